@@ -0,0 +1,122 @@
+#include "barcode_index.h"
+#include <algorithm>
+
+namespace
+{
+	const int kSeeds = 16;
+}
+
+bool BarcodeIndex::build(const std::vector<uint64_t>& aBarcodes)
+{
+	iPilots.clear();
+	iSlots.clear();
+
+	std::vector<uint64_t> sorted = aBarcodes;
+	std::sort(sorted.begin(), sorted.end());
+	if (std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end())
+	{
+		return false;
+	}
+	if (aBarcodes.empty())
+	{
+		return true;
+	}
+
+	uint32_t bucketCount = (uint32_t)std::max<size_t>(1, (aBarcodes.size() + kBucketSize - 1) / kBucketSize);
+	for (int seed = 0; seed < kSeeds; ++seed)
+	{
+		iSeed = mix(seed + 1);
+		std::vector<std::vector<uint32_t>> buckets(bucketCount);
+		for (uint32_t b = 0; b < aBarcodes.size(); ++b)
+		{
+			buckets[range(mix(aBarcodes[b] ^ iSeed), bucketCount)].push_back(b);
+		}
+		if (place(aBarcodes, buckets))
+		{
+			return true;
+		}
+	}
+	iPilots.clear();
+	iSlots.clear();
+	return false;
+}
+
+/*
+ The largest buckets are placed first, while most slots are free. The last buckets (single barcodes)
+ each need a pilot reaching one of the few slots left, so the search allows many more pilots than there are slots.
+ */
+bool BarcodeIndex::place(const std::vector<uint64_t>& aBarcodes, const std::vector<std::vector<uint32_t>>& aBuckets)
+{
+	size_t size = aBarcodes.size();
+	iPilots.assign(aBuckets.size(), 0);
+	iSlots.assign(size, Slot{ 0, 0 });
+	std::vector<unsigned char> taken(size, 0);
+
+	std::vector<uint32_t> order(aBuckets.size());
+	for (uint32_t b = 0; b < order.size(); ++b)
+	{
+		order[b] = b;
+	}
+	std::stable_sort(order.begin(), order.end(), [&aBuckets](uint32_t aBucket, uint32_t aOther) { return aBuckets[aBucket].size() > aBuckets[aOther].size(); });
+
+	uint64_t maxPilot = std::min<uint64_t>(UINT32_MAX, std::max<uint64_t>(64 * size, 1 << 16));
+	std::vector<uint64_t> hashes;
+	std::vector<uint32_t> slots;
+	for (uint32_t bucket : order)
+	{
+		const std::vector<uint32_t>& barcodes = aBuckets[bucket];
+		if (barcodes.empty())
+		{
+			break;
+		}
+
+		hashes.clear();
+		for (uint32_t b : barcodes)
+		{
+			hashes.push_back(mix(aBarcodes[b] ^ iSeed));
+		}
+		// (two barcodes with the same hash always go to the same slot)
+		for (size_t h = 1; h < hashes.size(); ++h)
+		{
+			if (std::find(hashes.begin(), hashes.begin() + h, hashes[h]) != hashes.begin() + h)
+			{
+				return false;
+			}
+		}
+
+		uint64_t pilot = 0;
+		for (; pilot < maxPilot; ++pilot)
+		{
+			slots.clear();
+			bool free = true;
+			for (size_t h = 0; h < hashes.size() && free; ++h)
+			{
+				uint32_t slot = position(hashes[h], (uint32_t)pilot);
+				free = !taken[slot] && std::find(slots.begin(), slots.end(), slot) == slots.end();
+				slots.push_back(slot);
+			}
+			if (free)
+			{
+				break;
+			}
+		}
+		if (pilot == maxPilot)
+		{
+			return false;
+		}
+
+		iPilots[bucket] = (uint32_t)pilot;
+		for (size_t h = 0; h < barcodes.size(); ++h)
+		{
+			taken[slots[h]] = 1;
+			iSlots[slots[h]].iBarcode = aBarcodes[barcodes[h]];
+			iSlots[slots[h]].iIndex = barcodes[h];
+		}
+	}
+	return true;
+}
+
+size_t BarcodeIndex::bytes() const
+{
+	return iPilots.capacity() * sizeof(uint32_t) + iSlots.capacity() * sizeof(Slot);
+}
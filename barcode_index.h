@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Maps barcodes (EAN/GTIN: sparse 64 bit numbers) to dense indices 0..n-1, their positions in the list it was built from,
+ * so the engine can key items by a dense id (Item::iId) and use flat arrays and bitmaps (e.g. IdSet) instead of trees and hash maps.
+ *
+ * Built once, at load time, as a minimal perfect hash (hash and displace, as CHD): the barcodes are hashed into buckets of about
+ * kBucketSize, and each bucket is given a displacement (a "pilot") which sends all its barcodes to free slots of a table with
+ * exactly one slot per barcode. Buckets are placed largest first, while the table is emptiest.
+ *
+ * A lookup is two hashes, a read of the bucket's pilot, and a read of the slot (which holds the barcode, to reject
+ * barcodes not in the list, and its index): the same work for every barcode, with no probing.
+ */
+class BarcodeIndex
+{
+public:
+	static const int kBucketSize = 4;
+
+	// false if aBarcodes repeats a barcode (the index is then empty)
+	bool build(const std::vector<uint64_t>& aBarcodes);
+
+	// aBarcode's position in the list (-1 if it is not in the list)
+	int find(uint64_t aBarcode) const
+	{
+		if (iSlots.empty())
+		{
+			return -1;
+		}
+		uint64_t hash = mix(aBarcode ^ iSeed);
+		uint32_t slot = position(hash, iPilots[range(hash, (uint32_t)iPilots.size())]);
+		return iSlots[slot].iBarcode == aBarcode ? (int)iSlots[slot].iIndex : -1;
+	};
+
+	size_t size() const { return iSlots.size(); };
+
+	// Memory used by the tables
+	size_t bytes() const;
+
+private:
+	struct Slot
+	{
+		uint64_t iBarcode;
+		uint32_t iIndex;
+	};
+
+	// splitmix64's finaliser
+	static uint64_t mix(uint64_t aValue)
+	{
+		aValue = (aValue ^ (aValue >> 30)) * 0xbf58476d1ce4e5b9ull;
+		aValue = (aValue ^ (aValue >> 27)) * 0x94d049bb133111ebull;
+		return aValue ^ (aValue >> 31);
+	};
+
+	// aHash's high 32 bits scaled to [0, aSize)
+	static uint32_t range(uint64_t aHash, uint32_t aSize)
+	{
+		return (uint32_t)(((aHash >> 32) * aSize) >> 32);
+	};
+
+	uint32_t position(uint64_t aHash, uint32_t aPilot) const
+	{
+		return range(mix(aHash + aPilot), (uint32_t)iSlots.size());
+	};
+
+	// Finds each bucket a pilot (aBuckets: positions in aBarcodes). false if one cannot be found (try another seed).
+	bool place(const std::vector<uint64_t>& aBarcodes, const std::vector<std::vector<uint32_t>>& aBuckets);
+
+	uint64_t iSeed{ 0 };
+	std::vector<uint32_t> iPilots;	// per bucket
+	std::vector<Slot> iSlots;
+};
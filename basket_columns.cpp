@@ -0,0 +1,345 @@
+#include "basket_columns.h"
+#include <algorithm>
+
+// The vector kernels are compiled for AVX2 and SSE4.1 whatever the build's instruction set, and chosen when first used
+// by what the CPU running them supports, so one binary runs (scalar at worst) on any x86-64
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define COLUMN_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+BasketColumns::BasketColumns(const std::vector<std::vector<Item>>& aBaskets) :
+	iBaskets(aBaskets.size()), iStride((aBaskets.size() + 7) / 8 * 8)
+{
+	for (size_t b = 0; b < aBaskets.size(); ++b)
+	{
+		// Quantity and price of each id in this basket
+		std::map<int, std::pair<int, int>> counts;
+		bool regular = true;
+		for (const Item& item : aBaskets[b])
+		{
+			auto find = counts.find(item.iId);
+			if (find == counts.end())
+			{
+				counts[item.iId] = std::make_pair(1, item.iUnitPrice);
+			}
+			else if (find->second.second != item.iUnitPrice || ++find->second.first >= kColumnMaxQuantity)
+			{
+				regular = false;
+				break;
+			}
+		}
+
+		if (!regular)
+		{
+			iIrregular[b] = aBaskets[b];
+			continue;
+		}
+
+		for (auto& entry : counts)
+		{
+			auto column = iColumnOfId.find(entry.first);
+			if (column == iColumnOfId.end())
+			{
+				column = iColumnOfId.insert(std::make_pair(entry.first, iColumnOfId.size())).first;
+				iQuantities.resize(iQuantities.size() + iStride, 0);
+				iPrices.resize(iPrices.size() + iStride, 0);
+			}
+
+			iQuantities[column->second * iStride + b] = entry.second.first;
+			iPrices[column->second * iStride + b] = entry.second.second;
+		}
+	}
+}
+
+const int* BasketColumns::quantities(int aId) const
+{
+	auto find = iColumnOfId.find(aId);
+	return (find == iColumnOfId.end()) ? nullptr : &iQuantities[find->second * iStride];
+}
+
+const int* BasketColumns::prices(int aId) const
+{
+	auto find = iColumnOfId.find(aId);
+	return (find == iColumnOfId.end()) ? nullptr : &iPrices[find->second * iStride];
+}
+
+int dealTally(const Deal& aDeal, std::vector<Item> aBasket, int& aSaving)
+{
+	int applications = 0;
+	aSaving = 0;
+	while (true)
+	{
+		std::vector<std::pair<Item, int>> result = aDeal.evaluate(aBasket);
+		if (result.size() == 0)
+		{
+			return applications;
+		}
+
+		++applications;
+		for (std::pair<Item, int>& pair : result)
+		{
+			aSaving += pair.first.iUnitPrice - pair.second;
+
+			auto find = std::find(aBasket.begin(), aBasket.end(), pair.first);
+			if (find != aBasket.end())
+			{
+				aBasket.erase(find);
+			}
+		}
+	}
+}
+
+/*
+ * Each time the deal applies it takes A of X and B of Y (when X == Y, max(A, B) of X, the first B as targets),
+ * so on a basket with one price per id:
+ *   applications = min(quantity X / A, quantity Y / B)	(a count of 0 sets no limit)
+ *   saving = applications * B * (price Y - Z)
+ *
+ * There is no vector integer division, so the quotient is estimated with floats and then corrected
+ * by at most one either way (exact, as quantities are below kColumnMaxQuantity).
+ */
+namespace
+{
+	// Baskets per instruction this CPU supports
+	int detectLanes()
+	{
+#if defined(COLUMN_KERNELS_X86)
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2"))
+		{
+			return 8;
+		}
+		if (__builtin_cpu_supports("sse4.1"))
+		{
+			return 4;
+		}
+#endif
+		return 1;
+	}
+
+#if defined(COLUMN_KERNELS_X86)
+	// The vector kernels below each return how many baskets they did (a multiple of their lanes); the caller does the rest
+
+	__attribute__((target("avx2")))
+	__m256i divide8(__m256i aQuantity, __m256 aInverse, __m256i aCount)
+	{
+		__m256i quotient = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(aQuantity), aInverse));
+
+		// -1 where quotient * count > quantity
+		__m256i over = _mm256_cmpgt_epi32(_mm256_mullo_epi32(quotient, aCount), aQuantity);
+		quotient = _mm256_add_epi32(quotient, over);
+
+		// +1 where (quotient + 1) * count <= quantity
+		__m256i next = _mm256_add_epi32(_mm256_mullo_epi32(quotient, aCount), aCount);
+		__m256i under = _mm256_cmpgt_epi32(next, aQuantity);
+		return _mm256_sub_epi32(_mm256_add_epi32(quotient, _mm256_set1_epi32(1)), _mm256_and_si256(under, _mm256_set1_epi32(1)));
+	}
+
+	__attribute__((target("avx2")))
+	size_t applicationsAvx2(const int* aFirst, int aFirstCount, const int* aSecond, int aSecondCount,
+		size_t aStride, int* aApplications)
+	{
+		const __m256 firstInverse = _mm256_set1_ps(1.0f / aFirstCount);
+		const __m256 secondInverse = _mm256_set1_ps(1.0f / aSecondCount);
+		const __m256i firstCount = _mm256_set1_epi32(aFirstCount);
+		const __m256i secondCount = _mm256_set1_epi32(aSecondCount);
+
+		size_t b = 0;
+		for (; b + 8 <= aStride; b += 8)
+		{
+			__m256i first = _mm256_loadu_si256((const __m256i*)(aFirst + b));
+			__m256i second = _mm256_loadu_si256((const __m256i*)(aSecond + b));
+			__m256i applications = _mm256_min_epi32(divide8(first, firstInverse, firstCount), divide8(second, secondInverse, secondCount));
+			_mm256_storeu_si256((__m256i*)(aApplications + b), applications);
+		}
+		return b;
+	}
+
+	__attribute__((target("sse4.1")))
+	__m128i divide4(__m128i aQuantity, __m128 aInverse, __m128i aCount)
+	{
+		__m128i quotient = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(aQuantity), aInverse));
+
+		__m128i over = _mm_cmpgt_epi32(_mm_mullo_epi32(quotient, aCount), aQuantity);
+		quotient = _mm_add_epi32(quotient, over);
+
+		__m128i next = _mm_add_epi32(_mm_mullo_epi32(quotient, aCount), aCount);
+		__m128i under = _mm_cmpgt_epi32(next, aQuantity);
+		return _mm_sub_epi32(_mm_add_epi32(quotient, _mm_set1_epi32(1)), _mm_and_si128(under, _mm_set1_epi32(1)));
+	}
+
+	__attribute__((target("sse4.1")))
+	size_t applicationsSse41(const int* aFirst, int aFirstCount, const int* aSecond, int aSecondCount,
+		size_t aStride, int* aApplications)
+	{
+		const __m128 firstInverse = _mm_set1_ps(1.0f / aFirstCount);
+		const __m128 secondInverse = _mm_set1_ps(1.0f / aSecondCount);
+		const __m128i firstCount = _mm_set1_epi32(aFirstCount);
+		const __m128i secondCount = _mm_set1_epi32(aSecondCount);
+
+		size_t b = 0;
+		for (; b + 4 <= aStride; b += 4)
+		{
+			__m128i first = _mm_loadu_si128((const __m128i*)(aFirst + b));
+			__m128i second = _mm_loadu_si128((const __m128i*)(aSecond + b));
+			__m128i applications = _mm_min_epi32(divide4(first, firstInverse, firstCount), divide4(second, secondInverse, secondCount));
+			_mm_storeu_si128((__m128i*)(aApplications + b), applications);
+		}
+		return b;
+	}
+
+	__attribute__((target("avx2")))
+	size_t savingsAvx2(const int* aApplications, const int* aPrices, int aCount, int aDealPrice,
+		size_t aStride, int* aSavings)
+	{
+		const __m256i count = _mm256_set1_epi32(aCount);
+		const __m256i dealPrice = _mm256_set1_epi32(aDealPrice);
+		size_t b = 0;
+		for (; b + 8 <= aStride; b += 8)
+		{
+			__m256i applications = _mm256_loadu_si256((const __m256i*)(aApplications + b));
+			__m256i prices = _mm256_loadu_si256((const __m256i*)(aPrices + b));
+			__m256i saving = _mm256_mullo_epi32(_mm256_mullo_epi32(applications, count), _mm256_sub_epi32(prices, dealPrice));
+			_mm256_storeu_si256((__m256i*)(aSavings + b), saving);
+		}
+		return b;
+	}
+
+	__attribute__((target("sse4.1")))
+	size_t savingsSse41(const int* aApplications, const int* aPrices, int aCount, int aDealPrice,
+		size_t aStride, int* aSavings)
+	{
+		const __m128i count = _mm_set1_epi32(aCount);
+		const __m128i dealPrice = _mm_set1_epi32(aDealPrice);
+		size_t b = 0;
+		for (; b + 4 <= aStride; b += 4)
+		{
+			__m128i applications = _mm_loadu_si128((const __m128i*)(aApplications + b));
+			__m128i prices = _mm_loadu_si128((const __m128i*)(aPrices + b));
+			__m128i saving = _mm_mullo_epi32(_mm_mullo_epi32(applications, count), _mm_sub_epi32(prices, dealPrice));
+			_mm_storeu_si128((__m128i*)(aSavings + b), saving);
+		}
+		return b;
+	}
+#endif
+
+	// aApplications[b] = min(aFirst[b] / aFirstCount, aSecond[b] / aSecondCount) for b < aStride
+	void applicationsKernel(const int* aFirst, int aFirstCount, const int* aSecond, int aSecondCount,
+		size_t aStride, int* aApplications)
+	{
+		size_t b = 0;
+#if defined(COLUMN_KERNELS_X86)
+		int lanes = columnLanes();
+		if (lanes == 8)
+		{
+			b = applicationsAvx2(aFirst, aFirstCount, aSecond, aSecondCount, aStride, aApplications);
+		}
+		else if (lanes == 4)
+		{
+			b = applicationsSse41(aFirst, aFirstCount, aSecond, aSecondCount, aStride, aApplications);
+		}
+#endif
+
+		for (; b < aStride; ++b)
+		{
+			aApplications[b] = std::min(aFirst[b] / aFirstCount, aSecond[b] / aSecondCount);
+		}
+	}
+
+	// aSavings[b] = aApplications[b] * aCount * (aPrices[b] - aDealPrice) for b < aStride
+	void savingsKernel(const int* aApplications, const int* aPrices, int aCount, int aDealPrice,
+		size_t aStride, int* aSavings)
+	{
+		size_t b = 0;
+#if defined(COLUMN_KERNELS_X86)
+		int lanes = columnLanes();
+		if (lanes == 8)
+		{
+			b = savingsAvx2(aApplications, aPrices, aCount, aDealPrice, aStride, aSavings);
+		}
+		else if (lanes == 4)
+		{
+			b = savingsSse41(aApplications, aPrices, aCount, aDealPrice, aStride, aSavings);
+		}
+#endif
+
+		for (; b < aStride; ++b)
+		{
+			aSavings[b] = aApplications[b] * aCount * (aPrices[b] - aDealPrice);
+		}
+	}
+}
+
+void evaluateColumns(const BuyAofXGetBofYForZ& aDeal, const BasketColumns& aColumns,
+	std::vector<int>& aApplications, std::vector<int>& aSavings)
+{
+	aApplications.assign(aColumns.stride(), 0);
+	aSavings.assign(aColumns.stride(), 0);
+
+	// The columns limiting the number of applications, and the units each application takes from them
+	const int* first = nullptr;
+	int firstCount = 0;
+	const int* second = nullptr;
+	int secondCount = 0;
+	bool found = true;
+
+	if (aDeal.selectionId() == aDeal.targetId())
+	{
+		firstCount = std::max(aDeal.selectionCount(), aDeal.targetCount());
+		first = aColumns.quantities(aDeal.selectionId());
+		found = (firstCount == 0 || first != nullptr);
+	}
+	else
+	{
+		if (aDeal.selectionCount() > 0)
+		{
+			firstCount = aDeal.selectionCount();
+			first = aColumns.quantities(aDeal.selectionId());
+			found = (first != nullptr);
+		}
+		if (aDeal.targetCount() > 0)
+		{
+			secondCount = aDeal.targetCount();
+			second = aColumns.quantities(aDeal.targetId());
+			found = found && (second != nullptr);
+		}
+	}
+
+	// (a deal taking no units never applies)
+	if (found && (firstCount > 0 || secondCount > 0) && aColumns.stride() > 0)
+	{
+		if (firstCount == 0)
+		{
+			first = second;
+			firstCount = secondCount;
+		}
+		if (secondCount == 0)
+		{
+			second = first;
+			secondCount = firstCount;
+		}
+
+		applicationsKernel(first, firstCount, second, secondCount, aColumns.stride(), &aApplications[0]);
+
+		if (aDeal.targetCount() > 0)
+		{
+			savingsKernel(&aApplications[0], aColumns.prices(aDeal.targetId()), aDeal.targetCount(), aDeal.targetUnitPrice(),
+				aColumns.stride(), &aSavings[0]);
+		}
+	}
+
+	aApplications.resize(aColumns.baskets());
+	aSavings.resize(aColumns.baskets());
+
+	for (auto& entry : aColumns.irregular())
+	{
+		aApplications[entry.first] = dealTally(aDeal, entry.second, aSavings[entry.first]);
+	}
+}
+
+int columnLanes()
+{
+	static const int lanes = detectLanes();
+	return lanes;
+}
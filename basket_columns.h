@@ -0,0 +1,56 @@
+#pragma once
+
+#include <map>
+#include <vector>
+
+#include "deal.h"
+
+/*
+ * Many baskets stored by column (structure of arrays): for each item id, the quantity in every basket
+ * and the unit price it has there. Used for bulk jobs (e.g. overnight re-pricing) which ask the same
+ * question of every basket, so a deal can be worked out for several baskets per instruction.
+ *
+ * Columns are padded to a multiple of 8 baskets (zero quantity in the padding).
+ * A basket is "irregular" if it has one item id at different unit prices, or a quantity too large
+ * for the vector division (kColumnMaxQuantity). Irregular baskets have no column entries and
+ * are evaluated item by item instead.
+ */
+class BasketColumns
+{
+public:
+	static constexpr int kColumnMaxQuantity = 1 << 20;
+
+	BasketColumns(const std::vector<std::vector<Item>>& aBaskets);
+
+	size_t baskets() const { return iBaskets; };
+	size_t stride() const { return iStride; };		// baskets() rounded up to a multiple of 8
+
+	// nullptr if no (regular) basket has the id
+	const int* quantities(int aId) const;
+	const int* prices(int aId) const;
+
+	bool regular(size_t aBasket) const { return iIrregular.count(aBasket) == 0; };
+	const std::map<size_t, std::vector<Item>>& irregular() const { return iIrregular; };
+
+private:
+	size_t iBaskets{ 0 };
+	size_t iStride{ 0 };
+
+	std::map<int, size_t> iColumnOfId;
+	std::vector<int> iQuantities;		// column * iStride + basket
+	std::vector<int> iPrices;
+
+	std::map<size_t, std::vector<Item>> iIrregular;
+};
+
+// Apply aDeal to aBasket until it no longer matches (as a checkout would with only this deal).
+// Returns the number of times it applied, aSaving is set to the total taken off the unit prices.
+int dealTally(const Deal& aDeal, std::vector<Item> aBasket, int& aSaving);
+
+// As dealTally, for every basket in aColumns (aApplications and aSavings are resized to aColumns.baskets()).
+// Vectorised with AVX2 (8 baskets per instruction) or SSE4.1 (4) when the CPU has them (checked at run time), scalar otherwise.
+void evaluateColumns(const BuyAofXGetBofYForZ& aDeal, const BasketColumns& aColumns,
+	std::vector<int>& aApplications, std::vector<int>& aSavings);
+
+// Baskets per instruction in evaluateColumns on this CPU (1 for the scalar kernels)
+int columnLanes();
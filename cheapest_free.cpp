@@ -0,0 +1,142 @@
+#include "cheapest_free.h"
+#include <algorithm>
+#include <limits>
+
+namespace
+{
+	/*
+	 * Apply the deals in aOrdering to the (sorted) items, marking the items used in aUsed.
+	 * Returns the total of the deal prices, adding a receipt line per item to aLines.
+	 */
+	int applyOrdering(const std::vector<Item>& aSorted, const std::vector<const BuyInSetOfXCheapestFree*>& aDeals, const std::vector<int>& aOrdering,
+		std::vector<bool>& aUsed, std::vector<Checkout::ReceiptLine>& aLines)
+	{
+		int total = 0;
+		std::vector<int> inSet;
+		for (int d : aOrdering)
+		{
+			const BuyInSetOfXCheapestFree* deal = aDeals[d];
+			int count = deal->targetCount();
+			if (count < 1)
+			{
+				continue; // never matches
+			}
+
+			inSet.clear();
+			for (int i = 0; i < aSorted.size(); ++i)
+			{
+				if (!aUsed[i] && deal->selectionIds().count(aSorted[i].iId))
+				{
+					inSet.push_back(i);
+				}
+			}
+
+			// Runs of count items, cheapest first
+			int matched = inSet.size() - inSet.size() % count;
+			for (int n = 0; n < matched; ++n)
+			{
+				const Item& item = aSorted[inSet[n]];
+				int price = (n % count == 0) ? 0 : item.iUnitPrice;
+				aUsed[inSet[n]] = true;
+				aLines.push_back(std::make_tuple(deal, item, price));
+				total += price;
+			}
+		}
+		return total;
+	}
+}
+
+bool solveCheapestFree(const std::vector<Item>& aInput, const std::vector<const Deal*>& aDeals, const CheckoutFeatures& aFeatures,
+	const SearchBudget& aBudget, Checkout::CheckoutResult& aResult, Checkout::CheckoutStats& aStats)
+{
+	std::vector<const BuyInSetOfXCheapestFree*> deals;
+	for (const Deal* deal : aDeals)
+	{
+		const BuyInSetOfXCheapestFree* inSet = dynamic_cast<const BuyInSetOfXCheapestFree*>(deal);
+		if (!inSet)
+		{
+			return false;
+		}
+		deals.push_back(inSet);
+	}
+
+	for (const std::vector<int>& component : aFeatures.iComponents)
+	{
+		if (component.size() > kCheapestFreeMaxDeals)
+		{
+			return false;
+		}
+	}
+
+	// The order BuyInSetOfXCheapestFree::evaluate takes items in
+	std::vector<Item> sorted = aInput;
+	std::sort(sorted.begin(), sorted.end(), [](const Item& item, const Item& other)
+	{
+		return item.iUnitPrice < other.iUnitPrice || (item.iUnitPrice == other.iUnitPrice && item.iId < other.iId);
+	});
+
+	Checkout::CheckoutResult result;
+	std::vector<bool> used(sorted.size(), false);
+	long evaluations = aStats.iDealEvaluations;
+	bool stopped = false;
+	auto outOfBudget = [&]()
+	{
+		stopped = stopped || aBudget.exhausted(evaluations);
+		return stopped;
+	};
+
+	for (const std::vector<int>& component : aFeatures.iComponents)
+	{
+		// Components only share items with themselves, so start from the same items each time
+		std::vector<int> ordering = component;
+		std::sort(ordering.begin(), ordering.end());
+
+		int bestSaving = std::numeric_limits<int>::min();
+		std::vector<bool> bestUsed;
+		std::vector<Checkout::ReceiptLine> bestLines;
+		do
+		{
+			++aStats.iOrderingsEvaluated;
+			evaluations += ordering.size();
+
+			std::vector<bool> componentUsed = used;
+			std::vector<Checkout::ReceiptLine> lines;
+			int total = applyOrdering(sorted, deals, ordering, componentUsed, lines);
+
+			// Items left over in this component are paid in full, so compare what was saved
+			int saving = -total;
+			for (const Checkout::ReceiptLine& line : lines)
+			{
+				saving += std::get<1>(line).iUnitPrice;
+			}
+
+			if (saving > bestSaving)
+			{
+				bestSaving = saving;
+				bestUsed = componentUsed;
+				bestLines = lines;
+			}
+		} while (std::next_permutation(ordering.begin(), ordering.end()) && !outOfBudget());	// (at least one ordering, so there is a receipt)
+
+		used = bestUsed;
+		result.iLines.insert(result.iLines.end(), bestLines.begin(), bestLines.end());
+	}
+
+	for (int i = 0; i < sorted.size(); ++i)
+	{
+		if (!used[i])
+		{
+			result.iLines.push_back(std::make_tuple(nullptr, sorted[i], sorted[i].iUnitPrice));
+		}
+	}
+
+	for (const Checkout::ReceiptLine& line : result.iLines)
+	{
+		result.iTotal += std::get<2>(line);
+	}
+
+	aStats.iDealEvaluations = evaluations;
+	result.iProvenOptimal = !stopped;
+	aResult = result;
+	return true;
+}
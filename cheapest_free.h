@@ -0,0 +1,30 @@
+#pragma once
+
+#include <vector>
+
+#include "checkout.h"
+
+/*
+ * Solver for checkouts where every deal is a BuyInSetOfXCheapestFree.
+ *
+ * Applied until it stops matching, one such deal sorts the items in its set by price and takes
+ * consecutive runs of X (the cheapest of each run free), leaving the (size % X) most expensive.
+ * So an ordering of deals can be priced with one pass over the sorted basket (no repeated Deal::evaluate calls),
+ * and deals whose sets share no items (and duplicate deals, see removeDominatedDeals) are independent.
+ *
+ * Only deals whose sets overlap have their orderings searched: with a basket of n items and
+ * components of k1, k2, ... overlapping deals, the work is O((k1! + k2! + ...) * k * n).
+ * That is polynomial in the basket, and a single set (or only disjoint sets) is one pass.
+ * It is not polynomial in the deals, so a component of more than kCheapestFreeMaxDeals is left to branch and bound,
+ * which prunes orderings that cannot win. Each deal applied in an ordering counts as one evaluation
+ * (in CheckoutStats::iDealEvaluations, and against aBudget). When the budget runs out, the best ordering so far is used, not proven optimal.
+ *
+ * (Matching/min-cost flow would give the grouping best for the customer, e.g. the most expensive items together,
+ * but a deal here always takes the cheapest X items in its set, so that grouping is not one checkoutItems can produce.)
+ */
+
+const int kCheapestFreeMaxDeals = 6;
+
+// false (and aResult unchanged) if any of aDeals is not a BuyInSetOfXCheapestFree, or a component has more than kCheapestFreeMaxDeals
+bool solveCheapestFree(const std::vector<Item>& aInput, const std::vector<const Deal*>& aDeals, const CheckoutFeatures& aFeatures,
+	const SearchBudget& aBudget, Checkout::CheckoutResult& aResult, Checkout::CheckoutStats& aStats);
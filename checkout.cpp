@@ -1,9 +1,22 @@
 #include "checkout.h"
+#include "ordering_cache.h"
+#include "deal_analysis.h"
+#include "deal_catalog.h"
+#include "cheapest_free.h"
+#include "thread_pool.h"
+#include "receipt_writer.h"
 #include <map>
+#include <set>
 #include <algorithm>
 #include <iostream>
 #include <tuple>
+#include <unordered_map>
 #include <limits>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <exception>
 
 /*
  * Given our original input and our checkout output
@@ -122,90 +135,502 @@ std::vector<const Deal*> Checkout::filterDeals(std::vector<const Deal*> aDeals,
  * the best deal permutation has been identified,
  * this function can build a printable receipt.
  */
-std::string Checkout::createReceipt(std::vector<std::tuple<const Deal*, Item, int>>& aInput, int aTotal)
+std::string Checkout::createReceipt(std::vector<std::tuple<const Deal*, Item, int>>& aInput, int aTotal, int aWidth)
 {
-	std::string receiptStr = "RECEIPT";
-	std::string headingFill = std::string((RECEIPT_WIDTH - receiptStr.length()) / 2, ' ');
-	std::string receipt = headingFill + receiptStr + headingFill + "\n";
+	// (an item line, maybe a deal line, and five more lines)
+	std::string receipt;
+	StringSink sink(receipt);
+	ReceiptWriter writer(sink, EReceiptText, aWidth);
+	receipt.reserve((2 * aInput.size() + 5) * (writer.width() + 1));
 
-	receipt += std::string(RECEIPT_WIDTH, '-') + '\n';
+	writer.write(aInput, aTotal);
+	return receipt;
+}
+
+namespace
+{
+	// A deal's use of a line of the basket, on the current path of a search (turned into a ReceiptLine for the best receipt only)
+	struct PathLine
+	{
+		const Deal* iDeal;
+		int iLine;
+		int iPrice;
+	};
+
+	/*
+	 * Evaluate a deal against the basket until it finds no more matching selections.
+	 * Affected lines are marked in aConsumed (deals cannot be used in conjunction) and recorded in aLines.
+	 * aResult is scratch space for Deal::evaluateLines, aSelections (optional) shares selector results between deals.
+	 * Returns the sum of the deal prices.
+	 */
+	int applyDeal(const Deal* aDeal, const std::vector<Item>& aBasket, std::vector<unsigned char>& aConsumed, std::vector<LinePrice>& aResult,
+		std::vector<PathLine>& aLines, Checkout::CheckoutStats& aStats, SelectionCache* aSelections = nullptr)
+	{
+		BasketView basket(aBasket.data(), aConsumed.data(), (int)aBasket.size(), aSelections);
+		int total = 0;
+		while (true)
+		{
+			++aStats.iDealEvaluations;
+			aDeal->evaluateLines(basket, aResult);
+			if (aResult.empty())
+			{
+				return total;
+			}
+
+			for (const LinePrice& linePrice : aResult)
+			{
+				aLines.push_back(PathLine{ aDeal, linePrice.first, linePrice.second });
+				total += linePrice.second;
+				aConsumed[linePrice.first] = 1;
+			}
+		}
+	}
 
-	// For every item (which may/may not have an associated Deal)...
-	for (std::tuple<const Deal*, Item, int>& tuple : aInput)
+	int unitPriceTotal(const std::vector<Item>& aInput)
 	{
-		const Deal* deal = std::get<0>(tuple);
-		int id = std::get<1>(tuple).iId;
-		int original_price = std::get<1>(tuple).iUnitPrice;
-		int price = std::get<2>(tuple);
-		
-		std::string idStr = std::get<1>(tuple).name();
-		std::string originalPriceStr = std::to_string(original_price); 
+		int total = 0;
+		for (const Item& item : aInput)
+		{
+			total += item.iUnitPrice;
+		}
+		return total;
+	}
+
+	/*
+	 * Depth first search over all orderings of the deals.
+	 *
+	 * Orderings which share a prefix share the work of evaluating that prefix.
+	 * A prefix is abandoned as soon as the deal prices alone reach the best total found so far
+	 * (prices are never negative, so the rest of the basket can only add to the total).
+	 *
+	 * Prefixes made of the same deals often leave the same items (e.g. deals which do not overlap, in either order).
+	 * What the rest of the ordering can cost depends only on those items and the deals left, so it is remembered
+	 * (the transposition table, of at most aTableEntries) and the next prefix to reach them does not search it again.
+	 */
+	class OrderingSearch
+	{
+	public:
+		OrderingSearch(const std::vector<Item>& aInput, const std::vector<const Deal*>& aDeals, Checkout::CheckoutStats& aStats, const SearchBudget& aBudget, size_t aTableEntries = 0)
+			: iInput(aInput), iDeals(aDeals), iStats(aStats), iBudget(aBudget), iTableEntries(aTableEntries), iUsed(aDeals.size(), false),
+			iConsumed(aDeals.size() + 1, std::vector<unsigned char>(aInput.size(), 0))
+		{};
+
+		/*
+		 * Build an ordering one deal at a time, each time picking the deal which
+		 * (applied repeatedly to what is left) saves the most.
+		 * Quick to find, and usually close to the best.
+		 */
+		void greedy()
+		{
+			std::vector<unsigned char> consumed(iInput.size(), 0);
+			std::vector<unsigned char> remaining;
+			std::vector<unsigned char> bestConsumed;
+			std::vector<PathLine> lines;
+			std::vector<int> ordering;
+			std::vector<bool> used(iDeals.size(), false);
+
+			for (int step = 0; step < iDeals.size(); ++step)
+			{
+				int bestDeal = -1;
+				int bestSaving = std::numeric_limits<int>::min();
+
+				for (int i = 0; i < iDeals.size(); ++i)
+				{
+					if (used[i])
+					{
+						continue;
+					}
+
+					remaining = consumed;
+					lines.clear();
+					int dealTotal = applyDeal(iDeals[i], iInput, remaining, iResult, lines, iStats, &iSelections);
+					int saving = -dealTotal;
+					for (const PathLine& line : lines)
+					{
+						saving += iInput[line.iLine].iUnitPrice;
+					}
+					if (saving > bestSaving)
+					{
+						bestDeal = i;
+						bestSaving = saving;
+						bestConsumed = remaining;
+					}
+				}
+
+				used[bestDeal] = true;
+				ordering.push_back(bestDeal);
+				consumed = bestConsumed;
+			}
+
+			tryOrdering(ordering);
+		}
+
+		// Seed the search with the 'no deals' case
+		void noDeals()
+		{
+			iBestLines.clear();
+			for (const Item& item : iInput)
+			{
+				iBestLines.push_back(std::make_tuple(nullptr, item, item.iUnitPrice));
+			}
+			iBestTotal = unitPriceTotal(iInput);
+			iBestOrdering.clear();
+		}
+
+		// Price a complete ordering, keeping it if it beats the best so far
+		void tryOrdering(const std::vector<int>& aOrdering)
+		{
+			std::vector<unsigned char> consumed(iInput.size(), 0);
+			std::vector<PathLine> lines;
+			int total = 0;
+			for (int i : aOrdering)
+			{
+				total += applyDeal(iDeals[i], iInput, consumed, iResult, lines, iStats, &iSelections);
+			}
+			leaf(aOrdering, lines, consumed, total);
+		}
+
+		void search()
+		{
+			bool exact;
+			descend(0, 0, exact);
+		}
+
+		// Every permutation, each evaluated from the start (at least one, so there is always a receipt)
+		void bruteForce()
+		{
+			std::vector<int> ordering;
+			for (int i = 0; i < iDeals.size(); ++i)
+			{
+				ordering.push_back(i);
+			}
+
+			do
+			{
+				tryOrdering(ordering);
+			} while (std::next_permutation(ordering.begin(), ordering.end()) && !outOfBudget());
+		}
+
+		// false if the search stopped early (so there may be a better ordering)
+		bool complete() const { return !iStopped; };
+
+		long selectionsShared() const { return iSelections.hits(); };
+
+		int bestTotal() const { return iBestTotal; };
+		const std::vector<Checkout::ReceiptLine>& bestLines() const { return iBestLines; };
+		const std::vector<int>& bestOrdering() const { return iBestOrdering; };
+
+	private:
+		// What the rest of an ordering costs (the deals left, then the items left at their unit price)
+		struct Remainder
+		{
+			int iTotal;
+			bool iExact;	// else the least it could cost
+		};
+
+		struct KeyHash
+		{
+			size_t operator()(const std::vector<int>& aKey) const
+			{
+				size_t hash = 14695981039346656037ull;
+				for (int value : aKey)
+				{
+					hash = (hash ^ (unsigned)value) * 1099511628211ull;
+				}
+				return hash;
+			}
+		};
+
+		/*
+		 The lines used by the deals so far are iConsumed[aDepth] (aDepth = the number of deals so far).
+		 Returns the least the rest of the ordering can cost: exactly (aExact) if every ordering of the deals left was priced,
+		 otherwise a lower bound (from the deal prices of the orderings which were abandoned).
+		 A remembered remainder is used if it shows this prefix cannot beat the best total.
+		 One which could beat it is searched again, to find its receipt.
+		 */
+		int descend(int aDepth, int aPartialTotal, bool& aExact)
+		{
+			const std::vector<unsigned char>& consumed = iConsumed[aDepth];
+			aExact = false;
+			if (aPartialTotal >= iBestTotal)
+			{
+				++iStats.iOrderingsPruned;
+				return 0;
+			}
+
+			if (iOrdering.size() == iDeals.size())
+			{
+				leaf(iOrdering, iLines, consumed, aPartialTotal);
+				aExact = true;
+				return remainingTotal(consumed);
+			}
+
+			// (only other prefixes of two or more deals can reach the same items, and the last deal is quicker to apply than look up)
+			bool remember = iTableEntries > 0 && iOrdering.size() >= 2 && iDeals.size() - iOrdering.size() >= 2;
+			if (remember)
+			{
+				makeKey(consumed);
+				auto find = iTable.find(iKey);
+				if (find != iTable.end())
+				{
+					++iStats.iTranspositionHits;
+					if (aPartialTotal + find->second.iTotal >= iBestTotal)
+					{
+						aExact = find->second.iExact;
+						return find->second.iTotal;
+					}
+				}
+			}
+
+			int lowest = std::numeric_limits<int>::max();
+			bool exact = true;
+			for (int i = 0; i < iDeals.size(); ++i)
+			{
+				if (iUsed[i])
+				{
+					continue;
+				}
+
+				if (outOfBudget())
+				{
+					return 0;
+				}
+
+				iUsed[i] = true;
+				iOrdering.push_back(i);
+				size_t numLines = iLines.size();
+
+				iConsumed[aDepth + 1] = consumed;
+				int dealTotal = applyDeal(iDeals[i], iInput, iConsumed[aDepth + 1], iResult, iLines, iStats, &iSelections);
+				bool rest;
+				lowest = std::min(lowest, dealTotal + descend(aDepth + 1, aPartialTotal + dealTotal, rest));
+				exact = exact && rest;
+
+				iLines.erase(iLines.begin() + numLines, iLines.end());
+				iOrdering.pop_back();
+				iUsed[i] = false;
+			}
 
-		// If we have a deal fo this item, we
-		// put the original price in brackets,
-		// and the deal price will be on the next line
-		if (original_price != price)
+			if (remember && !iStopped)
+			{
+				if (iTable.size() >= iTableEntries)
+				{
+					iTable.clear();
+				}
+				makeKey(consumed);
+				iTable[iKey] = Remainder{ lowest, exact };
+			}
+			aExact = exact && !iStopped;
+			return iStopped ? 0 : lowest;
+		}
+
+		// The deals used so far, then the items left (in order, as deals may depend on it)
+		void makeKey(const std::vector<unsigned char>& aConsumed)
+		{
+			iKey.assign((iDeals.size() + 31) / 32, 0);
+			for (int i = 0; i < iDeals.size(); ++i)
+			{
+				if (iUsed[i])
+				{
+					iKey[i / 32] |= 1u << (i % 32);
+				}
+			}
+			for (int line = 0; line < iInput.size(); ++line)
+			{
+				if (!aConsumed[line])
+				{
+					iKey.push_back(iInput[line].iId);
+					iKey.push_back(iInput[line].iUnitPrice);
+				}
+			}
+		}
+
+		int remainingTotal(const std::vector<unsigned char>& aConsumed) const
 		{
-			originalPriceStr = "(" + originalPriceStr + ")";
+			int total = 0;
+			for (int line = 0; line < iInput.size(); ++line)
+			{
+				if (!aConsumed[line])
+				{
+					total += iInput[line].iUnitPrice;
+				}
+			}
+			return total;
 		}
 
-		std::string priceStr = std::to_string(price);
+		// All deals applied: add any items which have not been matched by a deal
+		void leaf(const std::vector<int>& aOrdering, const std::vector<PathLine>& aLines, const std::vector<unsigned char>& aConsumed, int aDealTotal)
+		{
+			++iStats.iOrderingsEvaluated;
 
-		// Print ITEM
-		std::string line(RECEIPT_WIDTH, ' ');
-		line.replace(line.begin(), line.begin() + idStr.length(), idStr);
+			int total = aDealTotal + remainingTotal(aConsumed);
+			if (total >= iBestTotal)
+			{
+				return;
+			}
 
-		// Print PRICE
-		std::string receipt_price = (deal) ? originalPriceStr : priceStr;
-		line.replace(line.begin() + RECEIPT_WIDTH - receipt_price.length(), line.end(), receipt_price);
-		line += '\n';
-    	receipt += line;
+			iBestTotal = total;
+			iBestOrdering = aOrdering;
+			iBestLines.clear();
+			for (const PathLine& line : aLines)
+			{
+				iBestLines.push_back(std::make_tuple(line.iDeal, iInput[line.iLine], line.iPrice));
+			}
+			for (int line = 0; line < iInput.size(); ++line)
+			{
+				if (!aConsumed[line])
+				{
+					iBestLines.push_back(std::make_tuple(nullptr, iInput[line], iInput[line].iUnitPrice));
+				}
+			}
+		}
 
-		// Insert Deal Info:
-		if (deal && original_price != price) // if this price was affected by deal
+		bool outOfBudget()
 		{
-			std::string line(RECEIPT_WIDTH, ' ');
-			std::string name = deal->name();
+			iStopped = iStopped || iBudget.exhausted(iStats.iDealEvaluations);
+			return iStopped;
+		}
+
+		const std::vector<Item>& iInput;
+		const std::vector<const Deal*>& iDeals;
+		Checkout::CheckoutStats& iStats;
 
-			//don't print all of name if it doesn't fit
-			int nameLen = std::min((int)name.length(), RECEIPT_WIDTH); 
-			auto endOfDealNameIter = line.begin() + nameLen;
+		const SearchBudget& iBudget;
+		bool iStopped{ false };
 
-			line.replace(line.begin(), endOfDealNameIter, name);
+		size_t iTableEntries;
+		std::unordered_map<std::vector<int>, Remainder, KeyHash> iTable;
+		std::vector<int> iKey;
 
-			// Do we have space to write the name and price?
-			int endOfDealNameIdx = nameLen + priceStr.length() + 1;
-			auto startOfPriceIdx = RECEIPT_WIDTH - priceStr.length();
+		// Current path
+		std::vector<bool> iUsed;
+		std::vector<int> iOrdering;
+		std::vector<PathLine> iLines;
+		std::vector<std::vector<unsigned char>> iConsumed;	// per depth
+		std::vector<LinePrice> iResult;
+		SelectionCache iSelections;
+
+		// Best so far
+		int iBestTotal{ std::numeric_limits<int>::max() };
+		std::vector<int> iBestOrdering;
+		std::vector<Checkout::ReceiptLine> iBestLines;
+	};
+
+	/*
+	 * Search the orderings of aDeals (which all apply to aInput).
+	 * aIncludeNoDeals: also consider applying no deals at all (as the permutation search always has).
+	 */
+	Checkout::CheckoutResult searchOrderings(std::vector<Item>& aInput, const std::vector<const Deal*>& aDeals, SolverStrategy aStrategy, bool aIncludeNoDeals,
+		const Checkout::CheckoutOptions& aOptions, const SearchBudget& aBudget, Checkout::CheckoutStats& aStats)
+	{
+		OrderingSearch search(aInput, aDeals, aStats, aBudget, aOptions.iTranspositionEntries);
+		if (aIncludeNoDeals)
+		{
+			search.noDeals();
+		}
+
+		if (aStrategy == ESolverBruteForce)
+		{
+			search.bruteForce();
+		}
+		else
+		{
+			std::vector<int> cached;
+			if (aOptions.iOrderingCache && aOptions.iOrderingCache->lookup(aDeals, cached))
+			{
+				++aStats.iWarmStarts;
+				search.tryOrdering(cached);
+			}
 
-			// Add elipsis to show text has been cut off..
-			if (endOfDealNameIdx > startOfPriceIdx)
+			// With a budget (or if it may be cancelled), make sure there is a good answer before the exhaustive search starts
+			if (aBudget.iEvaluationLimit > 0 || aBudget.iTimed || aBudget.iCancel)
 			{
-				auto elipsisIter = line.begin() + RECEIPT_WIDTH - priceStr.length() - 4;
-				line.replace(elipsisIter, elipsisIter + 4, "... ");
+				search.greedy();
 			}
 
-			line.replace(line.begin() + startOfPriceIdx, line.end(), priceStr);
-			line += '\n';
-			receipt += line;
+			search.search();
+
+			// Only complete orderings are cached ('no deals' is always tried anyway)
+			if (aOptions.iOrderingCache && search.bestOrdering().size() == aDeals.size() && !aDeals.empty())
+			{
+				aOptions.iOrderingCache->store(aDeals, search.bestOrdering());
+			}
 		}
+
+		Checkout::CheckoutResult result;
+		result.iTotal = search.bestTotal();
+		result.iLines = search.bestLines();
+		result.iProvenOptimal = search.complete();
+		aStats.iSelectionsShared += search.selectionsShared();
+		return result;
 	}
 
-	receipt += std::string(RECEIPT_WIDTH, '-');
-	receipt += '\n';
+	/*
+	 * Deals in different components never apply to the same item, so the order of deals
+	 * in one component does not change the result of another. The best ordering of all deals
+	 * is the best ordering of each component, and items not touched by any deal are charged in full.
+	 * As with the permutation search, 'no deals' at all is also considered (if aIncludeNoDeals).
+	 */
+	Checkout::CheckoutResult searchComponents(std::vector<Item>& aInput, const std::vector<const Deal*>& aDeals, const CheckoutFeatures& aFeatures, bool aIncludeNoDeals,
+		const Checkout::CheckoutOptions& aOptions, const SearchBudget& aBudget, Checkout::CheckoutStats& aStats)
+	{
+		Checkout::CheckoutResult result;
+		std::vector<bool> touched(aInput.size(), false);
 
-	std::string line(RECEIPT_WIDTH, ' ');
-	line.replace(line.begin(), line.begin() + 6, "Total:");
-	std::string totalStr = std::to_string(aTotal);
-	auto totalIter = line.begin() + line.length() - totalStr.length();
-	line.replace(totalIter, totalIter + totalStr.length(), totalStr);
-	line += '\n';
-	receipt += line;
+		for (const std::vector<int>& component : aFeatures.iComponents)
+		{
+			std::vector<const Deal*> deals;
+			for (int d : component)
+			{
+				deals.push_back(aDeals[d]);
+			}
 
-	return receipt;
+			std::vector<Item> items;
+			for (int i = 0; i < aInput.size(); ++i)
+			{
+				for (const Deal* deal : deals)
+				{
+					if (deal->selectsOn(aInput[i]) || deal->targets(aInput[i]))
+					{
+						items.push_back(aInput[i]);
+						touched[i] = true;
+						break;
+					}
+				}
+			}
+
+			Checkout::CheckoutResult part = searchOrderings(items, deals, ESolverBranchAndBound, false, aOptions, aBudget, aStats);
+			result.iTotal += part.iTotal;
+			result.iLines.insert(result.iLines.end(), part.iLines.begin(), part.iLines.end());
+			result.iProvenOptimal = result.iProvenOptimal && part.iProvenOptimal;
+		}
+
+		for (int i = 0; i < aInput.size(); ++i)
+		{
+			if (!touched[i])
+			{
+				result.iTotal += aInput[i].iUnitPrice;
+				result.iLines.push_back(std::make_tuple(nullptr, aInput[i], aInput[i].iUnitPrice));
+			}
+		}
+
+		int noDealsTotal = unitPriceTotal(aInput);
+		if (aIncludeNoDeals && noDealsTotal <= result.iTotal)
+		{
+			result.iTotal = noDealsTotal;
+			result.iLines.clear();
+			for (const Item& item : aInput)
+			{
+				result.iLines.push_back(std::make_tuple(nullptr, item, item.iUnitPrice));
+			}
+		}
+
+		return result;
+	}
 }
 
 /*
- Check out list of Items
+ Find the best deals for a list of Items
 
  Approach:
   We have a number of deals.
@@ -214,105 +639,490 @@ std::string Checkout::createReceipt(std::vector<std::tuple<const Deal*, Item, in
   The problem is that a deals may overlap, meaning that all combinations ("permutations") of deals need to be evaluated
   
  Method: 
-   Get all permutation of deals.
-   For each permutation:
+   Remove deals which are never better than another deal (see deal_analysis.h).
+   Choose how to search (CostModel) from cheap features of the checkout:
+     brute force (every permutation), branch and bound (OrderingSearch),
+     branch and bound on each group of deals which share no items, or
+     the specialised solver when every deal is "cheapest in set free" (see cheapest_free.h).
+   Start with the best ordering we know of (no deals, the ordering cached for these deals, or a greedy ordering if there is a budget).
+   Search the orderings of deals:
      Evaluate each deal in turn, providing the remaining input. 
      For each evaluation, remove the affected input from the list
      Continue to evaluate a deal until no more results are returned. Then proceed to next deal.
-     Save the permutation if its the best
+     Save the ordering if its the best
+   If a budget is given, the search stops when it runs out and the best ordering so far is returned (not proven optimal).
+   (solveAllDeals leaves out 'no deals', so groups of deals can be solved separately and added up)
+ */
+namespace
+{
+	Checkout::CheckoutResult solveDeals(std::vector<Item>& aInput, const std::vector<const Deal*>& aDeals, const Checkout::CheckoutOptions& aOptions, bool aIncludeNoDeals)
+	{
+		Checkout::CheckoutStats localStats;
+		Checkout::CheckoutStats& stats = aOptions.iStats ? *aOptions.iStats : localStats;
+		++stats.iCheckouts;
+
+		SearchBudget budget;
+		if (aOptions.iWorkBudget > 0)
+		{
+			budget.iEvaluationLimit = stats.iDealEvaluations + aOptions.iWorkBudget;
+		}
+		if (aOptions.iTimeBudget.count() > 0)
+		{
+			budget.iTimed = true;
+			budget.iDeadline = std::chrono::steady_clock::now() + aOptions.iTimeBudget;
+		}
+		budget.iCancel = aOptions.iCancel;
+
+		// (performance optimisation) Remove deals which do not affect aInput
+		// - likely to only be a few relevant deals for our Items
+		std::vector<const Deal*> deals = Checkout::filterDeals(aDeals, aInput);
+		if (aOptions.iTime != kAnyTime)
+		{
+			deals.erase(std::remove_if(deals.begin(), deals.end(), [&aOptions](const Deal* aDeal) { return !aDeal->activeAt(aOptions.iTime); }), deals.end());
+		}
+
+		// Deals which can never beat another deal only multiply the orderings to search
+		deals = removeDominatedDeals(deals, stats.iDealsPruned);
+
+		CheckoutFeatures features = checkoutFeatures(aInput, deals);
+
+		SolverStrategy strategy = aOptions.iStrategy;
+		if (strategy == ESolverAuto)
+		{
+			CostModel defaultModel;
+			strategy = (aOptions.iCostModel ? *aOptions.iCostModel : defaultModel).choose(features);
+		}
+
+		Checkout::CheckoutResult result;
+		if (strategy == ESolverCheapestFree && !solveCheapestFree(aInput, deals, features, budget, result, stats))
+		{
+			strategy = ESolverBranchAndBound; // not all "cheapest in set free" deals, or too many overlap
+		}
+		++stats.iStrategies[strategy];
+
+		if (strategy == ESolverDecomposed)
+		{
+			result = searchComponents(aInput, deals, features, aIncludeNoDeals, aOptions, budget, stats);
+		}
+		else if (strategy != ESolverCheapestFree)
+		{
+			result = searchOrderings(aInput, deals, strategy, aIncludeNoDeals, aOptions, budget, stats);
+		}
+
+		if (!result.iProvenOptimal)
+		{
+			result.iCancelled = aOptions.iCancel && aOptions.iCancel->load();
+			++(result.iCancelled ? stats.iCancelled : stats.iBudgetExhausted);
+		}
+
+		result.iStrategy = strategy;
+		return result;
+	}
+}
+
+Checkout::CheckoutResult Checkout::solve(std::vector<Item>& aInput, const std::vector<const Deal*>& aDeals, const CheckoutOptions& aOptions)
+{
+	return solveDeals(aInput, aDeals, aOptions, true);
+}
+
+Checkout::CheckoutResult Checkout::solveAllDeals(std::vector<Item>& aInput, const std::vector<const Deal*>& aDeals, const CheckoutOptions& aOptions)
+{
+	return solveDeals(aInput, aDeals, aOptions, false);
+}
+
+/*
+ Find the best deals for a list of Items, using a DealCatalog
+
+  Items with a PriceCurve (only affected by single item deals) are taken out of the search,
+  unless another candidate deal also applies to them (or the basket has that item at another price).
+  Their price comes from the curve, which is what the best ordering of their deals costs.
+  Deals on different items do not change each other's result, so the best ordering of all the deals
+  is the best for the rest of the basket plus the curves, unless 'no deals' at all is cheaper (as solve also considers).
+ */
+Checkout::CheckoutResult Checkout::solve(std::vector<Item>& aInput, const DealCatalog& aCatalog, const CheckoutOptions& aOptions)
+{
+	return solve(aInput, aCatalog, aCatalog.filterDeals(aInput, aOptions.iTime), aOptions);
+}
+
+Checkout::CheckoutResult Checkout::solve(std::vector<Item>& aInput, const DealOverlay& aOverlay, const CheckoutOptions& aOptions)
+{
+	return solve(aInput, aOverlay.catalog(), aOverlay.filterDeals(aInput, aOptions.iTime), aOptions);
+}
+
+Checkout::CheckoutResult Checkout::solve(std::vector<Item>& aInput, const DealCatalog& aCatalog, const std::vector<const Deal*>& aCandidates, const CheckoutOptions& aOptions)
+{
+	CheckoutStats localStats;
+	CheckoutStats& stats = aOptions.iStats ? *aOptions.iStats : localStats;
+
+	const std::vector<const Deal*>& deals = aCandidates;
+
+	// Items which could be priced from a curve, by id (every unit of the item must be at the curve's price)
+	std::map<int, const PriceCurve*> curves;
+	std::set<int> noCurve;
+	for (const Item& item : aInput)
+	{
+		const PriceCurve* curve = aCatalog.curve(item);
+		if (curve)
+		{
+			curves[item.iId] = curve;
+		}
+		else
+		{
+			noCurve.insert(item.iId);
+		}
+	}
+
+	for (int id : noCurve)
+	{
+		curves.erase(id);
+	}
+
+	// ... which no other deal applies to
+	for (const Deal* deal : deals)
+	{
+		for (const Item& item : aInput)
+		{
+			auto find = curves.find(item.iId);
+			if (find == curves.end() || !(deal->selectsOn(item) || deal->targets(item)))
+			{
+				continue;
+			}
+
+			const std::vector<SingleItemBundle>& bundles = find->second->bundles();
+			bool curveDeal = std::any_of(bundles.begin(), bundles.end(),
+				[deal](const SingleItemBundle& aBundle) { return aBundle.iDeal == deal; });
+			if (!curveDeal)
+			{
+				curves.erase(find);
+			}
+		}
+	}
+
+	std::map<int, std::vector<Item>> curveItems;
+	std::vector<Item> searchItems;
+	for (const Item& item : aInput)
+	{
+		if (curves.count(item.iId))
+		{
+			curveItems[item.iId].push_back(item);
+		}
+		else
+		{
+			searchItems.push_back(item);
+		}
+	}
+
+	std::vector<const Deal*> searchDeals;
+	for (const Deal* deal : deals)
+	{
+		SingleItemBundle bundle;
+		if (!singleItemBundle(deal, bundle) || curves.count(bundle.iItemId) == 0)
+		{
+			searchDeals.push_back(deal);
+		}
+	}
+
+	CheckoutResult result = solveAllDeals(searchItems, searchDeals, aOptions);
+	if (result.iLines.size() < searchItems.size())
+	{
+		// (a search stopped before it priced anything: never add to its unpriced total)
+		result.iTotal = unitPriceTotal(searchItems);
+		result.iLines.clear();
+		for (const Item& item : searchItems)
+		{
+			result.iLines.push_back(std::make_tuple(nullptr, item, item.iUnitPrice));
+		}
+	}
+	for (auto& entry : curveItems)
+	{
+		result.iTotal += curves[entry.first]->priceItems(entry.second, result.iLines);
+		stats.iCurvePricedItems += entry.second.size();
+	}
+
+	int noDealsTotal = unitPriceTotal(aInput);
+	if (noDealsTotal <= result.iTotal)
+	{
+		result.iTotal = noDealsTotal;
+		result.iLines.clear();
+		for (const Item& item : aInput)
+		{
+			result.iLines.push_back(std::make_tuple(nullptr, item, item.iUnitPrice));
+		}
+	}
+	return result;
+}
+
+/*
+ Check out list of Items
 
   Returns the checkout receipt
  */
 std::string Checkout::checkoutItems(std::vector<Item>& aInput, std::vector<const Deal*>& aDeals, int& aTotal)
 {
+	return checkoutItems(aInput, aDeals, aTotal, CheckoutOptions());
+}
 
-	// (performance optimisation) Remove deals which do not affect aInput
-	// - likely to only be a few relevant deals for our Items
+std::string Checkout::checkoutItems(std::vector<Item>& aInput, std::vector<const Deal*>& aDeals, int& aTotal, const CheckoutOptions& aOptions)
+{
+	// Remove deals which do not affect aInput
 	aDeals = filterDeals(aDeals, aInput);
 
-	std::map<int, int> bestDeal;
-	int lowest_total = std::numeric_limits<int>::max();
-	std::vector<std::tuple<const Deal*, Item, int>> best_result{};
+	CheckoutResult result = solve(aInput, aDeals, aOptions);
+	aTotal = result.iTotal;
 
-	// Get deal permutations
-	std::vector<std::vector<const Deal*>> dealPermutations = Checkout::dealCombinations(aDeals);
+	// Generate receipt
+	return createReceipt(result.iLines, result.iTotal);
+}
 
-	//Iterate permutations
-	for (int i = 0; i < dealPermutations.size(); ++i)
-	{
-		std::vector<const Deal*>& dealPermutation = dealPermutations[i];
-		
-		//copy input (we need to modify it if we get a match - items are not applicable to multiple deals)
-		std::vector<Item> input = aInput;
+std::string Checkout::checkoutItems(std::vector<Item>& aInput, const DealCatalog& aCatalog, int& aTotal, const CheckoutOptions& aOptions)
+{
+	CheckoutResult result = solve(aInput, aCatalog, aOptions);
+	aTotal = result.iTotal;
 
-		std::vector<std::tuple<const Deal*, Item, int>> current_result{};
+	return createReceipt(result.iLines, result.iTotal);
+}
+
+Checkout::CheckoutStats& Checkout::CheckoutStats::operator+=(const CheckoutStats& aOther)
+{
+	iCheckouts += aOther.iCheckouts;
+	iDealEvaluations += aOther.iDealEvaluations;
+	iOrderingsEvaluated += aOther.iOrderingsEvaluated;
+	iOrderingsPruned += aOther.iOrderingsPruned;
+	iWarmStarts += aOther.iWarmStarts;
+	iBudgetExhausted += aOther.iBudgetExhausted;
+	for (int s = 0; s < ESolverCount; ++s)
+	{
+		iStrategies[s] += aOther.iStrategies[s];
+	}
+	iDealsPruned += aOther.iDealsPruned;
+	iCurvePricedItems += aOther.iCurvePricedItems;
+	iComponentsReused += aOther.iComponentsReused;
+	iDealsNotEligible += aOther.iDealsNotEligible;
+	iBasketsShared += aOther.iBasketsShared;
+	iCancelled += aOther.iCancelled;
+	iTranspositionHits += aOther.iTranspositionHits;
+	iSelectionsShared += aOther.iSelectionsShared;
+	return *this;
+}
 
-		// For each deal in this permutation:
-		//   evaluate the deal on the input.
-		//   We have to do this repetitively for a specific deal (value of j) until the deal find no more matching selections in the input
+namespace
+{
+	// Runs tasks on a pool and waits for just those tasks (the pool may be shared).
+	// wait() rethrows the first exception a task threw, once they have all finished.
+	class TaskGroup
+	{
+	public:
+		TaskGroup(ThreadPool& aPool) : iPool(aPool) {};
 
-		for (int j = 0; j < dealPermutation.size(); /* increment when evaluate returns no result */)
+		void run(std::function<void()> aTask)
 		{
-			const Deal* deal = dealPermutation[j];
+			{
+				std::lock_guard<std::mutex> lock(iMutex);
+				++iPending;
+			}
 
-			// Evaluate - storing any items affected and the resultant unit price
-			std::vector<std::pair<Item, int>> result = deal->evaluate(input);
+			iPool.submit([this, aTask]
+			{
+				std::exception_ptr error;
+				try
+				{
+					aTask();
+				}
+				catch (...)
+				{
+					error = std::current_exception();
+				}
 
-			int numAffectItems = result.size();
-			if (numAffectItems == 0)
+				std::lock_guard<std::mutex> lock(iMutex);
+				if (error && !iError)
+				{
+					iError = error;
+				}
+				if (--iPending == 0)
+				{
+					iDone.notify_all();
+				}
+			});
+		}
+
+		void wait()
+		{
+			std::unique_lock<std::mutex> lock(iMutex);
+			iDone.wait(lock, [this] { return iPending == 0; });
+			if (iError)
 			{
-				// No items matched. Go to next deal.
-				++j;
-				continue;
+				std::exception_ptr error = iError;
+				iError = nullptr;
+				std::rethrow_exception(error);
 			}
+		}
 
-			// Deal matched some items...
+	private:
+		ThreadPool& iPool;
+		std::mutex iMutex;
+		std::condition_variable iDone;
+		int iPending{ 0 };
+		std::exception_ptr iError;
+	};
 
-			// Remove items from input (deals cannot be used in conjunction)
-			std::vector<std::pair<Item, int>>::const_iterator it = result.begin();
-			while (it != result.end())
-			{
-				std::tuple<const Deal*, Item, int> tuple = std::make_tuple(deal, it->first, it->second);
-				current_result.push_back(tuple);
+	// Identical baskets (in any order) have the same key
+	std::vector<std::tuple<int, int, std::string>> basketKey(const std::vector<Item>& aBasket)
+	{
+		std::vector<std::tuple<int, int, std::string>> key;
+		for (const Item& item : aBasket)
+		{
+			key.push_back(std::make_tuple(item.iId, item.iUnitPrice, item.iName));
+		}
+		std::sort(key.begin(), key.end());
+		return key;
+	}
+}
+
+/*
+ Find the best deals for many baskets
+
+  The catalog's deal index and price curves are shared by every basket.
+  Baskets are grouped by the deals which apply to them, so each thread works through baskets
+  with the same deals (an OrderingCache warm-starts each one from the last) and
+  identical baskets in a group are only solved once.
+ */
+std::vector<Checkout::CheckoutResult> Checkout::checkoutBatch(const std::vector<std::vector<Item>>& aBaskets, const DealCatalog& aCatalog, const BatchOptions& aOptions)
+{
+	const int chunkSize = 64;
 
-				const Item& item = (*it).first;
-				auto find = std::find(input.begin(), input.end(), item);
+	std::unique_ptr<ThreadPool> ownPool;
+	if (!aOptions.iPool)
+	{
+		ownPool.reset(new ThreadPool(aOptions.iThreads));
+	}
+	ThreadPool& pool = aOptions.iPool ? *aOptions.iPool : *ownPool;
 
-				// May have already been removed (e.g. smart deals)
-				if (find != input.end())
+	// The deals which apply to each basket
+	std::vector<std::vector<const Deal*>> candidates(aBaskets.size());
+	{
+		TaskGroup tasks(pool);
+		for (int first = 0; first < aBaskets.size(); first += chunkSize)
+		{
+			tasks.run([&, first]
+			{
+				for (int b = first; b < std::min<int>(first + chunkSize, aBaskets.size()); ++b)
 				{
-					input.erase(find);
+					candidates[b] = aCatalog.filterDeals(aBaskets[b], aOptions.iCheckout.iTime);
 				}
-				it++;
-			}
+			});
+		}
+		tasks.wait();
+	}
 
-			// Add deal results to map
-			int currentValue = bestDeal[i];
+	// Group by candidate deals, then by identical basket
+	std::map<std::vector<const Deal*>, std::map<std::vector<std::tuple<int, int, std::string>>, std::vector<int>>> groups;
+	for (int b = 0; b < aBaskets.size(); ++b)
+	{
+		groups[candidates[b]][basketKey(aBaskets[b])].push_back(b);
+	}
 
-			for (std::pair<Item, int>& pair : result)
+	// Work through each group in chunks: <first basket to solve, copies of it>
+	std::vector<std::vector<const std::vector<int>*>> chunks;
+	for (auto& group : groups)
+	{
+		for (auto& identical : group.second)
+		{
+			if (chunks.empty() || chunks.back().size() >= chunkSize || candidates[chunks.back().back()->front()] != group.first)
 			{
-				currentValue += pair.second;
+				chunks.push_back(std::vector<const std::vector<int>*>());
 			}
-			bestDeal[i] = currentValue;
+			chunks.back().push_back(&identical.second);
 		}
-		
-		// Add any values which have not been matched by a deal
-		for (Item item : input)
+	}
+
+	std::vector<CheckoutResult> results(aBaskets.size());
+	std::vector<CheckoutStats> chunkStats(chunks.size());
+	{
+		TaskGroup tasks(pool);
+		for (int c = 0; c < chunks.size(); ++c)
 		{
-			std::tuple<Deal*, Item, int> p = std::make_tuple(nullptr, item, item.iUnitPrice);
-			current_result.push_back(p);
-			bestDeal[i] += item.iUnitPrice;
+			tasks.run([&, c]
+			{
+				CheckoutOptions options = aOptions.iCheckout;
+				options.iStats = &chunkStats[c];
+
+				for (const std::vector<int>* identical : chunks[c])
+				{
+					int first = identical->front();
+					std::vector<Item> basket = aBaskets[first];
+					results[first] = solve(basket, aCatalog, candidates[first], options);
+
+					for (int b : *identical)
+					{
+						if (b != first)
+						{
+							results[b] = results[first];
+							++chunkStats[c].iBasketsShared;
+						}
+					}
+				}
+			});
 		}
+		tasks.wait();
+	}
 
-		if (bestDeal[i] < lowest_total)
+	if (aOptions.iCheckout.iStats)
+	{
+		for (const CheckoutStats& stats : chunkStats)
 		{
-			lowest_total = bestDeal[i];
-			best_result = current_result;
+			*aOptions.iCheckout.iStats += stats;
 		}
 	}
-	
-	aTotal = lowest_total;
 
-	// Generate receipt
-	return createReceipt(best_result, lowest_total);
+	return results;
+}
+
+/*
+ Asynchronous checkout
+
+  The basket is moved into the task, so the caller can go on changing its own copy.
+  A till cancelling a checkout (iCancel) gets the best receipt found so far, marked iCancelled.
+ */
+std::future<Checkout::CheckoutResult> Checkout::checkoutAsync(std::vector<Item> aInput, const DealCatalog& aCatalog, ThreadPool& aPool, const CheckoutOptions& aOptions)
+{
+	auto input = std::make_shared<std::vector<Item>>(std::move(aInput));
+	auto promise = std::make_shared<std::promise<CheckoutResult>>();
+	std::future<CheckoutResult> future = promise->get_future();
+
+	bool submitted = aPool.trySubmit([input, promise, &aCatalog, aOptions]()
+	{
+		try
+		{
+			promise->set_value(solve(*input, aCatalog, aOptions));
+		}
+		catch (...)
+		{
+			promise->set_exception(std::current_exception());
+		}
+	});
+
+	return submitted ? std::move(future) : std::future<CheckoutResult>();
+}
+
+bool Checkout::checkoutAsync(std::vector<Item> aInput, const DealCatalog& aCatalog, ThreadPool& aPool, const CheckoutOptions& aOptions,
+	std::function<void(CheckoutResult)> aDone, std::function<void(std::exception_ptr)> aFailed)
+{
+	auto input = std::make_shared<std::vector<Item>>(std::move(aInput));
+	return aPool.trySubmit([input, &aCatalog, aOptions, aDone, aFailed]()
+	{
+		CheckoutResult result;
+		try
+		{
+			result = solve(*input, aCatalog, aOptions);
+		}
+		catch (...)
+		{
+			if (aFailed)
+			{
+				aFailed(std::current_exception());
+			}
+			return;
+		}
+		aDone(std::move(result));
+	});
 }
@@ -2,7 +2,17 @@
 #pragma once
 
 #include <string>
+#include <chrono>
+#include <atomic>
+#include <functional>
+#include <future>
 #include "deal.h"
+#include "cost_model.h"
+
+class OrderingCache;
+class DealCatalog;
+class DealOverlay;
+class ThreadPool;
 
 
 
@@ -14,6 +24,68 @@ namespace Checkout
 {
 	constexpr int RECEIPT_WIDTH = 20;
 
+	// <Deal (nullptr if none), Item, price charged>
+	typedef std::tuple<const Deal*, Item, int> ReceiptLine;
+
+	/*
+	 * Counters describing the work done to find the best deals.
+	 * They accumulate across checkouts, so one instance can be shared by many calls.
+	 */
+	struct CheckoutStats
+	{
+		long iCheckouts{ 0 };
+		long iDealEvaluations{ 0 };		// deal evaluations (evaluate/evaluateLines)
+		long iOrderingsEvaluated{ 0 };	// complete deal orderings priced
+		long iOrderingsPruned{ 0 };		// partial orderings abandoned as they could not beat the best total
+		long iWarmStarts{ 0 };			// checkouts which started from a cached ordering
+		long iBudgetExhausted{ 0 };		// checkouts which ran out of budget before the search finished
+		long iStrategies[ESolverCount] = {};	// checkouts per SolverStrategy
+		long iDealsPruned{ 0 };			// deals removed before searching, as another deal is always at least as good
+		long iCurvePricedItems{ 0 };	// items priced from a PriceCurve rather than searched
+		long iComponentsReused{ 0 };	// groups of deals a CheckoutSession did not need to solve again
+		long iDealsNotEligible{ 0 };	// deals a CheckoutSession held back, as the basket did not meet their rules yet
+		long iBasketsShared{ 0 };		// baskets in a batch priced from an identical basket
+		long iCancelled{ 0 };			// checkouts whose search was cancelled before it finished
+		long iTranspositionHits{ 0 };	// partial orderings which reached a basket already searched (see CheckoutOptions::iTranspositionEntries)
+		long iSelectionsShared{ 0 };	// selector results a SmartDeal took from another deal with the same selector (see SelectionCache)
+
+		CheckoutStats& operator+=(const CheckoutStats& aOther);
+	};
+
+	struct CheckoutOptions
+	{
+		OrderingCache* iOrderingCache{ nullptr };	// optional, warm-starts the search
+		CheckoutStats* iStats{ nullptr };			// optional
+
+		SolverStrategy iStrategy{ ESolverAuto };	// force a strategy (e.g. to compare them)
+		const CostModel* iCostModel{ nullptr };		// optional, chooses the strategy (default thresholds if not given)
+
+		// Anytime mode: stop searching when either budget runs out (0 = no limit)
+		// and return the best receipt found so far.
+		long iWorkBudget{ 0 };							// deal evaluations
+		std::chrono::microseconds iTimeBudget{ 0 };
+
+		// Optional, the search stops (as if out of budget) once this is set, e.g. by a till when another item is scanned
+		const std::atomic<bool>* iCancel{ nullptr };
+
+		// The most partial orderings the branch and bound search remembers, by the items and deals left,
+		// so the rest of an ordering is only searched once however the same items were reached (0 = none)
+		size_t iTranspositionEntries{ 1 << 14 };
+
+		// When the checkout happens, for deals with validity windows (see Deal::addWindow): deals not valid then do not apply.
+		// kAnyTime: every deal applies
+		int64_t iTime{ kAnyTime };
+	};
+
+	struct CheckoutResult
+	{
+		std::vector<ReceiptLine> iLines;
+		int iTotal{ 0 };
+		bool iProvenOptimal{ true };	// false if the search ran out of budget
+		bool iCancelled{ false };		// the search was cancelled before it finished (the result is valid, but may not be the best)
+		SolverStrategy iStrategy{ ESolverAuto };	// strategy used
+	};
+
 	// Get permutations of deals
 	std::vector<std::vector<const Deal*>> dealCombinations(std::vector<const Deal*> aDeals);
 
@@ -21,10 +93,53 @@ namespace Checkout
 	// (There are likely to be many more deals than items, and many of the deals will not be applicable to those items)
 	std::vector<const Deal*> filterDeals(std::vector<const Deal*> aDeals, std::vector<Item>& aItems);
 
-	std::string createReceipt(std::vector<std::tuple<const Deal*, Item, int>>& aInput, int aTotal);
+	// Fixed width text (see ReceiptWriter for other formats, or to write into a buffer)
+	std::string createReceipt(std::vector<std::tuple<const Deal*, Item, int>>& aInput, int aTotal, int aWidth = RECEIPT_WIDTH);
+
+	// Find the best deals for aInput (without building a receipt)
+	CheckoutResult solve(std::vector<Item>& aInput, const std::vector<const Deal*>& aDeals, const CheckoutOptions& aOptions);
+
+	// As above, but only orderings which apply every deal (not 'no deals')
+	CheckoutResult solveAllDeals(std::vector<Item>& aInput, const std::vector<const Deal*>& aDeals, const CheckoutOptions& aOptions);
+
+	// As solve, with the deals prepared in a DealCatalog (items with a PriceCurve are priced without searching)
+	CheckoutResult solve(std::vector<Item>& aInput, const DealCatalog& aCatalog, const CheckoutOptions& aOptions);
+
+	// As above, when the deals which apply (aCatalog.filterDeals(aInput)) are already known
+	CheckoutResult solve(std::vector<Item>& aInput, const DealCatalog& aCatalog, const std::vector<const Deal*>& aCandidates, const CheckoutOptions& aOptions);
+
+	// As solve with a DealCatalog, with a customer's own deals on top of it
+	CheckoutResult solve(std::vector<Item>& aInput, const DealOverlay& aOverlay, const CheckoutOptions& aOptions);
+
+	struct BatchOptions
+	{
+		CheckoutOptions iCheckout;		// iStats totals the whole batch, an iOrderingCache is shared by all threads
+		ThreadPool* iPool{ nullptr };	// optional, a pool is made for the batch if not given
+		size_t iThreads{ 0 };			// size of the batch's own pool (0 = one thread per hardware thread)
+	};
+
+	// Find the best deals for many baskets (e.g. the day's orders), in the same order as aBaskets.
+	// If a checkout throws, the exception is rethrown here once the batch's other tasks have finished.
+	std::vector<CheckoutResult> checkoutBatch(const std::vector<std::vector<Item>>& aBaskets, const DealCatalog& aCatalog, const BatchOptions& aOptions);
+
+	/*
+	 * Find the best deals on aPool, without blocking the caller (e.g. a POS event loop).
+	 * aOptions is copied; whatever it points to (stats, cache, cancel flag) must outlive the checkout,
+	 * and iStats must not be shared with checkouts running at the same time.
+	 * Neither call waits for space in a bounded pool: the future is not valid(), or false is returned
+	 * (and aDone is never called), if the pool's queue is full.
+	 */
+	std::future<CheckoutResult> checkoutAsync(std::vector<Item> aInput, const DealCatalog& aCatalog, ThreadPool& aPool, const CheckoutOptions& aOptions);
+
+	// As above, calling aDone with the result on the pool's thread, or aFailed (if given) with the exception if the checkout throws.
+	// (An exception from aDone or aFailed is caught and counted by the pool: see ThreadPool::failed.)
+	bool checkoutAsync(std::vector<Item> aInput, const DealCatalog& aCatalog, ThreadPool& aPool, const CheckoutOptions& aOptions,
+		std::function<void(CheckoutResult)> aDone, std::function<void(std::exception_ptr)> aFailed = nullptr);
 
 	// prints receipt
 	std::string checkoutItems(std::vector<Item>& aInput, std::vector<const Deal*>& aDeals, int& aTotal);
+	std::string checkoutItems(std::vector<Item>& aInput, std::vector<const Deal*>& aDeals, int& aTotal, const CheckoutOptions& aOptions);
+	std::string checkoutItems(std::vector<Item>& aInput, const DealCatalog& aCatalog, int& aTotal, const CheckoutOptions& aOptions);
 };
 
 
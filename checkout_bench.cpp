@@ -0,0 +1,512 @@
+#include "checkout.h"
+#include "deal_catalog.h"
+#include "basket_columns.h"
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <chrono>
+
+/*
+ * Benchmark of the checkout strategies.
+ *
+ * Times each SolverStrategy on generated checkouts (varying the number of deals,
+ * basket size and how much the deals overlap), prints the timings and calibrates a CostModel from them.
+ * Then compares pricing a batch of orders one checkoutItems call at a time with Checkout::checkoutBatch,
+ * and tallying deals over many baskets item by item with the BasketColumns kernels,
+ * and pricing personalised sessions with a DealOverlay rather than a deal list (or catalog) per customer,
+ * and applying CatalogDeltas to a large catalog rather than building it again.
+ *
+ * Usage: checkout_bench [cost model output file]
+ */
+
+namespace
+{
+	struct BenchCheckout
+	{
+		std::vector<BuyAofXGetBofYForZ> iDeals;
+		std::vector<Item> iItems;
+	};
+
+	// aGroups: deals are spread over this many independent groups of items
+	BenchCheckout generate(std::mt19937& aRandom, int aNumDeals, int aNumItems, int aGroups)
+	{
+		const int itemsPerGroup = 3;
+		BenchCheckout checkout;
+		for (int d = 0; d < aNumDeals; ++d)
+		{
+			int group = d % aGroups;
+			int selectionId = 1 + group * itemsPerGroup + aRandom() % itemsPerGroup;
+			int targetId = 1 + group * itemsPerGroup + aRandom() % itemsPerGroup;
+			checkout.iDeals.push_back(BuyAofXGetBofYForZ(1 + aRandom() % 3, selectionId, 1 + aRandom() % 2, targetId, aRandom() % 100));
+		}
+
+		for (int i = 0; i < aNumItems; ++i)
+		{
+			int id = 1 + aRandom() % (aGroups * itemsPerGroup);
+			checkout.iItems.push_back(Item(id, 100 + id, "Item" + std::to_string(id)));
+		}
+		return checkout;
+	}
+
+	double timeStrategy(BenchCheckout& aCheckout, SolverStrategy aStrategy, int aRepeats)
+	{
+		std::vector<const Deal*> deals;
+		for (BuyAofXGetBofYForZ& deal : aCheckout.iDeals)
+		{
+			deals.push_back(&deal);
+		}
+
+		Checkout::CheckoutOptions options;
+		options.iStrategy = aStrategy;
+
+		auto start = std::chrono::steady_clock::now();
+		for (int r = 0; r < aRepeats; ++r)
+		{
+			Checkout::solve(aCheckout.iItems, deals, options);
+		}
+		std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+		return elapsed.count() / aRepeats;
+	}
+
+	// A catalog of many deals over many items, and a day's orders (each only touching a few of them)
+	void benchBatch(std::mt19937& aRandom)
+	{
+		const int numItems = 400;
+		const int numDeals = 300;
+		const int numOrders = 5000;
+
+		std::vector<BuyAofXGetBofYForZ> deals;
+		for (int d = 0; d < numDeals; ++d)
+		{
+			int selectionId = 1 + aRandom() % numItems;
+			int targetId = (aRandom() % 2) ? selectionId : 1 + aRandom() % numItems;
+			deals.push_back(BuyAofXGetBofYForZ(1 + aRandom() % 3, selectionId, 1 + aRandom() % 2, targetId, aRandom() % 100));
+		}
+
+		std::vector<const Deal*> dealPtrs;
+		for (BuyAofXGetBofYForZ& deal : deals)
+		{
+			dealPtrs.push_back(&deal);
+		}
+
+		// Popular items are bought more often
+		std::vector<std::vector<Item>> orders;
+		for (int o = 0; o < numOrders; ++o)
+		{
+			std::vector<Item> order;
+			for (int i = 0; i < 1 + aRandom() % 5; ++i)
+			{
+				int id = 1 + (aRandom() % numItems) * (aRandom() % numItems) / numItems;
+				order.push_back(Item(id, 100 + id, "Item" + std::to_string(id)));
+			}
+			orders.push_back(order);
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		long loopTotal = 0;
+		for (std::vector<Item>& order : orders)
+		{
+			std::vector<const Deal*> orderDeals = dealPtrs;
+			int total;
+			Checkout::checkoutItems(order, orderDeals, total);
+			loopTotal += total;
+		}
+		std::chrono::duration<double> loopTime = std::chrono::steady_clock::now() - start;
+
+		start = std::chrono::steady_clock::now();
+		DealCatalog catalog(dealPtrs);
+		std::vector<Checkout::CheckoutResult> results = Checkout::checkoutBatch(orders, catalog, Checkout::BatchOptions());
+		std::chrono::duration<double> batchTime = std::chrono::steady_clock::now() - start;
+
+		long batchTotal = 0;
+		for (Checkout::CheckoutResult& result : results)
+		{
+			batchTotal += result.iTotal;
+		}
+
+		std::cout << std::endl << numOrders << " orders, " << numDeals << " deals:" << std::endl
+			<< "  checkoutItems loop " << std::setw(10) << std::fixed << std::setprecision(0) << numOrders / loopTime.count() << " baskets/s" << std::endl
+			<< "  checkoutBatch      " << std::setw(10) << numOrders / batchTime.count() << " baskets/s" << std::endl
+			<< std::defaultfloat;
+
+		if (loopTotal != batchTotal)
+		{
+			std::cerr << "Batch total " << batchTotal << " differs from " << loopTotal << std::endl;
+		}
+	}
+
+	// Applications and savings of every deal on every basket, item by item and by column
+	void benchColumns(std::mt19937& aRandom)
+	{
+		const int numItems = 200;
+		const int numDeals = 100;
+		const int numBaskets = 20000;
+
+		std::vector<BuyAofXGetBofYForZ> deals;
+		for (int d = 0; d < numDeals; ++d)
+		{
+			int selectionId = 1 + aRandom() % numItems;
+			int targetId = (aRandom() % 2) ? selectionId : 1 + aRandom() % numItems;
+			deals.push_back(BuyAofXGetBofYForZ(1 + aRandom() % 3, selectionId, 1 + aRandom() % 2, targetId, aRandom() % 100));
+		}
+
+		std::vector<std::vector<Item>> baskets;
+		for (int b = 0; b < numBaskets; ++b)
+		{
+			std::vector<Item> basket;
+			for (int i = 0; i < 1 + aRandom() % 20; ++i)
+			{
+				int id = 1 + (aRandom() % numItems) * (aRandom() % numItems) / numItems;
+				basket.push_back(Item(id, 100 + id, "Item" + std::to_string(id)));
+			}
+			baskets.push_back(basket);
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		long tallyTotal = 0;
+		for (BuyAofXGetBofYForZ& deal : deals)
+		{
+			for (std::vector<Item>& basket : baskets)
+			{
+				int saving;
+				tallyTotal += dealTally(deal, basket, saving) + saving;
+			}
+		}
+		std::chrono::duration<double> tallyTime = std::chrono::steady_clock::now() - start;
+
+		start = std::chrono::steady_clock::now();
+		BasketColumns columns(baskets);
+		std::chrono::duration<double> buildTime = std::chrono::steady_clock::now() - start;
+
+		start = std::chrono::steady_clock::now();
+		long columnsTotal = 0;
+		std::vector<int> applications;
+		std::vector<int> savings;
+		for (BuyAofXGetBofYForZ& deal : deals)
+		{
+			evaluateColumns(deal, columns, applications, savings);
+			for (int b = 0; b < numBaskets; ++b)
+			{
+				columnsTotal += applications[b] + savings[b];
+			}
+		}
+		std::chrono::duration<double> columnsTime = std::chrono::steady_clock::now() - start;
+
+		double evaluations = (double)numDeals * numBaskets;
+		std::cout << std::endl << numBaskets << " baskets, " << numDeals << " deals (" << columnLanes() << " baskets per instruction):" << std::endl
+			<< "  dealTally         " << std::setw(12) << std::fixed << std::setprecision(0) << evaluations / tallyTime.count() << " deal-baskets/s" << std::endl
+			<< "  evaluateColumns   " << std::setw(12) << evaluations / columnsTime.count() << " deal-baskets/s"
+			<< " (+ " << std::setprecision(1) << buildTime.count() * 1000 << "ms to build the columns)" << std::endl
+			<< std::defaultfloat;
+
+		if (tallyTotal != columnsTotal)
+		{
+			std::cerr << "Column total " << columnsTotal << " differs from " << tallyTotal << std::endl;
+		}
+	}
+
+	// Many personalised sessions: a store catalog, and a few deals of each customer's own on top of it
+	void benchOverlays(std::mt19937& aRandom)
+	{
+		const int numItems = 2000;
+		const int numStoreDeals = 5000;
+		const int numCustomers = 2000;
+		const int dealsPerCustomer = 5;
+		const int basketsPerCustomer = 3;
+
+		std::vector<BuyAofXGetBofYForZ> storeDeals;
+		for (int d = 0; d < numStoreDeals; ++d)
+		{
+			int selectionId = 1 + aRandom() % numItems;
+			storeDeals.push_back(BuyAofXGetBofYForZ(1 + aRandom() % 3, selectionId, 1, selectionId, aRandom() % 100));
+		}
+		std::vector<const Deal*> storeDealPtrs;
+		for (BuyAofXGetBofYForZ& deal : storeDeals)
+		{
+			storeDealPtrs.push_back(&deal);
+		}
+		DealCatalog catalog(storeDealPtrs);
+
+		std::vector<std::vector<BuyAofXGetBofYForZ>> customerDeals(numCustomers);
+		std::vector<std::vector<std::vector<Item>>> baskets(numCustomers);
+		for (int c = 0; c < numCustomers; ++c)
+		{
+			for (int d = 0; d < dealsPerCustomer; ++d)
+			{
+				int selectionId = 1 + aRandom() % numItems;
+				customerDeals[c].push_back(BuyAofXGetBofYForZ(1, selectionId, 1, selectionId, 50 + aRandom() % 50));
+			}
+			for (int b = 0; b < basketsPerCustomer; ++b)
+			{
+				std::vector<Item> basket;
+				for (int i = 0; i < 1 + aRandom() % 5; ++i)
+				{
+					// (customers tend to buy what their offers are for)
+					int id = (aRandom() % 2) ? customerDeals[c][aRandom() % dealsPerCustomer].selectionId() : 1 + aRandom() % numItems;
+					basket.push_back(Item(id, 100 + id % 50, "Item" + std::to_string(id)));
+				}
+				baskets[c].push_back(basket);
+			}
+		}
+
+		Checkout::CheckoutOptions options;
+		auto start = std::chrono::steady_clock::now();
+		long combinedTotal = 0;
+		for (int c = 0; c < numCustomers; ++c)
+		{
+			std::vector<const Deal*> combined = storeDealPtrs;
+			for (BuyAofXGetBofYForZ& deal : customerDeals[c])
+			{
+				combined.push_back(&deal);
+			}
+			for (std::vector<Item>& basket : baskets[c])
+			{
+				combinedTotal += Checkout::solve(basket, combined, options).iTotal;
+			}
+		}
+		std::chrono::duration<double> combinedTime = std::chrono::steady_clock::now() - start;
+
+		start = std::chrono::steady_clock::now();
+		long catalogTotal = 0;
+		for (int c = 0; c < numCustomers; ++c)
+		{
+			std::vector<const Deal*> combined = storeDealPtrs;
+			for (BuyAofXGetBofYForZ& deal : customerDeals[c])
+			{
+				combined.push_back(&deal);
+			}
+			DealCatalog customerCatalog(combined);
+			for (std::vector<Item>& basket : baskets[c])
+			{
+				catalogTotal += Checkout::solve(basket, customerCatalog, options).iTotal;
+			}
+		}
+		std::chrono::duration<double> catalogTime = std::chrono::steady_clock::now() - start;
+
+		start = std::chrono::steady_clock::now();
+		long overlayTotal = 0;
+		for (int c = 0; c < numCustomers; ++c)
+		{
+			std::vector<const Deal*> own;
+			for (BuyAofXGetBofYForZ& deal : customerDeals[c])
+			{
+				own.push_back(&deal);
+			}
+			DealOverlay overlay(catalog, own);
+			for (std::vector<Item>& basket : baskets[c])
+			{
+				overlayTotal += Checkout::solve(basket, overlay, options).iTotal;
+			}
+		}
+		std::chrono::duration<double> overlayTime = std::chrono::steady_clock::now() - start;
+
+		int checkouts = numCustomers * basketsPerCustomer;
+		std::cout << std::endl << numCustomers << " customers (" << dealsPerCustomer << " deals each), " << numStoreDeals << " store deals:" << std::endl
+			<< "  combined deal list   " << std::setw(10) << std::fixed << std::setprecision(0) << checkouts / combinedTime.count() << " baskets/s" << std::endl
+			<< "  catalog per customer " << std::setw(10) << checkouts / catalogTime.count() << " baskets/s" << std::endl
+			<< "  DealOverlay          " << std::setw(10) << checkouts / overlayTime.count() << " baskets/s" << std::endl
+			<< std::defaultfloat;
+
+		if (combinedTotal != overlayTotal || catalogTotal != overlayTotal)
+		{
+			std::cerr << "Overlay total " << overlayTotal << " differs from " << combinedTotal << " / " << catalogTotal << std::endl;
+		}
+	}
+
+	// Pricing's deltas to a large catalog: a few hundred deals added, replaced and retired at a time
+	void benchDeltas(std::mt19937& aRandom)
+	{
+		const int numItems = 30000;
+		const int numDeals = 100000;
+		const int numDeltas = 20;
+		const int changesPerDelta = 300;
+
+		std::vector<Item> priceList;
+		for (int id = 1; id <= numItems; ++id)
+		{
+			priceList.push_back(Item(id, 100 + id % 50, "Item" + std::to_string(id)));
+		}
+		std::vector<BuyAofXGetBofYForZ> deals;
+		for (int d = 0; d < numDeals; ++d)
+		{
+			int selectionId = 1 + aRandom() % numItems;
+			int targetId = (d % 4) ? selectionId : 1 + aRandom() % numItems;
+			deals.push_back(BuyAofXGetBofYForZ(1 + aRandom() % 3, selectionId, 1, targetId, aRandom() % 100));
+		}
+		std::vector<const Deal*> dealPtrs;
+		for (BuyAofXGetBofYForZ& deal : deals)
+		{
+			dealPtrs.push_back(&deal);
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		CatalogSnapshots snapshots(std::make_shared<DealCatalog>(dealPtrs, priceList));
+		std::chrono::duration<double> loadTime = std::chrono::steady_clock::now() - start;
+
+		// Each delta: a third added, a third replaced, a third retired
+		std::vector<std::string> texts;
+		std::vector<std::string> keys;
+		for (int d = 0; d < numDeals; ++d)
+		{
+			keys.push_back(std::to_string(d));
+		}
+		for (int delta = 0; delta < numDeltas; ++delta)
+		{
+			std::string text;
+			for (int c = 0; c < changesPerDelta; ++c)
+			{
+				int selectionId = 1 + aRandom() % numItems;
+				std::string deal = BuyAofXGetBofYForZ(1 + aRandom() % 3, selectionId, 1, selectionId, aRandom() % 100).serialise();
+				if (c % 3 == 0)
+				{
+					keys.push_back("d" + std::to_string(delta) + "." + std::to_string(c));
+					text += "+ " + keys.back() + " " + deal + "\n";
+					continue;
+				}
+				size_t k = aRandom() % keys.size();
+				if (c % 3 == 1)
+				{
+					text += "~ " + keys[k] + " " + deal + "\n";
+				}
+				else
+				{
+					text += "- " + keys[k] + "\n";
+					keys[k] = keys.back();
+					keys.pop_back();
+				}
+			}
+			texts.push_back(text);
+		}
+
+		std::string error;
+		std::vector<CatalogDelta> parsed(numDeltas);
+		start = std::chrono::steady_clock::now();
+		for (int delta = 0; delta < numDeltas; ++delta)
+		{
+			if (!parsed[delta].deserialise(texts[delta], error))
+			{
+				std::cerr << "Delta " << delta << ": " << error << std::endl;
+				return;
+			}
+		}
+		std::chrono::duration<double> parseTime = std::chrono::steady_clock::now() - start;
+
+		size_t blocksCopied = 0;
+		double applyTime = 0;
+		double rebuildTime = 0;
+		for (int delta = 0; delta < numDeltas; ++delta)
+		{
+			CatalogDeltaStats stats;
+			start = std::chrono::steady_clock::now();
+			if (!snapshots.apply(parsed[delta], error, &stats))
+			{
+				std::cerr << "Delta " << delta << ": " << error << std::endl;
+				return;
+			}
+			applyTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			blocksCopied += stats.iBlocksCopied;
+
+			// The alternative: building the catalog again from the changed deals
+			std::shared_ptr<const DealCatalog> current = snapshots.current();
+			std::vector<const Deal*> changed = current->deals();
+			start = std::chrono::steady_clock::now();
+			DealCatalog rebuilt(changed, priceList);
+			rebuildTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+			std::vector<Item> basket;
+			for (int i = 0; i < 20; ++i)
+			{
+				basket.push_back(priceList[aRandom() % numItems]);
+			}
+			if (rebuilt.curveCount() != current->curveCount() || rebuilt.filterDeals(basket) != current->filterDeals(basket))
+			{
+				std::cerr << "Delta " << delta << " differs from the rebuilt catalog" << std::endl;
+			}
+		}
+
+		std::cout << std::endl << numDeltas << " deltas of " << changesPerDelta << " changes to " << numDeals << " deals (loaded in "
+			<< std::fixed << std::setprecision(0) << loadTime.count() * 1e3 << " ms):" << std::endl
+			<< "  parse delta          " << std::setw(10) << std::setprecision(2) << parseTime.count() * 1e3 / numDeltas << " ms" << std::endl
+			<< "  apply delta          " << std::setw(10) << applyTime * 1e3 / numDeltas << " ms ("
+			<< blocksCopied / numDeltas << " blocks copied)" << std::endl
+			<< "  rebuild catalog      " << std::setw(10) << rebuildTime * 1e3 / numDeltas << " ms" << std::endl
+			<< std::defaultfloat;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	std::mt19937 random(2016);
+	std::vector<CostSample> samples;
+
+	std::cout << std::setw(6) << "deals" << std::setw(6) << "items" << std::setw(8) << "groups" << std::setw(9) << "density";
+	for (int s = 0; s < ESolverCount; ++s)
+	{
+		std::cout << std::setw(16) << strategyName((SolverStrategy)s);
+	}
+	std::cout << "   (us per checkout)" << std::endl;
+
+	for (int numDeals = 1; numDeals <= 7; ++numDeals)
+	{
+		for (int numItems : { 5, 20, 60 })
+		{
+			for (int groups : { 1, 2, 3 })
+			{
+				if (groups > numDeals)
+				{
+					continue;
+				}
+
+				BenchCheckout checkout = generate(random, numDeals, numItems, groups);
+
+				std::vector<const Deal*> deals;
+				for (BuyAofXGetBofYForZ& deal : checkout.iDeals)
+				{
+					deals.push_back(&deal);
+				}
+
+				CostSample sample;
+				sample.iFeatures = checkoutFeatures(checkout.iItems, Checkout::filterDeals(deals, checkout.iItems));
+
+				int repeats = (numDeals <= 5) ? 20 : 2;
+				for (int s = 0; s < ESolverCount; ++s)
+				{
+					sample.iMicros[s] = timeStrategy(checkout, (SolverStrategy)s, repeats);
+				}
+				samples.push_back(sample);
+
+				std::cout << std::setw(6) << sample.iFeatures.iDeals << std::setw(6) << numItems
+					<< std::setw(8) << sample.iFeatures.iComponents.size() << std::setw(9) << std::setprecision(2) << sample.iFeatures.iDensity;
+				for (int s = 0; s < ESolverCount; ++s)
+				{
+					std::cout << std::setw(16) << std::fixed << std::setprecision(1) << sample.iMicros[s];
+				}
+				std::cout << std::defaultfloat << std::endl;
+			}
+		}
+	}
+
+	CostModel model;
+	model.calibrate(samples);
+
+	std::cout << std::endl << "Calibrated cost model:" << std::endl
+		<< "  iBruteForceMaxDeals  " << model.iBruteForceMaxDeals << std::endl
+		<< "  iBruteForceMaxItems  " << model.iBruteForceMaxItems << std::endl
+		<< "  iDecomposeMaxDensity " << model.iDecomposeMaxDensity << std::endl;
+
+	if (argc > 1)
+	{
+		if (!model.save(argv[1]))
+		{
+			std::cerr << "Could not write " << argv[1] << std::endl;
+			return 1;
+		}
+		std::cout << "Saved to " << argv[1] << std::endl;
+	}
+
+	benchBatch(random);
+	benchColumns(random);
+	benchOverlays(random);
+	benchDeltas(random);
+	return 0;
+}
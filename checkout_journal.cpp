@@ -0,0 +1,418 @@
+#include "checkout_journal.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ Segment file: a 32 byte header (kMagic, the record size, the segment number) then records, packed.
+ The file is created full of zeros, so the records end at the first one with no checkout number
+ (or, after a crash, at the first one whose checksum does not match).
+ */
+namespace
+{
+	const char kMagic[8] = { 'C', 'K', 'J', 'O', 'U', 'R', 'N', '1' };
+	const size_t kHeaderSize = 32;
+
+	struct SegmentHeader
+	{
+		char iMagic[8];
+		uint32_t iRecordSize;
+		uint32_t iSegment;
+		char iUnused[kHeaderSize - 16];
+	};
+
+	static_assert(sizeof(SegmentHeader) == kHeaderSize, "segment header layout");
+	static_assert(sizeof(JournalRecord) == 32, "journal record layout");
+
+	bool validRecord(const JournalRecord& aRecord)
+	{
+		return aRecord.iCheckout != 0 && aRecord.iCheck == aRecord.checksum();
+	}
+}
+
+// FNV-1a
+uint32_t JournalRecord::checksum() const
+{
+	const unsigned char* bytes = (const unsigned char*)this;
+	uint32_t hash = 2166136261u;
+	for (size_t b = 0; b < offsetof(JournalRecord, iCheck); ++b)
+	{
+		hash = (hash ^ bytes[b]) * 16777619u;
+	}
+	return hash;
+}
+
+std::string Journal::segmentPath(const std::string& aDirectory, uint32_t aSegment)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "/journal.%06u", aSegment);
+	return aDirectory + name;
+}
+
+Journal::Journal(const std::vector<const Deal*>& aDeals, const JournalOptions& aOptions) :
+	iOptions(aOptions)
+{
+	for (size_t d = 0; d < aDeals.size(); ++d)
+	{
+		iDealIds[aDeals[d]] = (int32_t)d;
+	}
+	iOptions.iSegmentBytes = std::max(iOptions.iSegmentBytes, kHeaderSize + sizeof(JournalRecord));
+}
+
+Journal::~Journal()
+{
+	{
+		std::lock_guard<std::mutex> lock(iMutex);
+		iStopping = true;
+	}
+	iWork.notify_all();
+	if (iFlusher.joinable())
+	{
+		iFlusher.join();
+	}
+	flush(iCurrent, iCurrent.iWritten);
+	close(iCurrent);
+}
+
+/*
+ Carry on after the segments already in the directory: find the last one,
+ and the last checkout number written to it.
+ */
+bool Journal::open()
+{
+	std::lock_guard<std::mutex> lock(iMutex);
+	if (iCurrent.iData)
+	{
+		return true;
+	}
+
+	struct stat status;
+	while (::stat(segmentPath(iOptions.iDirectory, iNextSegment).c_str(), &status) == 0)
+	{
+		++iNextSegment;
+	}
+	if (iNextSegment > 1)
+	{
+		JournalReader reader(iOptions.iDirectory);
+		JournalRecord record;
+		while (reader.next(record))
+		{
+			iNextCheckout = record.iCheckout + 1;
+		}
+		iDurable = iNextCheckout - 1;
+	}
+
+	if (!startSegment())
+	{
+		return false;
+	}
+	iFlusher = std::thread(&Journal::run, this);
+	return true;
+}
+
+bool Journal::startSegment()
+{
+	Segment segment;
+	segment.iNumber = iNextSegment;
+	segment.iSize = iOptions.iSegmentBytes;
+
+	std::string path = segmentPath(iOptions.iDirectory, segment.iNumber);
+	segment.iFd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (segment.iFd < 0)
+	{
+		return false;
+	}
+
+	// Allocate the blocks now, rather than on the first write to each page: a write to a page of the mapping
+	// with no block behind it (the disk full) would raise SIGBUS in append
+	int error = (ftruncate(segment.iFd, segment.iSize) == 0) ? 0 : errno;
+#ifdef __linux__
+	if (error == 0)
+	{
+		error = posix_fallocate(segment.iFd, 0, segment.iSize);
+	}
+#endif
+	void* data = MAP_FAILED;
+	if (error == 0)
+	{
+		data = mmap(nullptr, segment.iSize, PROT_READ | PROT_WRITE, MAP_SHARED, segment.iFd, 0);
+		error = (data == MAP_FAILED) ? errno : 0;
+	}
+	if (error != 0)
+	{
+		// (removed, so the next attempt can create it)
+		close(segment);
+		unlink(path.c_str());
+		errno = error;
+		return false;
+	}
+	segment.iData = (char*)data;
+
+	SegmentHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.iMagic, kMagic, sizeof(kMagic));
+	header.iRecordSize = sizeof(JournalRecord);
+	header.iSegment = segment.iNumber;
+	std::memcpy(segment.iData, &header, sizeof(header));
+	segment.iWritten = kHeaderSize;
+
+	if (iCurrent.iData)
+	{
+		iRetired.push_back(iCurrent);
+		iWork.notify_one();
+	}
+	iCurrent = segment;
+	++iNextSegment;
+	++iSegments;
+	return true;
+}
+
+uint64_t Journal::append(const Checkout::CheckoutResult& aResult)
+{
+	size_t bytes = sizeof(JournalRecord) * aResult.iLines.size();
+
+	std::lock_guard<std::mutex> lock(iMutex);
+	if (!iCurrent.iData || kHeaderSize + bytes > iCurrent.iSize)
+	{
+		return 0;
+	}
+	if (iCurrent.iWritten + bytes > iCurrent.iSize && !startSegment())
+	{
+		return 0;
+	}
+
+	uint64_t checkout = iNextCheckout++;
+	JournalRecord record;
+	record.iCheckout = checkout;
+	for (const Checkout::ReceiptLine& line : aResult.iLines)
+	{
+		auto find = iDealIds.find(std::get<0>(line));
+		record.iDeal = (find == iDealIds.end()) ? -1 : find->second;
+		record.iItemId = std::get<1>(line).iId;
+		record.iUnitPrice = std::get<1>(line).iUnitPrice;
+		record.iPrice = std::get<2>(line);
+		record.iCheck = record.checksum();
+		std::memcpy(iCurrent.iData + iCurrent.iWritten, &record, sizeof(record));
+		iCurrent.iWritten += sizeof(record);
+		++record.iLine;
+	}
+	iWork.notify_one();
+	return checkout;
+}
+
+bool Journal::sync()
+{
+	std::unique_lock<std::mutex> lock(iMutex);
+	uint64_t appended = iNextCheckout - 1;
+	iWork.notify_one();
+	iCommitted.wait(lock, [this, appended] { return iDurable >= appended || iError != 0 || !iFlusher.joinable(); });
+	return iError == 0 && iDurable >= appended;
+}
+
+uint64_t Journal::durable() const
+{
+	std::lock_guard<std::mutex> lock(iMutex);
+	return iDurable;
+}
+
+int Journal::error() const
+{
+	std::lock_guard<std::mutex> lock(iMutex);
+	return iError;
+}
+
+size_t Journal::segments() const
+{
+	std::lock_guard<std::mutex> lock(iMutex);
+	return iSegments;
+}
+
+// msync needs a page aligned start
+bool Journal::flush(Segment& aSegment, size_t aUpTo)
+{
+	if (!aSegment.iData || aUpTo <= aSegment.iFlushed)
+	{
+		return true;
+	}
+	static const size_t kPage = sysconf(_SC_PAGESIZE);
+	size_t from = aSegment.iFlushed / kPage * kPage;
+	if (msync(aSegment.iData + from, aUpTo - from, MS_SYNC) != 0)
+	{
+		return false;
+	}
+	aSegment.iFlushed = aUpTo;
+	return true;
+}
+
+void Journal::close(Segment& aSegment)
+{
+	if (aSegment.iData)
+	{
+		munmap(aSegment.iData, aSegment.iSize);
+		aSegment.iData = nullptr;
+	}
+	if (aSegment.iFd >= 0)
+	{
+		::close(aSegment.iFd);
+		aSegment.iFd = -1;
+	}
+}
+
+/*
+ The flusher: once there is something to flush, wait out the commit interval
+ (so the checkouts appended meanwhile join this commit), then flush without iMutex held.
+ append only writes past iWritten, so what was written before can be flushed meanwhile.
+ Segments are only unmapped by this thread (or by the destructor, once it has stopped).
+ Once a flush has failed, iDurable stays where it was: what was appended after it is not known to be on disk.
+ */
+void Journal::run()
+{
+	std::unique_lock<std::mutex> lock(iMutex);
+	while (true)
+	{
+		iWork.wait(lock, [this] { return iStopping || !iRetired.empty() || iCurrent.iWritten > iCurrent.iFlushed || (iError == 0 && iDurable < iNextCheckout - 1); });
+		if (iStopping)
+		{
+			break;
+		}
+		iWork.wait_for(lock, iOptions.iCommitInterval, [this] { return iStopping; });
+
+		std::deque<Segment> retired;
+		retired.swap(iRetired);
+		Segment current = iCurrent;
+		uint64_t committed = iNextCheckout - 1;
+
+		lock.unlock();
+		int error = 0;
+		for (Segment& segment : retired)
+		{
+			if (!flush(segment, segment.iWritten) && error == 0)
+			{
+				error = errno;
+			}
+			close(segment);
+		}
+		if (!flush(current, current.iWritten) && error == 0)
+		{
+			error = errno;
+		}
+		lock.lock();
+
+		// (the segment may have been retired meanwhile, so its copy in iRetired flushes a little again)
+		if (iCurrent.iNumber == current.iNumber)
+		{
+			iCurrent.iFlushed = std::max(iCurrent.iFlushed, current.iFlushed);
+		}
+		if (iError == 0)
+		{
+			iError = error;
+		}
+		if (iError == 0)
+		{
+			iDurable = std::max(iDurable, committed);
+		}
+		iCommitted.notify_all();
+	}
+
+	// The destructor flushes the current segment
+	for (Segment& segment : iRetired)
+	{
+		if (!flush(segment, segment.iWritten) && iError == 0)
+		{
+			iError = errno;
+		}
+		close(segment);
+	}
+	iRetired.clear();
+	if (iError == 0)
+	{
+		iDurable = iNextCheckout - 1;
+	}
+	iCommitted.notify_all();
+}
+
+JournalReader::JournalReader(const std::string& aDirectory) :
+	iDirectory(aDirectory)
+{
+	openSegment(1);
+}
+
+JournalReader::~JournalReader()
+{
+	closeSegment();
+}
+
+bool JournalReader::openSegment(uint32_t aNumber)
+{
+	closeSegment();
+	iSegment = aNumber;
+
+	int fd = ::open(Journal::segmentPath(iDirectory, aNumber).c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		return false;
+	}
+	struct stat status;
+	void* data = MAP_FAILED;
+	if (fstat(fd, &status) == 0 && (size_t)status.st_size >= kHeaderSize)
+	{
+		data = mmap(nullptr, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	}
+	::close(fd);
+	if (data == MAP_FAILED)
+	{
+		return false;
+	}
+	iData = (const char*)data;
+	iSize = status.st_size;
+	iOffset = kHeaderSize;
+
+	SegmentHeader header;
+	std::memcpy(&header, iData, sizeof(header));
+	if (std::memcmp(header.iMagic, kMagic, sizeof(kMagic)) != 0 || header.iRecordSize != sizeof(JournalRecord))
+	{
+		closeSegment();
+		return false;
+	}
+#ifdef __linux__
+	madvise((void*)iData, iSize, MADV_SEQUENTIAL);
+#endif
+	return true;
+}
+
+void JournalReader::closeSegment()
+{
+	if (iData)
+	{
+		munmap((void*)iData, iSize);
+		iData = nullptr;
+	}
+}
+
+/*
+ A segment ends at its first empty (or torn) record, and the next one is opened.
+ The journal ends at the first segment which is missing (or not a journal segment).
+ */
+bool JournalReader::next(JournalRecord& aRecord)
+{
+	while (iData)
+	{
+		if (iOffset + sizeof(JournalRecord) <= iSize)
+		{
+			std::memcpy(&aRecord, iData + iOffset, sizeof(aRecord));
+			if (validRecord(aRecord))
+			{
+				iOffset += sizeof(JournalRecord);
+				return true;
+			}
+		}
+		openSegment(iSegment + 1);
+	}
+	return false;
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "checkout.h"
+
+/*
+ * One receipt line of a journalled checkout. Every checkout has one record per line,
+ * numbered from 0 (iLine), all with the same iCheckout (numbered from 1 and never reused).
+ */
+struct JournalRecord
+{
+	uint64_t iCheckout{ 0 };
+	int32_t iDeal{ -1 };		// position of the deal in the journal's deal list (-1 for none)
+	int32_t iItemId{ 0 };
+	int32_t iUnitPrice{ 0 };
+	int32_t iPrice{ 0 };		// charged
+	uint32_t iLine{ 0 };
+	uint32_t iCheck{ 0 };		// of the fields above, so a record torn by a crash is not read
+
+	uint32_t checksum() const;
+};
+
+struct JournalOptions
+{
+	std::string iDirectory{ "." };
+	size_t iSegmentBytes{ 64 << 20 };						// each segment file is created at this size
+	std::chrono::microseconds iCommitInterval{ 2000 };		// how long a commit waits for more checkouts to join it
+};
+
+/*
+ * Append-only journal of completed checkouts, for audit.
+ *
+ * Records are copied into a memory mapped segment file (journal.000001, journal.000002, ...),
+ * created at its full size, so appending is a copy and never waits for the disk.
+ * A background thread flushes what has been appended (msync) every commit interval, so checkouts
+ * appended close together share one flush (group commit). When a segment is full the next checkout
+ * starts a new one, and the old segment is flushed and closed in the background.
+ * A checkout's records are never split between segments.
+ *
+ * A new Journal continues the checkout numbering of the segments already in the directory,
+ * but always starts a new segment.
+ */
+class Journal
+{
+public:
+	Journal(const std::vector<const Deal*>& aDeals, const JournalOptions& aOptions = JournalOptions());
+	~Journal();
+
+	Journal(const Journal&) = delete;
+	Journal& operator=(const Journal&) = delete;
+
+	// false if the first segment could not be created (errno says why)
+	bool open();
+
+	// Returns the checkout's number (0 if it could not be journalled: not open, too large for a segment,
+	// or the next segment could not be created, e.g. the disk is full, with errno saying why)
+	uint64_t append(const Checkout::CheckoutResult& aResult);
+
+	// Wait until every checkout appended so far is on disk
+	// (false if a flush failed: see error())
+	bool sync();
+
+	// Checkouts up to this number are on disk. It stops advancing once a flush has failed.
+	uint64_t durable() const;
+
+	// 0, or the errno of the first failed flush
+	int error() const;
+
+	size_t segments() const;
+
+	static std::string segmentPath(const std::string& aDirectory, uint32_t aSegment);
+
+private:
+	struct Segment
+	{
+		uint32_t iNumber{ 0 };
+		int iFd{ -1 };
+		char* iData{ nullptr };
+		size_t iSize{ 0 };
+		size_t iWritten{ 0 };		// bytes appended (from the start of the file)
+		size_t iFlushed{ 0 };		// bytes known to be on disk
+	};
+
+	bool startSegment();			// (iMutex held) false, with errno set, if the segment could not be created and allocated
+	bool flush(Segment& aSegment, size_t aUpTo);	// false, with errno set, if msync failed
+	static void close(Segment& aSegment);
+	void run();
+
+	std::unordered_map<const Deal*, int32_t> iDealIds;
+	JournalOptions iOptions;
+
+	mutable std::mutex iMutex;
+	std::condition_variable iWork;
+	std::condition_variable iCommitted;
+
+	Segment iCurrent;
+	std::deque<Segment> iRetired;	// full segments, waiting to be flushed and closed
+	uint32_t iNextSegment{ 1 };
+	uint64_t iNextCheckout{ 1 };
+	uint64_t iDurable{ 0 };
+	int iError{ 0 };
+	size_t iSegments{ 0 };
+	bool iStopping{ false };
+
+	std::thread iFlusher;
+};
+
+/*
+ * Reads every record of a journal directory, in order (segment by segment).
+ */
+class JournalReader
+{
+public:
+	JournalReader(const std::string& aDirectory);
+	~JournalReader();
+
+	JournalReader(const JournalReader&) = delete;
+	JournalReader& operator=(const JournalReader&) = delete;
+
+	// false at the end of the journal
+	bool next(JournalRecord& aRecord);
+
+	uint32_t segment() const { return iSegment; };
+
+private:
+	bool openSegment(uint32_t aNumber);
+	void closeSegment();
+
+	std::string iDirectory;
+	uint32_t iSegment{ 0 };
+	const char* iData{ nullptr };
+	size_t iSize{ 0 };
+	size_t iOffset{ 0 };
+};
@@ -0,0 +1,233 @@
+#include "checkout_protocol.h"
+#include "deal.h"
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/*
+ * Load generator for checkout_server: each connection (a till) sends generated baskets,
+ * keeping up to <pipeline depth> requests in flight, and times each request until its response.
+ * Prints the throughput and latency percentiles.
+ *
+ * Usage: checkout_loadgen <socket path> [connections] [requests per connection] [pipeline depth]
+ *        checkout_loadgen --sample <deals file> <price list file>
+ *   (--sample writes a catalog for checkout_server matching the generated baskets)
+ */
+
+namespace
+{
+	const int kNumItems = 400;
+	const int kNumDeals = 300;
+
+	// Popular items are bought more often (as in checkout_bench)
+	std::vector<Item> randomBasket(std::mt19937& aRandom)
+	{
+		std::vector<Item> basket;
+		for (int i = 0; i < 1 + aRandom() % 5; ++i)
+		{
+			int id = 1 + (aRandom() % kNumItems) * (aRandom() % kNumItems) / kNumItems;
+			basket.push_back(Item(id, 100 + id, ""));
+		}
+		return basket;
+	}
+
+	bool writeSample(const std::string& aDealsPath, const std::string& aPriceListPath)
+	{
+		std::mt19937 random(2016);
+		std::ofstream deals(aDealsPath);
+		for (int d = 0; d < kNumDeals; ++d)
+		{
+			int selectionId = 1 + random() % kNumItems;
+			int targetId = (random() % 2) ? selectionId : 1 + random() % kNumItems;
+			deals << BuyAofXGetBofYForZ(1 + random() % 3, selectionId, 1 + random() % 2, targetId, random() % 100).serialise() << "\n";
+		}
+
+		std::ofstream priceList(aPriceListPath);
+		for (int id = 1; id <= kNumItems; ++id)
+		{
+			priceList << id << " " << 100 + id << " Item" << id << "\n";
+		}
+		return deals && priceList;
+	}
+
+	int connect(const std::string& aSocketPath)
+	{
+		sockaddr_un address;
+		std::memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		std::strncpy(address.sun_path, aSocketPath.c_str(), sizeof(address.sun_path) - 1);
+
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd >= 0 && ::connect(fd, (sockaddr*)&address, sizeof(address)) != 0)
+		{
+			close(fd);
+			return -1;
+		}
+		return fd;
+	}
+
+	bool writeAll(int aFd, const std::string& aData)
+	{
+		size_t offset = 0;
+		while (offset < aData.size())
+		{
+			ssize_t bytes = write(aFd, aData.data() + offset, aData.size() - offset);
+			if (bytes < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if (bytes <= 0)
+			{
+				return false;
+			}
+			offset += bytes;
+		}
+		return true;
+	}
+
+	struct TillResult
+	{
+		std::vector<double> iMicros;	// per request
+		long iErrors{ 0 };
+	};
+
+	void runTill(const std::string& aSocketPath, int aSeed, int aRequests, int aDepth, TillResult& aResult)
+	{
+		int fd = connect(aSocketPath);
+		if (fd < 0)
+		{
+			aResult.iErrors = aRequests;
+			return;
+		}
+
+		std::mt19937 random(aSeed);
+		std::vector<std::chrono::steady_clock::time_point> sentAt(aRequests);
+		std::string in;
+		char buffer[64 * 1024];
+		int sent = 0;
+		int received = 0;
+
+		while (received < aRequests)
+		{
+			std::string out;
+			for (; sent < aRequests && sent - received < aDepth; ++sent)
+			{
+				CheckoutProtocol::Request request;
+				request.iId = sent;
+				request.iItems = randomBasket(random);
+				CheckoutProtocol::appendRequest(out, request);
+				sentAt[sent] = std::chrono::steady_clock::now();
+			}
+			if (!out.empty() && !writeAll(fd, out))
+			{
+				break;
+			}
+
+			ssize_t bytes = read(fd, buffer, sizeof(buffer));
+			if (bytes < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if (bytes <= 0)
+			{
+				break;
+			}
+			in.append(buffer, bytes);
+
+			size_t offset = 0;
+			CheckoutProtocol::Response response;
+			size_t consumed;
+			while (CheckoutProtocol::parseResponse(in.data() + offset, in.size() - offset, response, consumed) == CheckoutProtocol::EParsed)
+			{
+				offset += consumed;
+				std::chrono::duration<double, std::micro> latency = std::chrono::steady_clock::now() - sentAt[received];
+				aResult.iMicros.push_back(latency.count());
+				if (response.iId != (uint32_t)received || response.iStatus == CheckoutProtocol::EBadRequest)
+				{
+					++aResult.iErrors;
+				}
+				++received;
+			}
+			in.erase(0, offset);
+		}
+
+		aResult.iErrors += aRequests - received;
+		close(fd);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (argc == 4 && std::string(argv[1]) == "--sample")
+	{
+		if (!writeSample(argv[2], argv[3]))
+		{
+			std::cerr << "Could not write the sample catalog" << std::endl;
+			return 1;
+		}
+		return 0;
+	}
+
+	if (argc < 2)
+	{
+		std::cerr << "Usage: checkout_loadgen <socket path> [connections] [requests per connection] [pipeline depth]" << std::endl
+			<< "       checkout_loadgen --sample <deals file> <price list file>" << std::endl;
+		return 1;
+	}
+
+	std::string socketPath = argv[1];
+	int connections = (argc > 2) ? std::stoi(argv[2]) : 4;
+	int requests = (argc > 3) ? std::stoi(argv[3]) : 10000;
+	int depth = (argc > 4) ? std::stoi(argv[4]) : 16;
+
+	std::vector<TillResult> results(connections);
+	std::vector<std::thread> tills;
+
+	auto start = std::chrono::steady_clock::now();
+	for (int c = 0; c < connections; ++c)
+	{
+		tills.push_back(std::thread(runTill, socketPath, c, requests, depth, std::ref(results[c])));
+	}
+	for (std::thread& till : tills)
+	{
+		till.join();
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	std::vector<double> micros;
+	long errors = 0;
+	for (TillResult& result : results)
+	{
+		micros.insert(micros.end(), result.iMicros.begin(), result.iMicros.end());
+		errors += result.iErrors;
+	}
+	std::sort(micros.begin(), micros.end());
+
+	auto percentile = [&micros](double aFraction)
+	{
+		return micros.empty() ? 0.0 : micros[std::min(micros.size() - 1, (size_t)(aFraction * micros.size()))];
+	};
+
+	std::cout << connections << " connections, " << requests << " requests each, pipeline depth " << depth << std::endl
+		<< std::fixed << std::setprecision(0)
+		<< "  throughput " << micros.size() / elapsed.count() << " requests/s" << std::endl
+		<< std::setprecision(1)
+		<< "  latency us: p50 " << percentile(0.5) << ", p90 " << percentile(0.9) << ", p99 " << percentile(0.99)
+		<< ", p99.9 " << percentile(0.999) << ", max " << percentile(1.0) << std::endl;
+
+	if (errors > 0)
+	{
+		std::cerr << errors << " requests failed" << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,151 @@
+#include "checkout_protocol.h"
+#include <cstring>
+
+namespace
+{
+	template <typename T>
+	void append(std::string& aBuffer, T aValue)
+	{
+		aBuffer.append((const char*)&aValue, sizeof(aValue));
+	}
+
+	template <typename T>
+	T read(const char*& aData)
+	{
+		T value;
+		std::memcpy(&value, aData, sizeof(value));
+		aData += sizeof(value);
+		return value;
+	}
+
+	// Sizes of the fixed parts of each frame (after the length)
+	constexpr size_t kRequestHeader = 2 * sizeof(uint32_t);
+	constexpr size_t kRequestItem = 2 * sizeof(int32_t);
+	constexpr size_t kResponseHeader = sizeof(uint32_t) + sizeof(uint8_t) + sizeof(int32_t) + sizeof(uint32_t);
+	constexpr size_t kResponseLine = 3 * sizeof(int32_t);
+
+	// Largest frame accepted (the response to a request of kMaxItems items)
+	constexpr size_t kMaxFrame = kResponseHeader + CheckoutProtocol::kMaxItems * kResponseLine;
+
+	// The length field at the start of aData: EIncomplete until the whole frame is there
+	CheckoutProtocol::ParseResult frame(const char* aData, size_t aSize, size_t aMinimum, uint32_t& aLength)
+	{
+		if (aSize < sizeof(uint32_t))
+		{
+			return CheckoutProtocol::EIncomplete;
+		}
+
+		std::memcpy(&aLength, aData, sizeof(aLength));
+		if (aLength < aMinimum || aLength > kMaxFrame)
+		{
+			return CheckoutProtocol::EInvalid;
+		}
+		return (aSize < sizeof(uint32_t) + aLength) ? CheckoutProtocol::EIncomplete : CheckoutProtocol::EParsed;
+	}
+}
+
+void CheckoutProtocol::appendRequest(std::string& aBuffer, const Request& aRequest)
+{
+	append<uint32_t>(aBuffer, kRequestHeader + aRequest.iItems.size() * kRequestItem);
+	append<uint32_t>(aBuffer, aRequest.iId);
+	append<uint32_t>(aBuffer, aRequest.iItems.size());
+	for (const Item& item : aRequest.iItems)
+	{
+		append<int32_t>(aBuffer, item.iId);
+		append<int32_t>(aBuffer, item.iUnitPrice);
+	}
+}
+
+void CheckoutProtocol::appendResponse(std::string& aBuffer, const Response& aResponse)
+{
+	append<uint32_t>(aBuffer, kResponseHeader + aResponse.iLines.size() * kResponseLine);
+	append<uint32_t>(aBuffer, aResponse.iId);
+	append<uint8_t>(aBuffer, aResponse.iStatus);
+	append<int32_t>(aBuffer, aResponse.iTotal);
+	append<uint32_t>(aBuffer, aResponse.iLines.size());
+	for (const Line& line : aResponse.iLines)
+	{
+		append<int32_t>(aBuffer, line.iDeal);
+		append<int32_t>(aBuffer, line.iItemId);
+		append<int32_t>(aBuffer, line.iPrice);
+	}
+}
+
+CheckoutProtocol::ParseResult CheckoutProtocol::parseRequest(const char* aData, size_t aSize, Request& aRequest, size_t& aConsumed)
+{
+	uint32_t length;
+	ParseResult result = frame(aData, aSize, kRequestHeader, length);
+	if (result != EParsed)
+	{
+		return result;
+	}
+	aConsumed = sizeof(uint32_t) + length;
+
+	const char* data = aData + sizeof(uint32_t);
+	aRequest.iId = read<uint32_t>(data);
+	uint32_t count = read<uint32_t>(data);
+
+	aRequest.iItems.clear();
+	aRequest.iValid = (count <= kMaxItems && length == kRequestHeader + count * kRequestItem);
+	if (!aRequest.iValid)
+	{
+		return EParsed;
+	}
+
+	aRequest.iItems.reserve(count);
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		int32_t id = read<int32_t>(data);
+		int32_t unitPrice = read<int32_t>(data);
+		aRequest.iItems.push_back(Item(id, unitPrice, ""));
+	}
+	return EParsed;
+}
+
+CheckoutProtocol::ParseResult CheckoutProtocol::parseResponse(const char* aData, size_t aSize, Response& aResponse, size_t& aConsumed)
+{
+	uint32_t length;
+	ParseResult result = frame(aData, aSize, kResponseHeader, length);
+	if (result != EParsed)
+	{
+		return result;
+	}
+
+	const char* data = aData + sizeof(uint32_t);
+	aResponse.iId = read<uint32_t>(data);
+	aResponse.iStatus = read<uint8_t>(data);
+	aResponse.iTotal = read<int32_t>(data);
+	uint32_t count = read<uint32_t>(data);
+	if (length != kResponseHeader + (size_t)count * kResponseLine)
+	{
+		return EInvalid;
+	}
+	aConsumed = sizeof(uint32_t) + length;
+
+	aResponse.iLines.resize(count);
+	for (Line& line : aResponse.iLines)
+	{
+		line.iDeal = read<int32_t>(data);
+		line.iItemId = read<int32_t>(data);
+		line.iPrice = read<int32_t>(data);
+	}
+	return EParsed;
+}
+
+CheckoutProtocol::Response CheckoutProtocol::makeResponse(uint32_t aId, const Checkout::CheckoutResult& aResult, const std::map<const Deal*, int>& aDealIndex)
+{
+	Response response;
+	response.iId = aId;
+	response.iStatus = aResult.iProvenOptimal ? EOk : ENotOptimal;
+	response.iTotal = aResult.iTotal;
+	for (const Checkout::ReceiptLine& receiptLine : aResult.iLines)
+	{
+		Line line;
+		auto find = aDealIndex.find(std::get<0>(receiptLine));
+		line.iDeal = (find == aDealIndex.end()) ? -1 : find->second;
+		line.iItemId = std::get<1>(receiptLine).iId;
+		line.iPrice = std::get<2>(receiptLine);
+		response.iLines.push_back(line);
+	}
+	return response;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "checkout.h"
+
+/*
+ * The binary protocol between tills and checkout_server (over a Unix domain socket, so in host byte order).
+ *
+ * Every message is a frame: a uint32 length (of the rest of the frame), then
+ *   request:  uint32 id, uint32 item count, then per item: int32 id, int32 unit price
+ *   response: uint32 id, uint8 status, int32 total, uint32 line count,
+ *             then per line: int32 deal (position in the server's deal file, -1 for none), int32 item id, int32 price
+ *
+ * Requests can be pipelined (sent without waiting for the responses). Responses come back
+ * in the order of the requests on each connection, and carry the request's id.
+ */
+namespace CheckoutProtocol
+{
+	constexpr uint32_t kMaxItems = 1 << 16;
+
+	enum Status
+	{
+		EOk = 0,
+		ENotOptimal = 1,	// the search did not finish, the total may not be the best
+		EBadRequest = 2
+	};
+
+	enum ParseResult
+	{
+		EIncomplete,		// wait for more data
+		EParsed,
+		EInvalid			// not a frame (the stream cannot be followed any further)
+	};
+
+	struct Request
+	{
+		uint32_t iId{ 0 };
+		std::vector<Item> iItems;
+		bool iValid{ true };	// false if the frame's length and item count do not agree
+	};
+
+	struct Line
+	{
+		int32_t iDeal{ -1 };
+		int32_t iItemId{ 0 };
+		int32_t iPrice{ 0 };
+	};
+
+	struct Response
+	{
+		uint32_t iId{ 0 };
+		uint8_t iStatus{ EOk };
+		int32_t iTotal{ 0 };
+		std::vector<Line> iLines;
+	};
+
+	void appendRequest(std::string& aBuffer, const Request& aRequest);
+	void appendResponse(std::string& aBuffer, const Response& aResponse);
+
+	// Parse the frame at the start of aData, setting aConsumed to its size
+	ParseResult parseRequest(const char* aData, size_t aSize, Request& aRequest, size_t& aConsumed);
+	ParseResult parseResponse(const char* aData, size_t aSize, Response& aResponse, size_t& aConsumed);
+
+	// aDealIndex: the position of each deal in the server's deal file
+	Response makeResponse(uint32_t aId, const Checkout::CheckoutResult& aResult, const std::map<const Deal*, int>& aDealIndex);
+}
@@ -0,0 +1,114 @@
+#include "checkout_scheduler.h"
+#include <chrono>
+#include <cmath>
+#include <memory>
+
+double LaneMetrics::percentileMicros(double aFraction) const
+{
+	long counted = 0;
+	for (int b = 0; b < kBuckets; ++b)
+	{
+		counted += iLatency[b];
+		if (counted > 0 && counted >= aFraction * iCompleted)
+		{
+			return std::ldexp(1.0, b);
+		}
+	}
+	return 0.0;
+}
+
+CheckoutScheduler::CheckoutScheduler(const DealCatalog& aCatalog, const SchedulerOptions& aOptions) :
+	iCatalog(aCatalog), iOptions(aOptions),
+	iFast(aOptions.iFastThreads, aOptions.iFastMaxQueued), iHeavy(aOptions.iHeavyThreads, aOptions.iHeavyMaxQueued)
+{
+}
+
+double CheckoutScheduler::estimateCost(size_t aItems, size_t aDeals)
+{
+	double orderings = 1.0;
+	for (size_t d = 2; d <= aDeals && orderings < 1e18; ++d)
+	{
+		orderings *= d;
+	}
+	return aItems * orderings;
+}
+
+SchedulerLane CheckoutScheduler::lane(size_t aItems, size_t aDeals) const
+{
+	return (estimateCost(aItems, aDeals) > iOptions.iHeavyCost) ? ELaneHeavy : ELaneFast;
+}
+
+SchedulerLane CheckoutScheduler::lane(const std::vector<Item>& aBasket) const
+{
+	return lane(aBasket.size(), iCatalog.filterDeals(aBasket).size());
+}
+
+/*
+ The deals which apply are found here (to estimate the cost) and handed to the lane,
+ so the checkout does not look them up again.
+ */
+std::future<Checkout::CheckoutResult> CheckoutScheduler::submit(std::vector<Item> aBasket, const Checkout::CheckoutOptions& aOptions)
+{
+	auto candidates = std::make_shared<std::vector<const Deal*>>(iCatalog.filterDeals(aBasket, aOptions.iTime));
+	SchedulerLane lane = this->lane(aBasket.size(), candidates->size());
+	ThreadPool& pool = (lane == ELaneHeavy) ? iHeavy : iFast;
+
+	auto basket = std::make_shared<std::vector<Item>>(std::move(aBasket));
+	auto promise = std::make_shared<std::promise<Checkout::CheckoutResult>>();
+	std::future<Checkout::CheckoutResult> future = promise->get_future();
+	auto submitted = std::chrono::steady_clock::now();
+
+	// Queued with iMutex held, so the thread which takes it counts it off after it was counted on
+	std::lock_guard<std::mutex> lock(iMutex);
+	LaneMetrics& metrics = iMetrics[lane];
+
+	bool queued = pool.trySubmit([this, lane, basket, candidates, promise, submitted, aOptions]()
+	{
+		{
+			std::lock_guard<std::mutex> lock(iMutex);
+			--iMetrics[lane].iQueued;
+		}
+
+		try
+		{
+			promise->set_value(Checkout::solve(*basket, iCatalog, *candidates, aOptions));
+		}
+		catch (...)
+		{
+			promise->set_exception(std::current_exception());
+		}
+
+		std::chrono::duration<double, std::micro> latency = std::chrono::steady_clock::now() - submitted;
+		int bucket = (latency.count() < 1.0) ? 0 : std::min(LaneMetrics::kBuckets - 1, 1 + (int)std::log2(latency.count()));
+
+		std::lock_guard<std::mutex> lock(iMutex);
+		LaneMetrics& metrics = iMetrics[lane];
+		++metrics.iCompleted;
+		metrics.iTotalMicros += latency.count();
+		metrics.iMaxMicros = std::max(metrics.iMaxMicros, latency.count());
+		++metrics.iLatency[bucket];
+	});
+
+	if (!queued)
+	{
+		++metrics.iRejected;
+		return std::future<Checkout::CheckoutResult>();
+	}
+
+	++metrics.iSubmitted;
+	++metrics.iQueued;
+	metrics.iMaxQueued = std::max(metrics.iMaxQueued, metrics.iQueued);
+	return future;
+}
+
+LaneMetrics CheckoutScheduler::metrics(SchedulerLane aLane) const
+{
+	std::lock_guard<std::mutex> lock(iMutex);
+	return iMetrics[aLane];
+}
+
+void CheckoutScheduler::wait()
+{
+	iFast.wait();
+	iHeavy.wait();
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <future>
+#include <mutex>
+
+#include "checkout.h"
+#include "deal_catalog.h"
+#include "thread_pool.h"
+
+enum SchedulerLane
+{
+	ELaneFast = 0,		// cheap checkouts, kept clear of the heavy ones
+	ELaneHeavy = 1,		// expensive checkouts, on their own bounded pool
+	ELaneCount
+};
+
+struct SchedulerOptions
+{
+	size_t iFastThreads{ 1 };
+	size_t iFastMaxQueued{ 0 };		// 0 = no limit
+	size_t iHeavyThreads{ 1 };		// the most heavy checkouts running at once
+	size_t iHeavyMaxQueued{ 16 };
+
+	// Checkouts estimated to cost more than this go to the heavy lane (see CheckoutScheduler::estimateCost)
+	double iHeavyCost{ 5000.0 };
+};
+
+/*
+ * Counters for one lane. Latency is from submit until the result is ready (queueing included).
+ */
+struct LaneMetrics
+{
+	static constexpr int kBuckets = 32;
+
+	long iSubmitted{ 0 };
+	long iRejected{ 0 };			// refused as the lane's queue was full
+	long iCompleted{ 0 };
+	size_t iQueued{ 0 };			// waiting for a thread now
+	size_t iMaxQueued{ 0 };			// the most ever waiting
+	double iTotalMicros{ 0.0 };
+	double iMaxMicros{ 0.0 };
+	long iLatency[kBuckets] = {};	// bucket b: latency below 2^b microseconds (and not below 2^(b-1))
+
+	double meanMicros() const { return iCompleted == 0 ? 0.0 : iTotalMicros / iCompleted; };
+
+	// Upper bound of the latency bucket holding aFraction of the checkouts (e.g. 0.99)
+	double percentileMicros(double aFraction) const;
+};
+
+/*
+ * Runs checkouts on two lanes, so a few big baskets with many overlapping deals
+ * do not hold up the small baskets queued behind them.
+ *
+ * Each basket's cost is estimated when it is submitted, from its size and the number of deals which apply to it.
+ * Both lanes refuse work when their queue is full (the future is not valid()), as Checkout::checkoutAsync does.
+ */
+class CheckoutScheduler
+{
+public:
+	CheckoutScheduler(const DealCatalog& aCatalog, const SchedulerOptions& aOptions = SchedulerOptions());
+
+	// Items times the orderings of the deals (the work of a full search, before pruning)
+	static double estimateCost(size_t aItems, size_t aDeals);
+
+	// Which lane aBasket would run on
+	SchedulerLane lane(const std::vector<Item>& aBasket) const;
+
+	// aOptions is copied (see Checkout::checkoutAsync)
+	std::future<Checkout::CheckoutResult> submit(std::vector<Item> aBasket, const Checkout::CheckoutOptions& aOptions = Checkout::CheckoutOptions());
+
+	LaneMetrics metrics(SchedulerLane aLane) const;
+
+	// Wait until every checkout submitted so far has finished
+	void wait();
+
+private:
+	SchedulerLane lane(size_t aItems, size_t aDeals) const;
+
+	const DealCatalog& iCatalog;
+	SchedulerOptions iOptions;
+
+	mutable std::mutex iMutex;
+	LaneMetrics iMetrics[ELaneCount];
+
+	// (last, so the threads have stopped before the rest is destroyed)
+	ThreadPool iFast;
+	ThreadPool iHeavy;
+};
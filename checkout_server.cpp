@@ -0,0 +1,410 @@
+#include "checkout.h"
+#include "checkout_journal.h"
+#include "checkout_protocol.h"
+#include "deal_catalog.h"
+#include "item_catalog.h"
+#include "thread_pool.h"
+#include <iostream>
+#include <fstream>
+#include <memory>
+#include <csignal>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/*
+ * Checkout daemon: loads the deal catalog once and prices baskets for the tills on this server
+ * (see checkout_protocol.h for the protocol).
+ *
+ * One thread waits on every connection (poll). Each time round, the requests which have arrived
+ * on all connections are priced together with Checkout::checkoutBatch (on a pool of worker threads),
+ * so a till pipelining its requests, or many tills at once, fill larger batches.
+ *
+ * Usage: checkout_server <socket path> <deals file> [price list file] [threads] [journal directory] [max items] [budget ms]
+ *   deals file: one Deal::serialise() string per line
+ *   price list: "id unitPrice name" per line (for the catalog's price curves), or an item catalog file (see item_catalog.h)
+ *   journal directory: where to journal each checkout (see checkout_journal.h), deal ids as in the responses ("-" for none)
+ *   max items: larger baskets are refused with EBadRequest (default kDefaultMaxItems)
+ *   budget ms: how long one checkout may search (default kDefaultBudget), so one basket cannot hold up the others in its batch
+ *     and every till waiting on the poll loop; the best receipt found by then is returned
+ */
+
+namespace
+{
+	const size_t kDefaultMaxItems = 1000;
+	const std::chrono::milliseconds kDefaultBudget(50);
+
+	volatile std::sig_atomic_t gStop = 0;
+
+	void stop(int)
+	{
+		gStop = 1;
+	}
+
+	struct Connection
+	{
+		int iFd{ -1 };
+		std::string iIn;
+		std::string iOut;
+		bool iClosing{ false };		// close once iOut is written
+	};
+
+	// A request waiting for the batch, and where its response goes
+	struct Pending
+	{
+		Connection* iConnection;
+		CheckoutProtocol::Request iRequest;
+	};
+
+	bool setNonBlocking(int aFd)
+	{
+		int flags = fcntl(aFd, F_GETFL, 0);
+		return flags >= 0 && fcntl(aFd, F_SETFL, flags | O_NONBLOCK) == 0;
+	}
+
+	bool loadDeals(const std::string& aPath, std::vector<std::shared_ptr<Deal>>& aDeals)
+	{
+		std::ifstream file(aPath);
+		if (!file)
+		{
+			return false;
+		}
+
+		std::string line;
+		while (std::getline(file, line))
+		{
+			if (!line.empty() && line.back() == '\r')
+			{
+				line.pop_back();
+			}
+			if (!line.empty())
+			{
+				aDeals.push_back(Deal::deserialise(line));
+			}
+		}
+		return true;
+	}
+
+	// From an item catalog file, only the items the deals cover are copied out (the rest stay in the file)
+	bool loadPriceList(const std::string& aPath, const std::vector<std::shared_ptr<Deal>>& aDeals, std::vector<Item>& aPriceList)
+	{
+		if (ItemCatalog::isCatalog(aPath))
+		{
+			ItemCatalog catalog;
+			if (!catalog.open(aPath))
+			{
+				return false;
+			}
+			std::set<int> ids;
+			for (const std::shared_ptr<Deal>& deal : aDeals)
+			{
+				deal->coveredIds(ids);
+			}
+			for (int id : ids)
+			{
+				int index = catalog.find(id);
+				if (index >= 0)
+				{
+					aPriceList.push_back(catalog.item(index));
+				}
+			}
+			return true;
+		}
+
+		std::ifstream file(aPath);
+		if (!file)
+		{
+			return false;
+		}
+
+		int id;
+		int unitPrice;
+		std::string name;
+		while (file >> id >> unitPrice >> name)
+		{
+			aPriceList.push_back(Item(id, unitPrice, name));
+		}
+		return true;
+	}
+
+	// Read what has arrived, taking off any complete requests. false if the till has closed its end (or the connection failed).
+	bool readRequests(Connection& aConnection, std::vector<Pending>& aPending)
+	{
+		char buffer[64 * 1024];
+		bool open = true;
+		while (true)
+		{
+			ssize_t bytes = read(aConnection.iFd, buffer, sizeof(buffer));
+			if (bytes > 0)
+			{
+				aConnection.iIn.append(buffer, bytes);
+				continue;
+			}
+			if (bytes < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			open = (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+			break;
+		}
+
+		size_t offset = 0;
+		while (true)
+		{
+			Pending pending;
+			pending.iConnection = &aConnection;
+			size_t consumed = 0;
+			CheckoutProtocol::ParseResult result = CheckoutProtocol::parseRequest(aConnection.iIn.data() + offset, aConnection.iIn.size() - offset, pending.iRequest, consumed);
+			if (result == CheckoutProtocol::EIncomplete)
+			{
+				break;
+			}
+			if (result == CheckoutProtocol::EInvalid)
+			{
+				aConnection.iClosing = true;
+				break;
+			}
+
+			aPending.push_back(pending);
+			offset += consumed;
+		}
+		aConnection.iIn.erase(0, offset);
+		return open;
+	}
+
+	// false if the connection has failed
+	bool writeResponses(Connection& aConnection)
+	{
+		size_t offset = 0;
+		while (offset < aConnection.iOut.size())
+		{
+			ssize_t bytes = write(aConnection.iFd, aConnection.iOut.data() + offset, aConnection.iOut.size() - offset);
+			if (bytes > 0)
+			{
+				offset += bytes;
+				continue;
+			}
+			if (bytes < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			{
+				break;
+			}
+			return false;
+		}
+		aConnection.iOut.erase(0, offset);
+		return true;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 3)
+	{
+		std::cerr << "Usage: checkout_server <socket path> <deals file> [price list file] [threads] [journal directory] [max items] [budget ms]" << std::endl;
+		return 1;
+	}
+	std::string socketPath = argv[1];
+
+	std::vector<std::shared_ptr<Deal>> ownedDeals;
+	std::vector<Item> priceList;
+	try
+	{
+		if (!loadDeals(argv[2], ownedDeals))
+		{
+			std::cerr << "Could not read " << argv[2] << std::endl;
+			return 1;
+		}
+	}
+	catch (...)
+	{
+		std::cerr << "Invalid deal in " << argv[2] << std::endl;
+		return 1;
+	}
+	if (argc > 3 && !loadPriceList(argv[3], ownedDeals, priceList))
+	{
+		std::cerr << "Could not read " << argv[3] << std::endl;
+		return 1;
+	}
+
+	std::vector<const Deal*> deals;
+	std::map<const Deal*, int> dealIndex;
+	for (std::shared_ptr<Deal>& deal : ownedDeals)
+	{
+		dealIndex[deal.get()] = deals.size();
+		deals.push_back(deal.get());
+	}
+	DealCatalog catalog(deals, priceList);
+
+	std::unique_ptr<Journal> journal;
+	if (argc > 5 && std::string(argv[5]) != "-")
+	{
+		JournalOptions journalOptions;
+		journalOptions.iDirectory = argv[5];
+		journal.reset(new Journal(deals, journalOptions));
+		if (!journal->open())
+		{
+			std::cerr << "Could not open the journal in " << argv[5] << ": " << std::strerror(errno) << std::endl;
+			return 1;
+		}
+	}
+
+	ThreadPool pool((argc > 4) ? std::stoul(argv[4]) : 0);
+	Checkout::CheckoutStats stats;
+	Checkout::BatchOptions batchOptions;
+	batchOptions.iPool = &pool;
+	batchOptions.iCheckout.iStats = &stats;
+	batchOptions.iCheckout.iTimeBudget = (argc > 7) ? std::chrono::milliseconds(std::stol(argv[7])) : kDefaultBudget;
+	size_t maxItems = (argc > 6) ? std::stoul(argv[6]) : kDefaultMaxItems;
+
+	sockaddr_un address;
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (socketPath.size() >= sizeof(address.sun_path))
+	{
+		std::cerr << "Socket path too long" << std::endl;
+		return 1;
+	}
+	std::strcpy(address.sun_path, socketPath.c_str());
+
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	unlink(socketPath.c_str());
+	if (listener < 0 || bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 128) != 0 || !setNonBlocking(listener))
+	{
+		std::cerr << "Could not listen on " << socketPath << ": " << std::strerror(errno) << std::endl;
+		return 1;
+	}
+
+	std::signal(SIGINT, stop);
+	std::signal(SIGTERM, stop);
+	std::signal(SIGPIPE, SIG_IGN);
+	std::cout << "Serving " << deals.size() << " deals (" << catalog.curveCount() << " price curves) on " << socketPath
+		<< " with " << pool.size() << " threads" << std::endl;
+
+	std::vector<std::unique_ptr<Connection>> connections;
+	long requests = 0;
+	long batches = 0;
+
+	while (!gStop)
+	{
+		std::vector<pollfd> fds;
+		fds.push_back(pollfd{ listener, POLLIN, 0 });
+		for (std::unique_ptr<Connection>& connection : connections)
+		{
+			short events = connection->iClosing ? 0 : POLLIN;
+			if (!connection->iOut.empty())
+			{
+				events |= POLLOUT;
+			}
+			fds.push_back(pollfd{ connection->iFd, events, 0 });
+		}
+
+		if (poll(&fds[0], fds.size(), 200) < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			std::cerr << "poll: " << std::strerror(errno) << std::endl;
+			break;
+		}
+
+		// Requests from every connection, priced as one batch
+		std::vector<Pending> pending;
+		std::vector<bool> closed(connections.size(), false);
+		for (size_t c = 0; c < connections.size(); ++c)
+		{
+			// (a till which has closed its end still gets the responses to what it sent)
+			if (!connections[c]->iClosing && (fds[c + 1].revents & (POLLIN | POLLHUP | POLLERR)) && !readRequests(*connections[c], pending))
+			{
+				connections[c]->iClosing = true;
+			}
+		}
+
+		if (!pending.empty())
+		{
+			// (refused requests are priced as empty baskets, to keep the results in step)
+			std::vector<std::vector<Item>> baskets;
+			std::vector<bool> refused;
+			for (Pending& request : pending)
+			{
+				refused.push_back(!request.iRequest.iValid || request.iRequest.iItems.size() > maxItems);
+				baskets.push_back(refused.back() ? std::vector<Item>() : request.iRequest.iItems);
+			}
+			std::vector<Checkout::CheckoutResult> results = Checkout::checkoutBatch(baskets, catalog, batchOptions);
+
+			for (size_t r = 0; r < pending.size(); ++r)
+			{
+				CheckoutProtocol::Response response = CheckoutProtocol::makeResponse(pending[r].iRequest.iId, results[r], dealIndex);
+				if (refused[r])
+				{
+					response = CheckoutProtocol::Response();
+					response.iId = pending[r].iRequest.iId;
+					response.iStatus = CheckoutProtocol::EBadRequest;
+				}
+				else if (journal)
+				{
+					journal->append(results[r]);
+				}
+				CheckoutProtocol::appendResponse(pending[r].iConnection->iOut, response);
+			}
+			requests += pending.size();
+			++batches;
+		}
+
+		for (size_t c = 0; c < connections.size(); ++c)
+		{
+			Connection& connection = *connections[c];
+			if (!closed[c] && !connection.iOut.empty())
+			{
+				closed[c] = !writeResponses(connection);
+			}
+			if (connection.iClosing && connection.iOut.empty())
+			{
+				closed[c] = true;
+			}
+		}
+
+		for (size_t c = connections.size(); c-- > 0;)
+		{
+			if (closed[c])
+			{
+				close(connections[c]->iFd);
+				connections.erase(connections.begin() + c);
+			}
+		}
+
+		if (fds[0].revents & POLLIN)
+		{
+			int fd;
+			while ((fd = accept(listener, nullptr, nullptr)) >= 0)
+			{
+				setNonBlocking(fd);
+				std::unique_ptr<Connection> connection(new Connection());
+				connection->iFd = fd;
+				connections.push_back(std::move(connection));
+			}
+		}
+	}
+
+	for (std::unique_ptr<Connection>& connection : connections)
+	{
+		close(connection->iFd);
+	}
+	close(listener);
+	unlink(socketPath.c_str());
+
+	std::cout << requests << " requests in " << batches << " batches";
+	if (batches > 0)
+	{
+		std::cout << " (" << (double)requests / batches << " per batch, " << stats.iBasketsShared << " shared)";
+	}
+	std::cout << std::endl;
+	return 0;
+}
@@ -0,0 +1,279 @@
+#include "checkout_session.h"
+#include <algorithm>
+#include <set>
+
+CheckoutSession::CheckoutSession(const std::vector<const Deal*>& aDeals, const Checkout::CheckoutOptions& aOptions)
+	: iDeals(aDeals), iOptions(aOptions), iRules(aDeals.size()), iRuleCounts(aDeals.size()), iUnmetRules(aDeals.size(), 0)
+{
+	for (int d = 0; d < iDeals.size(); ++d)
+	{
+		std::set<int> ids;
+		if (iDeals[d]->coveredIds(ids))
+		{
+			for (int id : ids)
+			{
+				iDealsById[id].push_back(d);
+			}
+		}
+		else
+		{
+			iUnindexed.push_back(d);
+		}
+
+		iDeals[d]->eligibilityRules(iRules[d]);
+		iRuleCounts[d].assign(iRules[d].size(), 0);
+		for (int r = 0; r < iRules[d].size(); ++r)
+		{
+			const ItemCountRule& rule = iRules[d][r];
+			if (rule.iCount > 0)
+			{
+				++iUnmetRules[d];
+			}
+
+			for (int id : rule.iIds)
+			{
+				iRulesById[id].push_back(std::make_pair(d, r));
+			}
+		}
+	}
+}
+
+// aChange: +1 for a scan, -1 for a void
+void CheckoutSession::countRules(const Item& aItem, int aChange)
+{
+	auto find = iRulesById.find(aItem.iId);
+	if (find == iRulesById.end())
+	{
+		return;
+	}
+
+	for (const std::pair<int, int>& entry : find->second)
+	{
+		int d = entry.first;
+		int r = entry.second;
+		const ItemCountRule& rule = iRules[d][r];
+		if (!rule.matches(aItem))
+		{
+			continue;
+		}
+
+		bool wasMet = iRuleCounts[d][r] >= rule.iCount;
+		iRuleCounts[d][r] += aChange;
+		bool isMet = iRuleCounts[d][r] >= rule.iCount;
+		iUnmetRules[d] += (wasMet == isMet) ? 0 : (isMet ? -1 : 1);
+	}
+}
+
+int CheckoutSession::add(const Item& aItem)
+{
+	Line line{ iNextLineId++, aItem, std::vector<int>() };
+
+	std::vector<int> candidates = iUnindexed;
+	auto find = iDealsById.find(aItem.iId);
+	if (find != iDealsById.end())
+	{
+		candidates.insert(candidates.end(), find->second.begin(), find->second.end());
+	}
+
+	for (int d : candidates)
+	{
+		if (iDeals[d]->selectsOn(aItem) || iDeals[d]->targets(aItem))
+		{
+			line.iDeals.push_back(d);
+		}
+	}
+
+	countRules(aItem, 1);
+	iLines.push_back(line);
+	iDirty = true;
+	return line.iLineId;
+}
+
+bool CheckoutSession::voidLine(int aLineId)
+{
+	auto find = std::find_if(iLines.begin(), iLines.end(), [aLineId](const Line& aLine) { return aLine.iLineId == aLineId; });
+	if (find == iLines.end())
+	{
+		return false;
+	}
+
+	countRules(find->iItem, -1);
+	iLines.erase(find);
+	iDirty = true;
+	return true;
+}
+
+int CheckoutSession::total()
+{
+	update();
+	return iResult.iTotal;
+}
+
+Checkout::CheckoutResult CheckoutSession::result()
+{
+	update();
+	return iResult;
+}
+
+std::string CheckoutSession::receipt()
+{
+	update();
+	return Checkout::createReceipt(iResult.iLines, iResult.iTotal);
+}
+
+/*
+ * The same as the decomposed search: the best complete ordering of each component,
+ * plus untouched items at full price, or 'no deals' at all if that is cheaper.
+ */
+void CheckoutSession::update()
+{
+	if (!iDirty)
+	{
+		return;
+	}
+	iDirty = false;
+
+	// Group the deals in the basket with a union-find over the items they share
+	std::vector<int> parent(iDeals.size());
+	for (int d = 0; d < iDeals.size(); ++d)
+	{
+		parent[d] = d;
+	}
+
+	auto root = [&parent](int d)
+	{
+		while (parent[d] != d)
+		{
+			d = parent[d] = parent[parent[d]];
+		}
+		return d;
+	};
+
+	// Only deals which might apply
+	std::vector<std::vector<int>> lineDeals;
+	std::set<int> heldBack;
+	for (const Line& line : iLines)
+	{
+		lineDeals.push_back(std::vector<int>());
+		for (int d : line.iDeals)
+		{
+			if (iUnmetRules[d] == 0)
+			{
+				lineDeals.back().push_back(d);
+			}
+			else
+			{
+				heldBack.insert(d);
+			}
+		}
+
+		for (int d : lineDeals.back())
+		{
+			parent[root(d)] = root(lineDeals.back()[0]);
+		}
+	}
+
+	if (iOptions.iStats)
+	{
+		iOptions.iStats->iDealsNotEligible += heldBack.size();
+	}
+
+	std::map<int, std::vector<int>> dealsByRoot;
+	std::map<int, std::vector<Item>> itemsByRoot;
+	Checkout::CheckoutResult result;
+	for (int l = 0; l < iLines.size(); ++l)
+	{
+		const Item& item = iLines[l].iItem;
+		if (lineDeals[l].empty())
+		{
+			result.iLines.push_back(std::make_tuple(nullptr, item, item.iUnitPrice));
+			continue;
+		}
+
+		int r = root(lineDeals[l][0]);
+		itemsByRoot[r].push_back(item);
+		for (int d : lineDeals[l])
+		{
+			dealsByRoot[r].push_back(d);
+		}
+	}
+
+	std::map<std::vector<int>, Component> components;
+	for (auto& entry : dealsByRoot)
+	{
+		std::vector<int>& dealPositions = entry.second;
+		std::sort(dealPositions.begin(), dealPositions.end());
+		dealPositions.erase(std::unique(dealPositions.begin(), dealPositions.end()), dealPositions.end());
+
+		std::vector<Item>& items = itemsByRoot[entry.first];
+
+		auto find = iComponents.find(dealPositions);
+		if (find != iComponents.end() && find->second.iItems == items)
+		{
+			if (iOptions.iStats)
+			{
+				++iOptions.iStats->iComponentsReused;
+			}
+			components[dealPositions] = find->second;
+			continue;
+		}
+
+		std::vector<const Deal*> deals;
+		for (int d : dealPositions)
+		{
+			deals.push_back(iDeals[d]);
+		}
+
+		Component component;
+		component.iItems = items;
+		component.iResult = Checkout::solveAllDeals(items, deals, iOptions);
+		if (component.iResult.iLines.size() < items.size())
+		{
+			// The search stopped before it priced the items: charge them in full
+			component.iResult.iLines.clear();
+			for (const Item& item : items)
+			{
+				component.iResult.iLines.push_back(std::make_tuple(nullptr, item, item.iUnitPrice));
+			}
+		}
+		components[dealPositions] = component;
+	}
+
+	// Components no longer in the basket are dropped, and ones not proven optimal are solved again next time
+	iComponents.clear();
+	for (auto& entry : components)
+	{
+		const Checkout::CheckoutResult& part = entry.second.iResult;
+		result.iLines.insert(result.iLines.end(), part.iLines.begin(), part.iLines.end());
+		result.iProvenOptimal = result.iProvenOptimal && part.iProvenOptimal;
+		result.iCancelled = result.iCancelled || part.iCancelled;
+		if (part.iProvenOptimal)
+		{
+			iComponents.insert(entry);
+		}
+	}
+
+	int noDealsTotal = 0;
+	for (const Line& line : iLines)
+	{
+		noDealsTotal += line.iItem.iUnitPrice;
+	}
+
+	for (const Checkout::ReceiptLine& line : result.iLines)
+	{
+		result.iTotal += std::get<2>(line);
+	}
+
+	if (noDealsTotal <= result.iTotal)
+	{
+		result.iTotal = noDealsTotal;
+		result.iLines.clear();
+		for (const Line& line : iLines)
+		{
+			result.iLines.push_back(std::make_tuple(nullptr, line.iItem, line.iItem.iUnitPrice));
+		}
+	}
+
+	result.iStrategy = ESolverDecomposed;
+	iResult = result;
+}
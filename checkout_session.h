@@ -0,0 +1,79 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "checkout.h"
+
+/*
+ * A sale in progress: items are scanned (and voided) one at a time, with a running total.
+ *
+ * Deals which share items in the basket form a component (as for ESolverDecomposed).
+ * The best ordering of each component is kept, and when the basket changes only
+ * the components whose items (or deals) changed are solved again.
+ * (A component whose search ran out of budget or was cancelled is not kept, so it is solved again on the next change.)
+ * Closing the sale (receipt()) reuses everything already solved.
+ *
+ * Each deal's eligibility rules (Deal::eligibilityRules) are counted as items are scanned and voided,
+ * through an index of the deals (and rules) by item id. A deal is only handed to the solver
+ * once the basket meets all of its rules, so deals which cannot apply yet are not evaluated.
+ *
+ * The total is always the same as Checkout::checkoutItems on the whole basket.
+ */
+class CheckoutSession
+{
+public:
+	CheckoutSession(const std::vector<const Deal*>& aDeals, const Checkout::CheckoutOptions& aOptions = Checkout::CheckoutOptions());
+
+	// Returns the line id (used to void the item)
+	int add(const Item& aItem);
+
+	// false if there is no such line (or it has already been voided)
+	bool voidLine(int aLineId);
+
+	int total();
+	Checkout::CheckoutResult result();
+	std::string receipt();
+
+	size_t size() const { return iLines.size(); };
+
+private:
+	struct Line
+	{
+		int iLineId;
+		Item iItem;
+		std::vector<int> iDeals;	// positions in iDeals of the deals which apply to the item (eligible or not)
+	};
+
+	// A component's deals and items when it was solved, and the result
+	struct Component
+	{
+		std::vector<Item> iItems;
+		Checkout::CheckoutResult iResult;
+	};
+
+	void update();
+	void countRules(const Item& aItem, int aChange);
+
+	std::vector<const Deal*> iDeals;
+	Checkout::CheckoutOptions iOptions;
+
+	// Positions in iDeals by item id (Deal::coveredIds), and deals which must be checked for every item
+	std::unordered_map<int, std::vector<int>> iDealsById;
+	std::vector<int> iUnindexed;
+
+	// Eligibility: per deal, its rules, the matching items in the basket and how many rules are not yet met
+	std::vector<std::vector<ItemCountRule>> iRules;
+	std::vector<std::vector<int>> iRuleCounts;
+	std::vector<int> iUnmetRules;
+	std::unordered_map<int, std::vector<std::pair<int, int>>> iRulesById;	// <deal, rule> by item id
+
+	std::vector<Line> iLines;
+	int iNextLineId{ 1 };
+
+	std::map<std::vector<int>, Component> iComponents;	// by the deals in the component
+	bool iDirty{ false };
+	Checkout::CheckoutResult iResult;
+};
@@ -1,9 +1,34 @@
 //© 2016 Michael Cox
 #include "checkout.h"
+#include "ordering_cache.h"
+#include "deal_analysis.h"
+#include "deal_catalog.h"
+#include "cheapest_free.h"
+#include "checkout_session.h"
+#include "thread_pool.h"
+#include "basket_columns.h"
+#include "checkout_protocol.h"
+#include "checkout_scheduler.h"
+#include "receipt_writer.h"
+#include "checkout_journal.h"
+#include "item_taxonomy.h"
+#include "id_set_pool.h"
+#include "item_catalog.h"
+#include "barcode_index.h"
 #include "gtest/gtest.h"
 #include <string>
 #include <iostream>
 #include <set>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <cstdlib>
+#include <unistd.h>
+#include <csignal>
+#include <fstream>
+#include <iterator>
+#include <cerrno>
+#include <sys/resource.h>
 
 #ifdef _MSC_VER
 	// If editing in Visual Studio, define these
@@ -569,3 +594,2027 @@ TEST(Basics, TestSmartDeals_TescoMealDeal_ExtraItems_WithOptionalPizzaDeal_WitPi
 
 
 
+void TestOrderingCacheDeals(std::vector<const Deal*>& aDeals, std::vector<Item>& aItems, OrderingCache& aCache, Checkout::CheckoutStats& aStats, int expected)
+{
+	Checkout::CheckoutOptions options;
+	options.iOrderingCache = &aCache;
+	options.iStats = &aStats;
+	options.iStrategy = ESolverBranchAndBound; // (brute force does not use the cache)
+
+	int total;
+	std::string receipt = Checkout::checkoutItems(aItems, aDeals, total, options);
+	std::cout << receipt << std::endl;
+	ASSERT_EQ(total, expected);
+}
+
+TEST(OrderingCache, WarmStart)
+{
+	BuyAofXGetBofYForZ deal1(2, 1, 1, 1, 25); // Buy 2 of item1, get 1 item1 for 25 
+	BuyAofXGetBofYForZ deal2(2, 1, 1, 1, 22); // Buy 2 of item1, get 1 item1 for 22 
+	BuyAofXGetBofYForZ deal3(1, 2, 1, 2, 33); // Buy 1 of item2, get 1 item2 for 33
+
+	Item item1(1, 100, std::string("Item1"));
+	Item item2(2, 200, std::string("Item2"));
+
+	OrderingCache cache;
+	Checkout::CheckoutStats stats;
+
+	std::vector<const Deal*> deals{ &deal1, &deal2, &deal3 };
+	std::vector<Item> items{ 5, item1 };
+	items.push_back(item2);
+	TestOrderingCacheDeals(deals, items, cache, stats, 377);
+	ASSERT_EQ(cache.hits(), 0);
+	ASSERT_EQ(cache.size(), 1);
+
+	// Different basket, same deals (in a different order)
+	std::vector<const Deal*> deals2{ &deal3, &deal2, &deal1 };
+	std::vector<Item> items2{ 2, item1 };
+	items2.push_back(item2);
+	TestOrderingCacheDeals(deals2, items2, cache, stats, 155);
+
+	ASSERT_EQ(cache.hits(), 1);
+	ASSERT_EQ(cache.hitRate(), 0.5);
+	ASSERT_EQ(stats.iWarmStarts, 1);
+	ASSERT_EQ(stats.iCheckouts, 2);
+}
+
+TEST(OrderingCache, Bounded)
+{
+	BuyAofXGetBofYForZ deal1(2, 1, 1, 1, 25);
+	BuyAofXGetBofYForZ deal2(1, 2, 1, 2, 33);
+
+	Item item1(1, 100, std::string("Item1"));
+	Item item2(2, 200, std::string("Item2"));
+
+	OrderingCache cache(1);
+	Checkout::CheckoutStats stats;
+
+	std::vector<const Deal*> deals{ &deal1, &deal2 };
+	std::vector<Item> items{ item1, item1 };
+	TestOrderingCacheDeals(deals, items, cache, stats, 125);
+
+	deals = { &deal1, &deal2 };
+	items = { item2 };
+	TestOrderingCacheDeals(deals, items, cache, stats, 33);
+
+	ASSERT_EQ(cache.size(), 1);
+	ASSERT_EQ(cache.capacity(), 1);
+}
+
+TEST(OrderingCache, SaveAndLoad)
+{
+	BuyAofXGetBofYForZ deal1(2, 1, 1, 1, 25);
+	BuyAofXGetBofYForZ deal2(2, 1, 1, 1, 22);
+
+	std::vector<const Deal*> deals{ &deal1, &deal2 };
+
+	OrderingCache cache;
+	cache.store(deals, std::vector<int>{ 1, 0 });
+	ASSERT_EQ(cache.save("ordering_cache_test.txt"), true);
+
+	OrderingCache restarted;
+	ASSERT_EQ(restarted.load("ordering_cache_test.txt"), true);
+	std::remove("ordering_cache_test.txt");
+
+	std::vector<int> ordering;
+	ASSERT_EQ(restarted.lookup(deals, ordering), true);
+	ASSERT_EQ(ordering, (std::vector<int>{ 1, 0 }));
+
+	// A corrupt or truncated file is refused
+	for (std::string contents : { "x\n", "99999999999\n", "-1\n", "2 junk\n", "2\nkey\n" })
+	{
+		std::ofstream("ordering_cache_test.txt") << contents;
+		ASSERT_EQ(OrderingCache().load("ordering_cache_test.txt"), false) << contents;
+	}
+	std::remove("ordering_cache_test.txt");
+}
+
+TEST(OrderingCache, SmartDealKeys)
+{
+	Item crisps{ 1, 100, "Crisps" };
+	Item cola{ 2, 80, "Cola" };
+	SingleItemSelector crispsSelector{ crisps };
+	SingleItemSelector colaSelector{ cola };
+
+	DealSelectorSelectTargetPrice crispsFor80{ std::make_tuple(&crispsSelector, &crispsSelector, 80) };
+	DealSelectorSelectTargetPrice colaFor60{ std::make_tuple(&colaSelector, &colaSelector, 60) };
+	DealSelectorSelectTargetPrice colaFor50{ std::make_tuple(&colaSelector, &colaSelector, 50) };
+	StrictDealSelector strict1(crispsFor80);
+	StrictDealSelector strict2(colaFor60);
+	StrictDealSelector strict3(colaFor50);
+	std::vector<DealSelector*> selectors1{ &strict1 };
+	std::vector<DealSelector*> selectors2{ &strict2 };
+	std::vector<DealSelector*> selectors3{ &strict3 };
+	MultiDealSelector ds1(selectors1);
+	MultiDealSelector ds2(selectors2);
+	MultiDealSelector ds3(selectors3);
+	SmartDeal deal1(ds1);
+	SmartDeal deal2(ds2);
+	SmartDeal deal3(ds3);
+	SmartDeal deal1Again(ds1);
+
+	// Same name, different selectors or prices
+	ASSERT_NE(OrderingCache::dealKey(&deal1), OrderingCache::dealKey(&deal2));
+	ASSERT_NE(OrderingCache::dealKey(&deal2), OrderingCache::dealKey(&deal3));
+	ASSERT_EQ(OrderingCache::dealKey(&deal1), OrderingCache::dealKey(&deal1Again));
+}
+
+TEST(Anytime, WorkBudget)
+{
+	BuyAofXGetBofYForZ deal1(2, 1, 1, 1, 25); // Buy 2 of item1, get 1 item1 for 25 
+	BuyAofXGetBofYForZ deal2(2, 1, 1, 1, 22); // Buy 2 of item1, get 1 item1 for 22 
+	BuyAofXGetBofYForZ deal3(3, 1, 1, 1, 30);
+	BuyAofXGetBofYForZ deal4(3, 1, 2, 1, 60);
+	BuyAofXGetBofYForZ deal5(4, 1, 1, 1, 10);
+	std::vector<const Deal*> deals{ &deal1, &deal2, &deal3, &deal4, &deal5 };
+
+	Item item1(1, 100, std::string("Item1"));
+	std::vector<Item> items{ 5, item1 };
+
+	Checkout::CheckoutStats stats;
+	Checkout::CheckoutOptions options;
+	options.iStats = &stats;
+
+	Checkout::CheckoutResult exhaustive = Checkout::solve(items, deals, options);
+	ASSERT_EQ(exhaustive.iProvenOptimal, true);
+	ASSERT_EQ(stats.iBudgetExhausted, 0);
+
+	// Not enough work for more than the greedy pass
+	options.iWorkBudget = 1;
+	Checkout::CheckoutResult anytime = Checkout::solve(items, deals, options);
+	ASSERT_EQ(anytime.iProvenOptimal, false);
+	ASSERT_EQ(stats.iBudgetExhausted, 1);
+	// Greedy pass: better than no deals, but not the best
+	ASSERT_EQ(anytime.iTotal, 344);
+	ASSERT_EQ(exhaustive.iTotal, 342);
+	ASSERT_EQ(anytime.iLines.size(), items.size());
+}
+
+TEST(Anytime, TimeBudget)
+{
+	BuyAofXGetBofYForZ deal1(2, 1, 1, 1, 25);
+	BuyAofXGetBofYForZ deal2(2, 1, 1, 1, 22);
+	std::vector<const Deal*> deals{ &deal1, &deal2 };
+
+	Item item1(1, 100, std::string("Item1"));
+	std::vector<Item> items{ 5, item1 };
+
+	Checkout::CheckoutOptions options;
+	options.iTimeBudget = std::chrono::seconds(10);
+
+	Checkout::CheckoutResult result = Checkout::solve(items, deals, options);
+	ASSERT_EQ(result.iProvenOptimal, true);
+	ASSERT_EQ(result.iTotal, 344);
+}
+
+TEST(Anytime, BruteForceAlwaysPrices)
+{
+	BuyAofXGetBofYForZ deal1(2, 1, 1, 1, 25);
+	BuyAofXGetBofYForZ deal2(3, 1, 1, 1, 10);
+	std::vector<const Deal*> deals{ &deal1, &deal2 };
+
+	Item item1(1, 100, std::string("Item1"));
+	std::vector<Item> items{ 5, item1 };
+
+	// Cancelled before it starts: still one ordering (without 'no deals' to fall back on)
+	std::atomic<bool> cancel(true);
+	Checkout::CheckoutOptions options;
+	options.iStrategy = ESolverBruteForce;
+	options.iCancel = &cancel;
+
+	Checkout::CheckoutResult result = Checkout::solveAllDeals(items, deals, options);
+	ASSERT_EQ(result.iCancelled, true);
+	ASSERT_EQ(result.iLines.size(), items.size());
+	ASSERT_LE(result.iTotal, 500);
+}
+
+// Random model deals over a few items (prices may be above the unit price, i.e. bad deals)
+std::vector<BuyAofXGetBofYForZ> RandomDeals(std::mt19937& aRandom, int aNumDeals, int aNumItems)
+{
+	std::vector<BuyAofXGetBofYForZ> deals;
+	for (int d = 0; d < aNumDeals; ++d)
+	{
+		int selectionId = 1 + aRandom() % aNumItems;
+		int targetId = (aRandom() % 2) ? selectionId : 1 + aRandom() % aNumItems;
+		deals.push_back(BuyAofXGetBofYForZ(1 + aRandom() % 3, selectionId, 1 + aRandom() % 2, targetId, aRandom() % 120));
+	}
+	return deals;
+}
+
+std::vector<Item> RandomBasket(std::mt19937& aRandom, int aNumItems, int aSize)
+{
+	std::vector<Item> items;
+	for (int i = 0; i < aSize; ++i)
+	{
+		int id = 1 + aRandom() % aNumItems;
+		items.push_back(Item(id, 100 + id, "Item" + std::to_string(id)));
+	}
+	return items;
+}
+
+TEST(SolverStrategy, StrategiesAgree)
+{
+	std::mt19937 random(26);
+	for (int run = 0; run < 200; ++run)
+	{
+		std::vector<BuyAofXGetBofYForZ> deals = RandomDeals(random, 1 + run % 5, 5);
+		std::vector<const Deal*> dealPtrs;
+		for (BuyAofXGetBofYForZ& deal : deals)
+		{
+			dealPtrs.push_back(&deal);
+		}
+		std::vector<Item> items = RandomBasket(random, 5, 1 + run % 9);
+
+		Checkout::CheckoutOptions options;
+		options.iStrategy = ESolverBruteForce;
+		int expected = Checkout::solve(items, dealPtrs, options).iTotal;
+
+		options.iStrategy = ESolverBranchAndBound;
+		ASSERT_EQ(Checkout::solve(items, dealPtrs, options).iTotal, expected);
+
+		options.iStrategy = ESolverDecomposed;
+		ASSERT_EQ(Checkout::solve(items, dealPtrs, options).iTotal, expected);
+	}
+}
+
+TEST(SolverStrategy, TranspositionTable)
+{
+	std::mt19937 random(41);
+	Checkout::CheckoutStats withTable;
+	Checkout::CheckoutStats withoutTable;
+	for (int run = 0; run < 40; ++run)
+	{
+		std::vector<BuyAofXGetBofYForZ> deals = RandomDeals(random, 4 + run % 3, 4);
+		std::vector<const Deal*> dealPtrs;
+		for (BuyAofXGetBofYForZ& deal : deals)
+		{
+			dealPtrs.push_back(&deal);
+		}
+		std::vector<Item> items = RandomBasket(random, 4, 6 + run % 8);
+
+		Checkout::CheckoutOptions options;
+		options.iStrategy = ESolverBranchAndBound;
+		options.iTranspositionEntries = 0;
+		options.iStats = &withoutTable;
+		Checkout::CheckoutResult expected = Checkout::solve(items, dealPtrs, options);
+
+		options.iTranspositionEntries = 1 << 14;
+		options.iStats = &withTable;
+		Checkout::CheckoutResult result = Checkout::solve(items, dealPtrs, options);
+		ASSERT_EQ(result.iTotal, expected.iTotal);
+		int linesTotal = 0;
+		for (const Checkout::ReceiptLine& line : result.iLines)
+		{
+			linesTotal += std::get<2>(line);
+		}
+		ASSERT_EQ(linesTotal, expected.iTotal);
+
+		// A table too small to hold the search is emptied as it goes
+		options.iTranspositionEntries = 3;
+		options.iStats = nullptr;
+		ASSERT_EQ(Checkout::solve(items, dealPtrs, options).iTotal, expected.iTotal);
+	}
+
+	ASSERT_GT(withTable.iTranspositionHits, 0);
+	ASSERT_EQ(withoutTable.iTranspositionHits, 0);
+	ASSERT_LT(withTable.iDealEvaluations, withoutTable.iDealEvaluations);
+}
+
+// Implements only evaluate(), so the search uses the default Deal::evaluateLines
+class VectorOnlyDeal : public Deal
+{
+public:
+	VectorOnlyDeal(const BuyAofXGetBofYForZ& aDeal) : Deal("VectorOnly"), iDeal(aDeal) {};
+
+	virtual std::vector<std::pair<Item, int>> evaluate(std::vector<Item>& aInput) const { return iDeal.evaluate(aInput); };
+	virtual bool selectsOn(const Item& aItem) const { return iDeal.selectsOn(aItem); };
+	virtual bool targets(const Item& aItem) const { return iDeal.targets(aItem); };
+	virtual std::string serialise() const { return iDeal.serialise(); };
+
+private:
+	BuyAofXGetBofYForZ iDeal;
+};
+
+TEST(DealLines, MatchEvaluate)
+{
+	std::mt19937 random(42);
+
+	Item sandwich(1, 250, "Sandwich");
+	Item crisps(2, 80, "Crisps");
+	Item drink(3, 120, "Drink");
+	std::set<Item> mains{ sandwich, Item(4, 300, "Wrap") };
+	std::set<Item> snacks{ crisps, drink };
+	CountedCheapestInSetSelector main(mains, 1);
+	SingleInSetSelector snack(snacks);
+	CountedSpecificItemSelector twoDrinks(drink, 2);
+	GreedyAnyInSetSelector anySnack(snacks);
+	DealSelectorSelectTargetPrice mainPart{ std::make_tuple(&main, &main, 200) };
+	DealSelectorSelectTargetPrice snackPart{ std::make_tuple(&snack, &snack, 50) };
+	DealSelectorSelectTargetPrice drinksPart{ std::make_tuple(&twoDrinks, &anySnack, 60) };
+	StrictDealSelector strictMain(mainPart);
+	StrictDealSelector strictSnack(snackPart);
+	OptionalDealSelector optionalDrinks(drinksPart);
+	std::vector<DealSelector*> parts{ &strictMain, &strictSnack, &optionalDrinks };
+	MultiDealSelector multi(parts);
+	SmartDeal mealDeal(multi);
+
+	for (int run = 0; run < 300; ++run)
+	{
+		std::vector<BuyAofXGetBofYForZ> models = RandomDeals(random, 2, 4);
+		BuyInSetOfXCheapestFree cheapestFree({ 1 + (int)(random() % 4), 1 + (int)(random() % 4) }, 1 + random() % 3);
+		VectorOnlyDeal vectorOnly(models[1]);
+		std::vector<const Deal*> deals{ &models[0], &cheapestFree, &vectorOnly, &mealDeal };
+
+		std::vector<Item> basket = RandomBasket(random, 4, random() % 10);
+		basket.push_back((random() % 2) ? crisps : drink);
+		basket.push_back(Item(1, 90 + random() % 2 * 160, "Item1"));
+
+		std::vector<unsigned char> consumed(basket.size());
+		std::vector<Item> available;
+		for (size_t line = 0; line < basket.size(); ++line)
+		{
+			consumed[line] = (random() % 4 == 0);
+			if (!consumed[line])
+			{
+				available.push_back(basket[line]);
+			}
+		}
+		BasketView view{ basket.data(), consumed.data(), (int)basket.size() };
+
+		std::vector<LinePrice> result;
+		for (const Deal* deal : deals)
+		{
+			std::vector<Item> input = available;
+			std::vector<std::pair<Item, int>> expected = deal->evaluate(input);
+			deal->evaluateLines(view, result);
+
+			ASSERT_EQ(result.size(), expected.size()) << deal->name();
+			std::set<int> used;
+			for (size_t r = 0; r < result.size(); ++r)
+			{
+				int line = result[r].first;
+				ASSERT_TRUE(view.available(line));
+				ASSERT_TRUE(used.insert(line).second);
+				ASSERT_EQ(basket[line], expected[r].first) << deal->name();
+				ASSERT_EQ(result[r].second, expected[r].second) << deal->name();
+			}
+		}
+	}
+}
+
+TEST(SolverStrategy, ChosenPerCheckout)
+{
+	Item item1(1, 100, "Item1");
+	Item item2(2, 100, "Item2");
+	Item item3(3, 100, "Item3");
+
+	BuyAofXGetBofYForZ deal1(2, 1, 1, 1, 25);
+	BuyAofXGetBofYForZ deal2(2, 1, 1, 1, 22);
+	BuyAofXGetBofYForZ deal3(1, 2, 1, 2, 50);
+	BuyAofXGetBofYForZ deal4(2, 2, 1, 2, 10);
+	BuyAofXGetBofYForZ deal5(1, 3, 1, 3, 70);
+	std::vector<const Deal*> deals{ &deal1, &deal2, &deal3, &deal4, &deal5 };
+
+	Checkout::CheckoutStats stats;
+	Checkout::CheckoutOptions options;
+	options.iStats = &stats;
+
+	// Two deals apply
+	std::vector<Item> small{ item1, item1, item1 };
+	ASSERT_EQ(Checkout::solve(small, deals, options).iStrategy, ESolverBruteForce);
+
+	// Five deals, in three independent groups
+	std::vector<Item> mixed{ item1, item1, item2, item2, item3 };
+	ASSERT_EQ(Checkout::solve(mixed, deals, options).iStrategy, ESolverDecomposed);
+
+	// Five deals, all on the same item
+	BuyAofXGetBofYForZ deal6(3, 1, 1, 1, 5);
+	BuyAofXGetBofYForZ deal7(4, 1, 2, 1, 5);
+	BuyAofXGetBofYForZ deal8(1, 1, 1, 1, 90);
+	std::vector<const Deal*> sameItem{ &deal1, &deal2, &deal6, &deal7, &deal8 };
+	std::vector<Item> large{ 6, item1 };
+	ASSERT_EQ(Checkout::solve(large, sameItem, options).iStrategy, ESolverBranchAndBound);
+
+	ASSERT_EQ(stats.iStrategies[ESolverBruteForce], 1);
+	ASSERT_EQ(stats.iStrategies[ESolverDecomposed], 1);
+	ASSERT_EQ(stats.iStrategies[ESolverBranchAndBound], 1);
+}
+
+TEST(SolverStrategy, Calibrate)
+{
+	// Brute force wins up to 4 deals, decomposing wins up to a density of 0.25
+	std::vector<CostSample> samples;
+	for (int deals = 1; deals <= 6; ++deals)
+	{
+		CostSample sample;
+		sample.iFeatures.iDeals = deals;
+		sample.iFeatures.iItems = 10;
+		sample.iFeatures.iDensity = deals / 20.0;
+		sample.iFeatures.iComponents = { { 0 }, { 1 } };
+		sample.iMicros[ESolverBruteForce] = (deals <= 4) ? 1.0 : 100.0;
+		sample.iMicros[ESolverBranchAndBound] = 10.0;
+		sample.iMicros[ESolverDecomposed] = (deals <= 5) ? 5.0 : 50.0;
+		samples.push_back(sample);
+	}
+
+	CostModel model;
+	model.calibrate(samples);
+	ASSERT_EQ(model.iBruteForceMaxDeals, 4);
+	ASSERT_EQ(model.iBruteForceMaxItems, 10);
+	ASSERT_EQ(model.iDecomposeMaxDensity, 0.25);
+
+	ASSERT_EQ(model.save("cost_model_test.txt"), true);
+	CostModel loaded;
+	ASSERT_EQ(loaded.load("cost_model_test.txt"), true);
+	std::remove("cost_model_test.txt");
+	ASSERT_EQ(loaded.iBruteForceMaxDeals, 4);
+	ASSERT_EQ(loaded.iDecomposeMaxDensity, 0.25);
+}
+
+TEST(DealAnalysis, Dominates)
+{
+	BuyAofXGetBofYForZ buy2For150(2, 1, 2, 1, 75);
+	BuyAofXGetBofYForZ buy2For180(2, 1, 2, 1, 90);
+	BuyAofXGetBofYForZ buy3For180(3, 1, 3, 1, 60);
+
+	ASSERT_EQ(dominates(&buy2For150, &buy2For180), true);
+	ASSERT_EQ(dominates(&buy2For180, &buy2For150), false);
+	ASSERT_EQ(dominates(&buy3For180, &buy2For180), false); // needs more items
+
+	BuyInSetOfXCheapestFree set12{ std::set<int>{ 1, 2 }, 2 };
+	BuyInSetOfXCheapestFree set12Again{ std::set<int>{ 1, 2 }, 2 };
+	BuyInSetOfXCheapestFree set123{ std::set<int>{ 1, 2, 3 }, 2 };
+
+	ASSERT_EQ(dominates(&set12, &set12Again), true);
+	ASSERT_EQ(dominates(&set123, &set12), false);
+	ASSERT_EQ(dominates(&set12, &buy2For150), false);
+}
+
+TEST(DealAnalysis, DominatedDealsPruned)
+{
+	BuyAofXGetBofYForZ buy2For150(2, 1, 2, 1, 75);
+	BuyAofXGetBofYForZ buy2For180(2, 1, 2, 1, 90);
+	BuyAofXGetBofYForZ buy2For150Again(2, 1, 2, 1, 75);
+	BuyAofXGetBofYForZ buy3For200(3, 1, 3, 1, 66);
+	std::vector<const Deal*> deals{ &buy2For180, &buy2For150, &buy3For200, &buy2For150Again };
+
+	Item item1(1, 100, "Item1");
+	std::vector<Item> items{ 7, item1 };
+
+	Checkout::CheckoutStats stats;
+	Checkout::CheckoutOptions options;
+	options.iStats = &stats;
+
+	// 198 + 198 + 100
+	int total;
+	std::string receipt = Checkout::checkoutItems(items, deals, total, options);
+	std::cout << receipt << std::endl;
+	ASSERT_EQ(total, 496);
+	ASSERT_EQ(stats.iDealsPruned, 2);
+}
+
+TEST(PriceCurve, MatchesDealOrderings)
+{
+	std::mt19937 random(30);
+	for (int run = 0; run < 50; ++run)
+	{
+		int unitPrice = 50 + random() % 100;
+		std::vector<std::unique_ptr<Deal>> owned;
+		std::vector<const Deal*> deals;
+		std::vector<SingleItemBundle> bundles;
+		for (int b = 0; b < 1 + random() % 3; ++b)
+		{
+			// Buy A get B at Z (B <= A)
+			int targetCount = 1 + random() % 4;
+			owned.emplace_back(new BuyAofXGetBofYForZ(targetCount + random() % 3, 1, targetCount, 1, random() % unitPrice));
+			deals.push_back(owned.back().get());
+
+			SingleItemBundle bundle;
+			ASSERT_TRUE(singleItemBundle(deals.back(), bundle));
+			bundles.push_back(bundle);
+		}
+
+		// As the search prices n units
+		PriceCurve curve(unitPrice, bundles);
+		Item item1(1, unitPrice, "Item1");
+		for (int n = 0; n <= 25; ++n)
+		{
+			std::vector<Item> items(n, item1);
+			ASSERT_EQ(curve.price(n), Checkout::solve(items, deals, Checkout::CheckoutOptions()).iTotal);
+		}
+
+		// The table and its periodic tail, against every ordering priced in turn
+		ASSERT_LE(curve.tableSize(), (size_t)PriceCurve::kMaxTableSize);
+		for (int n = 0; n <= 3000; n += 1 + n / 100)
+		{
+			std::vector<int> ordering;
+			for (int b = 0; b < bundles.size(); ++b)
+			{
+				ordering.push_back(b);
+			}
+			int expected = std::numeric_limits<int>::max();
+			do
+			{
+				int units = n;
+				int total = 0;
+				for (int b : ordering)
+				{
+					total += units / bundles[b].iUnits * bundles[b].cost(unitPrice);
+					units %= bundles[b].iUnits;
+				}
+				expected = std::min(expected, total + units * unitPrice);
+			} while (std::next_permutation(ordering.begin(), ordering.end()));
+			ASSERT_EQ(curve.price(n), expected) << "run " << run << " n " << n;
+		}
+
+		// The receipt lines add up to the curve price
+		std::vector<std::tuple<const Deal*, Item, int>> lines;
+		ASSERT_EQ(curve.priceItems(std::vector<Item>(37, item1), lines), curve.price(37));
+		ASSERT_EQ(lines.size(), 37);
+		lines.clear();
+		ASSERT_EQ(curve.priceItems(std::vector<Item>(2500, item1), lines), curve.price(2500));
+	}
+}
+
+TEST(DealCatalog, CurvePricedItems)
+{
+	// 5 for 400, 3 for 210
+	BuyAofXGetBofYForZ buy5(5, 1, 5, 1, 80);
+	BuyAofXGetBofYForZ buy3(3, 1, 3, 1, 70);
+	std::vector<const Deal*> deals{ &buy5, &buy3 };
+
+	Item item1(1, 100, "Item1");
+	DealCatalog catalog(deals, std::vector<Item>{ item1 });
+	ASSERT_EQ(catalog.curveCount(), 1);
+	ASSERT_NE(catalog.curve(item1), nullptr);
+	ASSERT_EQ(catalog.curve(Item(1, 90, "Item1")), nullptr);
+
+	Checkout::CheckoutStats stats;
+	Checkout::CheckoutOptions options;
+	options.iStats = &stats;
+
+	// Applying each deal until it stops matching: 210 * 3 + 200 (not 400 + 210 + 210)
+	std::vector<Item> items{ 11, item1 };
+	int total;
+	Checkout::checkoutItems(items, deals, total, options);
+	ASSERT_EQ(total, 830);
+
+	// The curve gives the same
+	std::string receipt = Checkout::checkoutItems(items, catalog, total, options);
+	std::cout << receipt << std::endl;
+	ASSERT_EQ(total, 830);
+	ASSERT_EQ(stats.iCurvePricedItems, 11);
+}
+
+TEST(DealCatalog, SharedItemsAreSearched)
+{
+	BuyAofXGetBofYForZ buy3(3, 1, 3, 1, 70);		// item 1: 3 for 210
+	BuyAofXGetBofYForZ buy2(2, 2, 2, 2, 40);		// item 2: 2 for 80
+	BuyInSetOfXCheapestFree set23{ std::set<int>{ 2, 3 }, 2 };
+	std::vector<const Deal*> deals{ &buy3, &buy2, &set23 };
+
+	Item item1(1, 100, "Item1");
+	Item item2(2, 50, "Item2");
+	Item item3(3, 60, "Item3");
+	DealCatalog catalog(deals, std::vector<Item>{ item1, item2, item3 });
+
+	// Item 2 is also in the set deal, so only item 1 has a curve
+	ASSERT_EQ(catalog.curveCount(), 1);
+	ASSERT_EQ(catalog.filterDeals(std::vector<Item>{ item1 }), std::vector<const Deal*>{ &buy3 });
+	ASSERT_EQ(catalog.filterDeals(std::vector<Item>{ item3, item1 }), (std::vector<const Deal*>{ &buy3, &set23 }));
+
+	Checkout::CheckoutStats stats;
+	Checkout::CheckoutOptions options;
+	options.iStats = &stats;
+
+	std::vector<Item> items{ item1, item2, item1, item3, item2, item1, item1 };
+	int expected;
+	Checkout::checkoutItems(items, deals, expected, options);
+
+	int total;
+	Checkout::checkoutItems(items, catalog, total, options);
+	ASSERT_EQ(total, expected);
+	ASSERT_EQ(stats.iCurvePricedItems, 4);
+}
+
+TEST(DealCatalog, CancelledBeforeSearching)
+{
+	BuyAofXGetBofYForZ buy3(3, 1, 3, 1, 70);		// item 1: 3 for 210 (a curve)
+	BuyAofXGetBofYForZ buy2(2, 2, 2, 2, 40);		// item 2: 2 for 80
+	BuyInSetOfXCheapestFree set23{ std::set<int>{ 2, 3 }, 2 };
+	std::vector<const Deal*> deals{ &buy3, &buy2, &set23 };
+
+	Item item1(1, 100, "Item1");
+	Item item2(2, 50, "Item2");
+	Item item3(3, 60, "Item3");
+	DealCatalog catalog(deals, std::vector<Item>{ item1, item2, item3 });
+
+	// e.g. the till cancels when the next item is scanned
+	std::atomic<bool> cancel(true);
+	Checkout::CheckoutOptions options;
+	options.iCancel = &cancel;
+
+	std::vector<Item> items{ item1, item2, item1, item3, item2, item1 };
+	Checkout::CheckoutResult result = Checkout::solve(items, catalog, options);
+	ASSERT_EQ(result.iLines.size(), items.size());
+	ASSERT_GT(result.iTotal, 0);
+	ASSERT_LE(result.iTotal, 460);
+
+	int linesTotal = 0;
+	for (Checkout::ReceiptLine& line : result.iLines)
+	{
+		linesTotal += std::get<2>(line);
+	}
+	ASSERT_EQ(linesTotal, result.iTotal);
+}
+
+TEST(DealCatalog, MatchesDealList)
+{
+	std::mt19937 random(33);
+	for (int run = 0; run < 200; ++run)
+	{
+		std::vector<Item> catalogue;
+		for (int id = 1; id <= 5; ++id)
+		{
+			catalogue.push_back(Item(id, 50 + random() % 100, "Item" + std::to_string(id)));
+		}
+
+		// Single item deals on items 1 to 4 (some dearer than the items), and sometimes a set deal sharing item 4
+		std::vector<std::unique_ptr<Deal>> owned;
+		for (int d = 0; d < 2 + random() % 5; ++d)
+		{
+			const Item& item = catalogue[random() % 4];
+			int targetCount = 1 + random() % 3;
+			owned.emplace_back(new BuyAofXGetBofYForZ(targetCount + random() % 3, item.iId, targetCount, item.iId, random() % (item.iUnitPrice + 20)));
+		}
+		if (random() % 2)
+		{
+			owned.emplace_back(new BuyInSetOfXCheapestFree(std::set<int>{ 4, 5 }, 2));
+		}
+		std::vector<const Deal*> deals;
+		for (const std::unique_ptr<Deal>& deal : owned)
+		{
+			deals.push_back(deal.get());
+		}
+		DealCatalog catalog(deals, catalogue);
+
+		std::vector<Item> basket;
+		for (int i = random() % 16; i > 0; --i)
+		{
+			basket.push_back(catalogue[random() % catalogue.size()]);
+		}
+
+		Checkout::CheckoutOptions options;
+		ASSERT_EQ(Checkout::solve(basket, catalog, options).iTotal, Checkout::solve(basket, deals, options).iTotal) << "run " << run;
+	}
+}
+
+TEST(CheapestFree, MatchesExhaustiveSearch)
+{
+	std::mt19937 random(31);
+	for (int run = 0; run < 300; ++run)
+	{
+		// Overlapping sets over 6 items, some items at the same price
+		std::vector<BuyInSetOfXCheapestFree> deals;
+		for (int d = 0; d < 1 + run % 4; ++d)
+		{
+			std::set<int> set;
+			for (int id = 1; id <= 6; ++id)
+			{
+				if (random() % 2)
+				{
+					set.insert(id);
+				}
+			}
+			deals.push_back(BuyInSetOfXCheapestFree(set, 1 + random() % 4));
+		}
+
+		std::vector<const Deal*> dealPtrs;
+		for (BuyInSetOfXCheapestFree& deal : deals)
+		{
+			dealPtrs.push_back(&deal);
+		}
+
+		std::vector<Item> items;
+		for (int i = 0; i < run % 12; ++i)
+		{
+			int id = 1 + random() % 6;
+			items.push_back(Item(id, 10 * (1 + id % 3), "Item" + std::to_string(id)));
+		}
+
+		Checkout::CheckoutOptions options;
+		options.iStrategy = ESolverBruteForce;
+		int expected = Checkout::solve(items, dealPtrs, options).iTotal;
+
+		Checkout::CheckoutStats stats;
+		options.iStats = &stats;
+		options.iStrategy = ESolverAuto;
+		Checkout::CheckoutResult result = Checkout::solve(items, dealPtrs, options);
+		ASSERT_EQ(result.iTotal, expected);
+		// (one pass per deal in each ordering, no repeated Deal::evaluate calls)
+		ASSERT_LE(stats.iDealEvaluations, stats.iOrderingsEvaluated * (long)dealPtrs.size());
+		ASSERT_EQ(stats.iDealEvaluations > 0, stats.iStrategies[ESolverCheapestFree] > 0);
+
+		int linesTotal = 0;
+		for (Checkout::ReceiptLine& line : result.iLines)
+		{
+			linesTotal += std::get<2>(line);
+		}
+		ASSERT_EQ(linesTotal, expected);
+		ASSERT_EQ(result.iLines.size(), items.size());
+	}
+}
+
+TEST(CheapestFree, ChosenForCheapestFreeBaskets)
+{
+	Item item1(1, 100, "Item1");
+	Item item2(2, 200, "Item2");
+	BuyInSetOfXCheapestFree set12{ std::set<int>{ 1, 2 }, 3 };
+	BuyAofXGetBofYForZ buy2(2, 1, 2, 1, 75);
+
+	Checkout::CheckoutStats stats;
+	Checkout::CheckoutOptions options;
+	options.iStats = &stats;
+
+	std::vector<Item> items{ item1, item2, item1, item2, item2, item1 };
+	std::vector<const Deal*> deals{ &set12 };
+	int total;
+	std::string receipt = Checkout::checkoutItems(items, deals, total, options);
+	std::cout << receipt << std::endl;
+	ASSERT_EQ(total, 600); // (0 100 100) (0 200 200)
+	ASSERT_EQ(stats.iStrategies[ESolverCheapestFree], 1);
+
+	// Forcing it with another kind of deal falls back to branch and bound
+	options.iStrategy = ESolverCheapestFree;
+	deals = std::vector<const Deal*>{ &set12, &buy2 };
+	ASSERT_EQ(Checkout::solve(items, deals, options).iStrategy, ESolverBranchAndBound);
+}
+
+TEST(CheapestFree, RespectsBudget)
+{
+	// Overlapping sets: each deal shares items with the next
+	std::vector<BuyInSetOfXCheapestFree> owned;
+	for (int d = 0; d < 10; ++d)
+	{
+		owned.push_back(BuyInSetOfXCheapestFree(std::set<int>{ d + 1, d + 2, d + 3, (d + 6) % 12 + 1 }, 2 + d % 3));
+	}
+	std::vector<Item> items;
+	for (int id = 1; id <= 12; ++id)
+	{
+		items.push_back(Item(id, 10 * id, "Item" + std::to_string(id)));
+	}
+
+	auto solve = [&](int aDeals, const Checkout::CheckoutOptions& aOptions)
+	{
+		std::vector<const Deal*> deals;
+		for (int d = 0; d < aDeals; ++d)
+		{
+			deals.push_back(&owned[d]);
+		}
+		return Checkout::solve(items, deals, aOptions);
+	};
+
+	Checkout::CheckoutOptions options;
+	options.iWorkBudget = 100;
+	options.iTimeBudget = std::chrono::milliseconds(5);
+
+	// Too many overlapping deals to try every ordering: branch and bound, within the budget
+	Checkout::CheckoutResult result = solve(10, options);
+	ASSERT_EQ(result.iStrategy, ESolverBranchAndBound);
+	ASSERT_FALSE(result.iProvenOptimal);
+
+	// Few enough, but the budget stops the orderings early
+	int best = solve(5, Checkout::CheckoutOptions()).iTotal;
+	result = solve(5, options);
+	ASSERT_EQ(result.iStrategy, ESolverCheapestFree);
+	ASSERT_FALSE(result.iProvenOptimal);
+	ASSERT_GE(result.iTotal, best);
+	ASSERT_EQ(result.iLines.size(), items.size());
+
+	std::atomic<bool> cancel(true);
+	Checkout::CheckoutOptions cancelled;
+	cancelled.iCancel = &cancel;
+	result = solve(5, cancelled);
+	ASSERT_TRUE(result.iCancelled);
+	ASSERT_FALSE(result.iProvenOptimal);
+
+	options.iWorkBudget = 0;
+	options.iTimeBudget = std::chrono::microseconds(0);
+	result = solve(5, options);
+	ASSERT_TRUE(result.iProvenOptimal);
+	ASSERT_EQ(result.iTotal, best);
+}
+
+TEST(CheckoutSession, MatchesCheckoutItems)
+{
+	std::mt19937 random(32);
+	for (int run = 0; run < 20; ++run)
+	{
+		std::vector<BuyAofXGetBofYForZ> deals = RandomDeals(random, 1 + run % 6, 8);
+		std::vector<const Deal*> dealPtrs;
+		for (BuyAofXGetBofYForZ& deal : deals)
+		{
+			dealPtrs.push_back(&deal);
+		}
+
+		Checkout::CheckoutStats stats;
+		Checkout::CheckoutOptions options;
+		options.iStats = &stats;
+		CheckoutSession session(dealPtrs, options);
+
+		std::vector<std::pair<int, Item>> basket;
+		for (int scan = 0; scan < 15; ++scan)
+		{
+			if (!basket.empty() && random() % 4 == 0)
+			{
+				int line = random() % basket.size();
+				ASSERT_EQ(session.voidLine(basket[line].first), true);
+				ASSERT_EQ(session.voidLine(basket[line].first), false);
+				basket.erase(basket.begin() + line);
+			}
+			else
+			{
+				Item item = RandomBasket(random, 8, 1)[0];
+				basket.push_back(std::make_pair(session.add(item), item));
+			}
+
+			std::vector<Item> items;
+			for (auto& line : basket)
+			{
+				items.push_back(line.second);
+			}
+			std::vector<const Deal*> allDeals = dealPtrs;
+			int expected;
+			Checkout::checkoutItems(items, allDeals, expected);
+			ASSERT_EQ(session.total(), expected);
+		}
+
+		ASSERT_EQ(session.size(), basket.size());
+		ASSERT_EQ(session.result().iLines.size(), basket.size());
+	}
+}
+
+TEST(CheckoutSession, ResolvesChangedComponentsOnly)
+{
+	Item item1(1, 100, "Item1");
+	Item item2(2, 50, "Item2");
+	BuyAofXGetBofYForZ buy2(2, 1, 2, 1, 75);
+	BuyAofXGetBofYForZ buy3(3, 2, 1, 2, 0);
+	std::vector<const Deal*> deals{ &buy2, &buy3 };
+
+	Checkout::CheckoutStats stats;
+	Checkout::CheckoutOptions options;
+	options.iStats = &stats;
+	CheckoutSession session(deals, options);
+
+	// Neither deal can apply yet
+	session.add(item1);
+	session.add(item2);
+	ASSERT_EQ(session.total(), 150);
+	ASSERT_EQ(stats.iCheckouts, 0);
+
+	int line = session.add(item2);
+	session.add(item2);
+	ASSERT_EQ(session.total(), 200);
+	ASSERT_EQ(stats.iCheckouts, 1);
+
+	// Only item 1's component changes
+	session.add(item1);
+	ASSERT_EQ(session.total(), 250);
+	ASSERT_EQ(stats.iCheckouts, 2);
+	ASSERT_EQ(stats.iComponentsReused, 1);
+
+	ASSERT_EQ(session.voidLine(line), true);
+	ASSERT_EQ(session.total(), 250);
+	ASSERT_EQ(stats.iComponentsReused, 2);
+
+	// Closing the sale solves nothing
+	std::string receipt = session.receipt();
+	std::cout << receipt << std::endl;
+	ASSERT_EQ(stats.iCheckouts, 2);
+}
+
+TEST(CheckoutSession, CancelledComponentsAreSolvedAgain)
+{
+	Item item1(1, 100, "Item1");
+	Item item9(9, 30, "Item9");
+	BuyAofXGetBofYForZ deal1(2, 1, 1, 1, 25);
+	BuyAofXGetBofYForZ deal2(3, 1, 1, 1, 10);
+	std::vector<const Deal*> deals{ &deal1, &deal2 };
+
+	std::atomic<bool> cancel(true);
+	Checkout::CheckoutStats stats;
+	Checkout::CheckoutOptions options;
+	options.iStats = &stats;
+	options.iCancel = &cancel;
+	CheckoutSession session(deals, options);
+
+	std::vector<Item> basket(5, item1);
+	for (const Item& item : basket)
+	{
+		session.add(item);
+	}
+	Checkout::CheckoutResult cancelled = session.result();
+	ASSERT_EQ(cancelled.iCancelled, true);
+	ASSERT_EQ(cancelled.iProvenOptimal, false);
+	ASSERT_EQ(cancelled.iLines.size(), basket.size());
+	ASSERT_LE(cancelled.iTotal, 500);
+
+	// The cancelled component is not reused once there is time to search it
+	cancel = false;
+	session.add(item9);
+	basket.push_back(item9);
+	Checkout::CheckoutResult result = session.result();
+	ASSERT_EQ(result.iCancelled, false);
+	ASSERT_EQ(result.iProvenOptimal, true);
+	ASSERT_EQ(stats.iComponentsReused, 0);
+
+	int expected;
+	std::vector<const Deal*> allDeals = deals;
+	Checkout::checkoutItems(basket, allDeals, expected);
+	ASSERT_EQ(result.iTotal, expected);
+}
+
+TEST(CheckoutSession, DealsWaitForEligibility)
+{
+	Item item1(1, 100, "Item1");
+	Item item2(2, 50, "Item2");
+
+	// Buy 3 of item 1, get 1 of item 2 free
+	BuyAofXGetBofYForZ buy3Get1(3, 1, 1, 2, 0);
+	BuyInSetOfXCheapestFree set12{ std::set<int>{ 1, 2 }, 5 };
+
+	CountedSpecificItemSelector selection{ item2, 2 };
+	CountedSpecificItemSelector target{ item2, 2 };
+	DealSelectorSelectTargetPrice dsSTP{ std::make_tuple(&selection, &target, 40) };
+	StrictDealSelector dealSelector(dsSTP);
+	std::vector<DealSelector*> selectors{ &dealSelector };
+	MultiDealSelector ds(selectors);
+	SmartDeal buy2For80(ds);
+
+	std::vector<ItemCountRule> rules;
+	buy3Get1.eligibilityRules(rules);
+	ASSERT_EQ(rules.size(), 2);
+	ASSERT_EQ(rules[0].iCount, 3);
+	rules.clear();
+	buy2For80.eligibilityRules(rules);
+	ASSERT_EQ(rules.size(), 2);
+	ASSERT_EQ(rules[0].iUnitPrice, 50);
+	ASSERT_EQ(rules[0].matches(Item(2, 60, "Item2")), false);
+
+	std::vector<const Deal*> deals{ &buy3Get1, &set12, &buy2For80 };
+	Checkout::CheckoutStats stats;
+	Checkout::CheckoutOptions options;
+	options.iStats = &stats;
+	CheckoutSession session(deals, options);
+
+	// No deal can apply yet, so nothing is evaluated
+	session.add(item1);
+	session.add(item2);
+	session.add(item1);
+	ASSERT_EQ(session.total(), 250);
+	ASSERT_EQ(stats.iDealEvaluations, 0);
+	ASSERT_EQ(stats.iDealsNotEligible, 3);
+
+	session.add(item1);
+	ASSERT_EQ(session.total(), 300);
+	ASSERT_GT(stats.iDealEvaluations, 0);
+
+	// Voiding an item makes the deals ineligible again
+	int line = session.add(item2);
+	ASSERT_EQ(session.total(), 350); // (item 2 free with the item 1s, or the cheapest of 5 free)
+	session.voidLine(line);
+	session.voidLine(1);
+	long evaluations = stats.iDealEvaluations;
+	ASSERT_EQ(session.total(), 250);
+	ASSERT_EQ(stats.iDealEvaluations, evaluations);
+}
+
+TEST(CheckoutBatch, MatchesCheckoutItems)
+{
+	std::mt19937 random(34);
+	std::vector<BuyAofXGetBofYForZ> deals = RandomDeals(random, 12, 10);
+	std::vector<const Deal*> dealPtrs;
+	for (BuyAofXGetBofYForZ& deal : deals)
+	{
+		dealPtrs.push_back(&deal);
+	}
+
+	std::vector<Item> priceList;
+	for (int id = 1; id <= 10; ++id)
+	{
+		priceList.push_back(Item(id, 100 + id, "Item" + std::to_string(id)));
+	}
+	DealCatalog catalog(dealPtrs, priceList);
+
+	// Some baskets repeat
+	std::vector<std::vector<Item>> baskets;
+	for (int b = 0; b < 300; ++b)
+	{
+		baskets.push_back((b % 5 == 4) ? baskets[b / 2] : RandomBasket(random, 10, 1 + b % 7));
+	}
+
+	Checkout::CheckoutStats stats;
+	Checkout::BatchOptions options;
+	options.iCheckout.iStats = &stats;
+	options.iThreads = 4;
+	std::vector<Checkout::CheckoutResult> results = Checkout::checkoutBatch(baskets, catalog, options);
+
+	ASSERT_EQ(results.size(), baskets.size());
+	for (int b = 0; b < baskets.size(); ++b)
+	{
+		std::vector<Item> basket = baskets[b];
+		ASSERT_EQ(results[b].iTotal, Checkout::solve(basket, catalog, Checkout::CheckoutOptions()).iTotal);
+		ASSERT_EQ(results[b].iLines.size(), basket.size());
+	}
+	ASSERT_GT(stats.iBasketsShared, 0);
+	ASSERT_EQ(stats.iCheckouts + stats.iBasketsShared, baskets.size());
+
+	// A pool can be shared by several batches
+	ThreadPool pool(2);
+	options.iPool = &pool;
+	std::vector<Checkout::CheckoutResult> again = Checkout::checkoutBatch(baskets, catalog, options);
+	for (int b = 0; b < baskets.size(); ++b)
+	{
+		ASSERT_EQ(again[b].iTotal, results[b].iTotal);
+	}
+}
+
+TEST(BasketColumns, MatchesDealTally)
+{
+	std::mt19937 random(35);
+	std::vector<BuyAofXGetBofYForZ> deals = RandomDeals(random, 40, 10);
+	deals.push_back(BuyAofXGetBofYForZ(0, 1, 2, 2, 50));
+	deals.push_back(BuyAofXGetBofYForZ(3, 1, 0, 2, 50));
+	deals.push_back(BuyAofXGetBofYForZ(0, 3, 0, 3, 50));
+	deals.push_back(BuyAofXGetBofYForZ(1, 1, 1, 99, 0));	// no basket has item 99
+
+	// (not a multiple of 8 baskets, some with an item at two prices)
+	std::vector<std::vector<Item>> baskets;
+	for (int b = 0; b < 203; ++b)
+	{
+		baskets.push_back(RandomBasket(random, 10, b % 30));
+		if (b % 17 == 0)
+		{
+			baskets.back().push_back(Item(1, 90, "Item1"));
+			baskets.back().push_back(Item(1, 101, "Item1"));
+		}
+	}
+
+	BasketColumns columns(baskets);
+	ASSERT_EQ(columns.baskets(), 203);
+	ASSERT_EQ(columns.stride(), 208);
+	ASSERT_FALSE(columns.regular(0));
+	ASSERT_TRUE(columns.regular(1));
+
+	std::vector<int> applications;
+	std::vector<int> savings;
+	for (BuyAofXGetBofYForZ& deal : deals)
+	{
+		evaluateColumns(deal, columns, applications, savings);
+		ASSERT_EQ(applications.size(), baskets.size());
+		for (int b = 0; b < baskets.size(); ++b)
+		{
+			int saving = 0;
+			ASSERT_EQ(applications[b], dealTally(deal, baskets[b], saving));
+			ASSERT_EQ(savings[b], saving);
+		}
+	}
+}
+
+TEST(CheckoutAsync, MatchesSolve)
+{
+	BuyAofXGetBofYForZ deal1(1, 1, 1, 2, 50);
+	BuyAofXGetBofYForZ deal2(1, 2, 1, 3, 50);
+	BuyAofXGetBofYForZ deal3(1, 3, 1, 1, 50);
+	DealCatalog catalog({ &deal1, &deal2, &deal3 });
+
+	std::vector<Item> basket;
+	for (int id = 1; id <= 3; ++id)
+	{
+		basket.push_back(Item(id, 100, "Item" + std::to_string(id)));
+		basket.push_back(Item(id, 100, "Item" + std::to_string(id)));
+	}
+	std::vector<Item> input = basket;
+	int expected = Checkout::solve(input, catalog, Checkout::CheckoutOptions()).iTotal;
+
+	ThreadPool pool(2);
+	std::future<Checkout::CheckoutResult> future = Checkout::checkoutAsync(basket, catalog, pool, Checkout::CheckoutOptions());
+	ASSERT_TRUE(future.valid());
+	Checkout::CheckoutResult result = future.get();
+	ASSERT_EQ(result.iTotal, expected);
+	ASSERT_FALSE(result.iCancelled);
+
+	std::promise<int> done;
+	ASSERT_TRUE(Checkout::checkoutAsync(basket, catalog, pool, Checkout::CheckoutOptions(),
+		[&done](Checkout::CheckoutResult aResult) { done.set_value(aResult.iTotal); }));
+	ASSERT_EQ(done.get_future().get(), expected);
+
+	// Cancelled before it starts: the best found so far (still a full receipt)
+	std::atomic<bool> cancel(true);
+	Checkout::CheckoutStats stats;
+	Checkout::CheckoutOptions options;
+	options.iCancel = &cancel;
+	options.iStats = &stats;
+	result = Checkout::checkoutAsync(basket, catalog, pool, options).get();
+	ASSERT_TRUE(result.iCancelled);
+	ASSERT_FALSE(result.iProvenOptimal);
+	ASSERT_EQ(result.iLines.size(), basket.size());
+	ASSERT_GE(result.iTotal, expected);
+	ASSERT_LE(result.iTotal, 600);
+	ASSERT_EQ(stats.iCancelled, 1);
+	ASSERT_EQ(stats.iBudgetExhausted, 0);
+
+	cancel = false;
+	result = Checkout::checkoutAsync(basket, catalog, pool, options).get();
+	ASSERT_FALSE(result.iCancelled);
+	ASSERT_EQ(result.iTotal, expected);
+}
+
+TEST(CheckoutAsync, BoundedPoolRefusesWhenFull)
+{
+	BuyAofXGetBofYForZ deal(2, 1, 1, 1, 0);
+	DealCatalog catalog({ &deal });
+	std::vector<Item> basket{ Item(1, 100, "Item1"), Item(1, 100, "Item1") };
+
+	// One thread, busy until released, and room for one more task
+	ThreadPool pool(1, 1);
+	std::promise<void> started;
+	std::promise<void> release;
+	std::shared_future<void> released = release.get_future().share();
+	pool.submit([&started, released]() { started.set_value(); released.wait(); });
+	started.get_future().wait();
+
+	std::promise<int> done;
+	ASSERT_TRUE(Checkout::checkoutAsync(basket, catalog, pool, Checkout::CheckoutOptions(),
+		[&done](Checkout::CheckoutResult aResult) { done.set_value(aResult.iTotal); }));
+
+	ASSERT_FALSE(Checkout::checkoutAsync(basket, catalog, pool, Checkout::CheckoutOptions()).valid());
+	ASSERT_FALSE(pool.trySubmit([]() {}));
+
+	release.set_value();
+	ASSERT_EQ(done.get_future().get(), 100);
+	pool.wait();
+	ASSERT_TRUE(pool.trySubmit([]() {}));
+	pool.wait();
+}
+
+// A deal whose evaluation fails (e.g. out of memory)
+class ThrowingDeal : public Deal
+{
+public:
+	ThrowingDeal() : Deal("Throwing") {};
+
+	virtual std::vector<std::pair<Item, int>> evaluate(std::vector<Item>& aInput) const { throw std::runtime_error("evaluate failed"); };
+	virtual bool selectsOn(const Item& aItem) const { return true; };
+	virtual bool targets(const Item& aItem) const { return true; };
+	virtual std::string serialise() const { return ""; };
+};
+
+TEST(CheckoutAsync, FailuresAreReported)
+{
+	ThrowingDeal deal;
+	DealCatalog catalog({ &deal });
+	std::vector<Item> basket{ Item(1, 100, "Item1"), Item(1, 100, "Item1") };
+	ThreadPool pool(1);
+
+	ASSERT_THROW(Checkout::checkoutAsync(basket, catalog, pool, Checkout::CheckoutOptions()).get(), std::runtime_error);
+
+	std::promise<std::string> failed;
+	bool called = false;
+	ASSERT_TRUE(Checkout::checkoutAsync(basket, catalog, pool, Checkout::CheckoutOptions(),
+		[&called](Checkout::CheckoutResult aResult) { called = true; },
+		[&failed](std::exception_ptr aError)
+		{
+			try
+			{
+				std::rethrow_exception(aError);
+			}
+			catch (const std::exception& aException)
+			{
+				failed.set_value(aException.what());
+			}
+		}));
+	ASSERT_EQ(failed.get_future().get(), "evaluate failed");
+	pool.wait();
+	ASSERT_FALSE(called);
+
+	// Without aFailed, and from the callback itself: the pool carries on
+	ASSERT_TRUE(Checkout::checkoutAsync(basket, catalog, pool, Checkout::CheckoutOptions(), [](Checkout::CheckoutResult aResult) {}));
+	BuyAofXGetBofYForZ freeItem(2, 1, 1, 1, 0);
+	DealCatalog working({ &freeItem });
+	ASSERT_TRUE(Checkout::checkoutAsync(basket, working, pool, Checkout::CheckoutOptions(),
+		[](Checkout::CheckoutResult aResult) { throw std::runtime_error("callback failed"); }));
+	pool.wait();
+	ASSERT_EQ(pool.failed(), 1);
+	ASSERT_EQ(Checkout::checkoutAsync(basket, working, pool, Checkout::CheckoutOptions()).get().iTotal, 100);
+
+	// A batch passes the exception back to its caller
+	Checkout::BatchOptions batchOptions;
+	batchOptions.iPool = &pool;
+	ASSERT_THROW(Checkout::checkoutBatch(std::vector<std::vector<Item>>{ basket }, catalog, batchOptions), std::runtime_error);
+	ASSERT_EQ(Checkout::checkoutBatch(std::vector<std::vector<Item>>{ basket }, working, batchOptions)[0].iTotal, 100);
+}
+
+TEST(CheckoutProtocol, RoundTrip)
+{
+	BuyAofXGetBofYForZ deal1(2, 1, 1, 1, 0);
+	BuyAofXGetBofYForZ deal2(1, 2, 1, 3, 50);
+	std::map<const Deal*, int> dealIndex{ { &deal1, 0 }, { &deal2, 1 } };
+	DealCatalog catalog({ &deal1, &deal2 });
+
+	// Two pipelined requests, arriving a byte at a time
+	std::string stream;
+	CheckoutProtocol::Request request;
+	request.iId = 7;
+	request.iItems = { Item(1, 100, ""), Item(1, 100, ""), Item(2, 80, ""), Item(3, 120, ""), Item(4, 10, "") };
+	CheckoutProtocol::appendRequest(stream, request);
+	request.iId = 8;
+	request.iItems.clear();
+	CheckoutProtocol::appendRequest(stream, request);
+
+	std::vector<CheckoutProtocol::Request> parsed;
+	size_t offset = 0;
+	for (size_t size = 0; size <= stream.size(); ++size)
+	{
+		CheckoutProtocol::Request next;
+		size_t consumed = 0;
+		if (CheckoutProtocol::parseRequest(stream.data() + offset, size - offset, next, consumed) == CheckoutProtocol::EParsed)
+		{
+			parsed.push_back(next);
+			offset += consumed;
+		}
+	}
+	ASSERT_EQ(parsed.size(), 2);
+	ASSERT_EQ(parsed[0].iId, 7);
+	ASSERT_TRUE(parsed[0].iValid);
+	ASSERT_EQ(parsed[0].iItems.size(), 5);
+	ASSERT_EQ(parsed[0].iItems[3].iId, 3);
+	ASSERT_EQ(parsed[0].iItems[3].iUnitPrice, 120);
+	ASSERT_EQ(parsed[1].iItems.size(), 0);
+
+	Checkout::CheckoutResult result = Checkout::solve(parsed[0].iItems, catalog, Checkout::CheckoutOptions());
+	std::string responses;
+	CheckoutProtocol::appendResponse(responses, CheckoutProtocol::makeResponse(7, result, dealIndex));
+
+	CheckoutProtocol::Response response;
+	size_t consumed = 0;
+	ASSERT_EQ(CheckoutProtocol::parseResponse(responses.data(), responses.size() - 1, response, consumed), CheckoutProtocol::EIncomplete);
+	ASSERT_EQ(CheckoutProtocol::parseResponse(responses.data(), responses.size(), response, consumed), CheckoutProtocol::EParsed);
+	ASSERT_EQ(consumed, responses.size());
+	ASSERT_EQ(response.iId, 7);
+	ASSERT_EQ(response.iStatus, CheckoutProtocol::EOk);
+	ASSERT_EQ(response.iTotal, 100 + 80 + 50 + 10);
+	ASSERT_EQ(response.iLines.size(), 5);
+
+	std::map<int, int> linesPerDeal;
+	for (const CheckoutProtocol::Line& line : response.iLines)
+	{
+		++linesPerDeal[line.iDeal];
+	}
+	ASSERT_EQ(linesPerDeal[0], 2);
+	ASSERT_EQ(linesPerDeal[1], 2);
+	ASSERT_EQ(linesPerDeal[-1], 1);
+
+	// A length which does not match the item count, and a length which is not a frame at all
+	std::string bad;
+	request.iItems = { Item(1, 100, "") };
+	CheckoutProtocol::appendRequest(bad, request);
+	bad[0] += 4;
+	bad += std::string(4, '\0');
+	ASSERT_EQ(CheckoutProtocol::parseRequest(bad.data(), bad.size(), request, consumed), CheckoutProtocol::EParsed);
+	ASSERT_FALSE(request.iValid);
+	ASSERT_EQ(consumed, bad.size());
+
+	std::string garbage(4, '\xff');
+	ASSERT_EQ(CheckoutProtocol::parseRequest(garbage.data(), garbage.size(), request, consumed), CheckoutProtocol::EInvalid);
+}
+
+TEST(CheckoutScheduler, SmallAndLargeBasketsOnSeparateLanes)
+{
+	std::mt19937 random(38);
+	std::vector<BuyAofXGetBofYForZ> deals = RandomDeals(random, 12, 10);
+	std::vector<const Deal*> dealPtrs;
+	for (BuyAofXGetBofYForZ& deal : deals)
+	{
+		dealPtrs.push_back(&deal);
+	}
+	DealCatalog catalog(dealPtrs);
+
+	ASSERT_EQ(CheckoutScheduler::estimateCost(5, 0), 5.0);
+	ASSERT_EQ(CheckoutScheduler::estimateCost(5, 3), 30.0);
+
+	SchedulerOptions options;
+	options.iHeavyCost = 1000.0;
+	CheckoutScheduler scheduler(catalog, options);
+
+	std::vector<std::vector<Item>> baskets;
+	for (int b = 0; b < 40; ++b)
+	{
+		baskets.push_back(RandomBasket(random, 10, (b % 10 == 0) ? 30 : 2));
+	}
+	ASSERT_EQ(scheduler.lane(baskets[0]), ELaneHeavy);
+	ASSERT_EQ(scheduler.lane(std::vector<Item>{ Item(1, 101, "Item1") }), ELaneFast);
+
+	std::vector<std::future<Checkout::CheckoutResult>> results;
+	long heavy = 0;
+	for (std::vector<Item>& basket : baskets)
+	{
+		heavy += (scheduler.lane(basket) == ELaneHeavy) ? 1 : 0;
+		results.push_back(scheduler.submit(basket));
+	}
+
+	for (int b = 0; b < baskets.size(); ++b)
+	{
+		ASSERT_TRUE(results[b].valid());
+		ASSERT_EQ(results[b].get().iTotal, Checkout::solve(baskets[b], catalog, Checkout::CheckoutOptions()).iTotal);
+	}
+	scheduler.wait();
+
+	LaneMetrics fast = scheduler.metrics(ELaneFast);
+	LaneMetrics slow = scheduler.metrics(ELaneHeavy);
+	ASSERT_EQ(slow.iSubmitted, heavy);
+	ASSERT_EQ(fast.iSubmitted + slow.iSubmitted, baskets.size());
+	ASSERT_EQ(fast.iCompleted, fast.iSubmitted);
+	ASSERT_EQ(slow.iCompleted, slow.iSubmitted);
+	ASSERT_EQ(fast.iQueued, 0);
+	ASSERT_EQ(fast.iRejected + slow.iRejected, 0);
+	ASSERT_GT(fast.iMaxQueued, 0);
+	ASSERT_GT(fast.percentileMicros(0.99), 0.0);
+	ASSERT_LE(fast.percentileMicros(0.5), fast.percentileMicros(0.99));
+	ASSERT_LE(fast.meanMicros(), fast.iMaxMicros);
+}
+
+// Overrides name() only, so receipts use the default Deal::writeName
+class RenamedDeal : public VectorOnlyDeal
+{
+public:
+	RenamedDeal(const BuyAofXGetBofYForZ& aDeal) : VectorOnlyDeal(aDeal) {};
+
+	virtual std::string name() const { return "Lunch offer"; };
+};
+
+TEST(ReceiptWriter, Formats)
+{
+	BuyAofXGetBofYForZ deal(2, 1, 1, 1, 0);
+	BuyInSetOfXCheapestFree cheapestFree({ 1, 2 }, 3);
+	char name[64];
+	ASSERT_EQ(std::string(name, deal.writeName(name, sizeof(name))), deal.name());
+	ASSERT_EQ(std::string(name, cheapestFree.writeName(name, sizeof(name))), cheapestFree.name());
+	ASSERT_EQ(deal.writeName(name, 4), deal.name().size());
+	ASSERT_EQ(std::string(name, 4), "Buy2");
+	RenamedDeal renamed(deal);
+	ASSERT_EQ(std::string(name, renamed.writeName(name, sizeof(name))), "Lunch offer");
+
+	std::vector<Checkout::ReceiptLine> lines{
+		std::make_tuple(&deal, Item(1, 175, "Sandwich1"), 0),
+		std::make_tuple(nullptr, Item(2, 85, "Drink \"2\""), 85) };
+
+	// Text: as createReceipt, at any width, into a fixed buffer
+	char buffer[512];
+	BufferSink sink(buffer, sizeof(buffer));
+	ReceiptWriter(sink, EReceiptText).write(lines, 260);
+	ASSERT_FALSE(sink.overflowed());
+	ASSERT_EQ(std::string(buffer, sink.size()), Checkout::createReceipt(lines, 260));
+
+	std::string wide;
+	StringSink wideSink(wide);
+	ReceiptWriter(wideSink, EReceiptText, 30).write(lines, 260);
+	ASSERT_EQ(wide,
+		"           RECEIPT           \n"
+		"------------------------------\n"
+		"Sandwich1                (175)\n"
+		"Buy2Of1Get1Of1For0UnitPrice  0\n"
+		"Drink \"2\"                   85\n"
+		"------------------------------\n"
+		"Total:                     260\n");
+
+	BufferSink small(buffer, 10);
+	ReceiptWriter(small, EReceiptText).write(lines, 260);
+	ASSERT_TRUE(small.overflowed());
+	ASSERT_EQ(small.size(), 10);
+
+	std::string json;
+	StringSink jsonSink(json);
+	ReceiptWriter(jsonSink, EReceiptJson).write(lines, 260);
+	ASSERT_EQ(json, "{\"lines\":[{\"id\":1,\"name\":\"Sandwich1\",\"unitPrice\":175,\"price\":0,\"deal\":\"Buy2Of1Get1Of1For0UnitPrice\"},"
+		"{\"id\":2,\"name\":\"Drink \\\"2\\\"\",\"unitPrice\":85,\"price\":85}],\"total\":260}\n");
+
+	std::string binary;
+	StringSink binarySink(binary);
+	ReceiptWriter(binarySink, EReceiptBinary).write(lines, 260);
+	ASSERT_EQ(binary.size(), (14 + deal.name().size()) + 14 + 5);
+	int32_t value;
+	std::memcpy(&value, binary.data() + 5, sizeof(value));
+	ASSERT_EQ(value, 175);
+	ASSERT_EQ(binary[13], (char)deal.name().size());
+	ASSERT_EQ(binary.substr(14, deal.name().size()), deal.name());
+	ASSERT_EQ(binary[binary.size() - 5], 2);
+	std::memcpy(&value, binary.data() + binary.size() - 4, sizeof(value));
+	ASSERT_EQ(value, 260);
+}
+
+TEST(Journal, AppendRolloverAndRead)
+{
+	char directory[] = "/tmp/checkout_journal_XXXXXX";
+	ASSERT_NE(mkdtemp(directory), nullptr);
+
+	BuyAofXGetBofYForZ deal(2, 1, 1, 1, 0);
+	std::vector<const Deal*> deals{ &deal };
+	Checkout::CheckoutResult result;
+	result.iLines = {
+		std::make_tuple(&deal, Item(1, 175, "Sandwich1"), 0),
+		std::make_tuple(nullptr, Item(2, 85, "Drink2"), 85) };
+
+	// Room for 5 records a segment, so every third checkout starts a new segment
+	JournalOptions options;
+	options.iDirectory = directory;
+	options.iSegmentBytes = 32 + 5 * sizeof(JournalRecord);
+	{
+		Journal journal(deals, options);
+		ASSERT_EQ(journal.append(result), 0);
+		ASSERT_TRUE(journal.open());
+		for (uint64_t c = 1; c <= 7; ++c)
+		{
+			ASSERT_EQ(journal.append(result), c);
+		}
+		ASSERT_TRUE(journal.sync());
+		ASSERT_EQ(journal.durable(), 7);
+		ASSERT_EQ(journal.segments(), 4);
+
+		Checkout::CheckoutResult tooLarge;
+		tooLarge.iLines.assign(6, result.iLines[1]);
+		ASSERT_EQ(journal.append(tooLarge), 0);
+	}
+
+	// Reopened, it carries on numbering in a new segment
+	{
+		Journal journal(deals, options);
+		ASSERT_TRUE(journal.open());
+		ASSERT_EQ(journal.durable(), 7);
+		ASSERT_EQ(journal.append(result), 8);
+	}
+
+	JournalRecord record;
+	JournalReader reader(directory);
+	for (uint64_t c = 1; c <= 8; ++c)
+	{
+		ASSERT_TRUE(reader.next(record));
+		ASSERT_EQ(record.iCheckout, c);
+		ASSERT_EQ(record.iLine, 0);
+		ASSERT_EQ(record.iDeal, 0);
+		ASSERT_EQ(record.iItemId, 1);
+		ASSERT_EQ(record.iUnitPrice, 175);
+		ASSERT_EQ(record.iPrice, 0);
+		ASSERT_TRUE(reader.next(record));
+		ASSERT_EQ(record.iCheckout, c);
+		ASSERT_EQ(record.iLine, 1);
+		ASSERT_EQ(record.iDeal, -1);
+		ASSERT_EQ(record.iPrice, 85);
+	}
+	ASSERT_FALSE(reader.next(record));
+	ASSERT_EQ(reader.segment(), 6);
+
+	for (uint32_t s = 1; s <= 5; ++s)
+	{
+		std::remove(Journal::segmentPath(directory, s).c_str());
+	}
+	rmdir(directory);
+}
+
+// Limits the size of the files this process writes (as a full disk would stop a segment being allocated), until destroyed
+class FileSizeLimit
+{
+public:
+	FileSizeLimit(rlim_t aBytes)
+	{
+		getrlimit(RLIMIT_FSIZE, &iOld);
+		iOldHandler = std::signal(SIGXFSZ, SIG_IGN);
+		rlimit limit = iOld;
+		limit.rlim_cur = aBytes;
+		setrlimit(RLIMIT_FSIZE, &limit);
+	};
+	~FileSizeLimit()
+	{
+		setrlimit(RLIMIT_FSIZE, &iOld);
+		std::signal(SIGXFSZ, iOldHandler);
+	};
+
+private:
+	rlimit iOld;
+	void (*iOldHandler)(int);
+};
+
+TEST(Journal, FailsWhenSegmentCannotBeAllocated)
+{
+	char directory[] = "/tmp/checkout_journal_XXXXXX";
+	ASSERT_NE(mkdtemp(directory), nullptr);
+
+	BuyAofXGetBofYForZ deal(2, 1, 1, 1, 0);
+	std::vector<const Deal*> deals{ &deal };
+	Checkout::CheckoutResult result;
+	result.iLines = { std::make_tuple(&deal, Item(1, 175, "Sandwich1"), 0) };
+
+	JournalOptions options;
+	options.iDirectory = directory;
+	options.iSegmentBytes = 32 + 2 * sizeof(JournalRecord);
+	{
+		Journal journal(deals, options);
+		{
+			FileSizeLimit limit(64);
+			ASSERT_FALSE(journal.open());
+			ASSERT_EQ(errno, EFBIG);
+		}
+		ASSERT_TRUE(journal.open());
+		ASSERT_EQ(journal.append(result), 1);
+		ASSERT_EQ(journal.append(result), 2);
+
+		// The next checkout needs a new segment
+		{
+			FileSizeLimit limit(64);
+			ASSERT_EQ(journal.append(result), 0);
+			ASSERT_EQ(errno, EFBIG);
+		}
+		ASSERT_EQ(journal.append(result), 3);
+		ASSERT_TRUE(journal.sync());
+		ASSERT_EQ(journal.segments(), 2);
+	}
+
+	JournalRecord record;
+	JournalReader reader(directory);
+	for (uint64_t c = 1; c <= 3; ++c)
+	{
+		ASSERT_TRUE(reader.next(record));
+		ASSERT_EQ(record.iCheckout, c);
+	}
+	ASSERT_FALSE(reader.next(record));
+
+	for (uint32_t s = 1; s <= 2; ++s)
+	{
+		ASSERT_EQ(std::remove(Journal::segmentPath(directory, s).c_str()), 0);
+	}
+	ASSERT_EQ(rmdir(directory), 0);
+}
+
+TEST(SelectionCache, SharedBetweenMealDeals)
+{
+	Item sandwich(1, 200, "Sandwich");
+	Item drink(2, 120, "Drink");
+	Item snack(3, 80, "Snack");
+
+	// Each deal has its own selectors, over equal sets
+	std::set<Item> mainsA{ sandwich }, mainsB{ sandwich }, mainsC{ sandwich };
+	std::set<Item> drinksA{ drink }, drinksB{ drink };
+	std::set<Item> snacksA{ snack }, snacksC{ snack };
+	SingleInSetSelector mainA(mainsA), mainB(mainsB), mainC(mainsC);
+	SingleInSetSelector drinkA(drinksA), drinkB(drinksB);
+	SingleInSetSelector snackA(snacksA), snackC(snacksC);
+
+	// A: meal deal for 300, B: sandwich and drink for 220, C: sandwich and snack for 190
+	DealSelectorSelectTargetPrice a0{ std::make_tuple(&mainA, &mainA, 150) }, a1{ std::make_tuple(&drinkA, &drinkA, 100) }, a2{ std::make_tuple(&snackA, &snackA, 50) };
+	DealSelectorSelectTargetPrice b0{ std::make_tuple(&mainB, &mainB, 140) }, b1{ std::make_tuple(&drinkB, &drinkB, 80) };
+	DealSelectorSelectTargetPrice c0{ std::make_tuple(&mainC, &mainC, 130) }, c1{ std::make_tuple(&snackC, &snackC, 60) };
+	StrictDealSelector sa0(a0), sa1(a1), sa2(a2), sb0(b0), sb1(b1), sc0(c0), sc1(c1);
+	std::vector<DealSelector*> partsA{ &sa0, &sa1, &sa2 }, partsB{ &sb0, &sb1 }, partsC{ &sc0, &sc1 };
+	MultiDealSelector multiA(partsA), multiB(partsB), multiC(partsC);
+	SmartDeal dealA(multiA), dealB(multiB), dealC(multiC);
+
+	std::vector<unsigned char> consumed(2, 0);
+	std::vector<Item> basket{ snack, sandwich };
+	SelectionCache cache;
+	std::vector<int> lines;
+	cache.selectLines(mainA, BasketView(basket.data(), consumed.data(), 2), lines);
+	cache.selectLines(mainB, BasketView(basket.data(), consumed.data(), 2), lines);
+	ASSERT_EQ(lines, std::vector<int>{ 1 });
+	ASSERT_EQ(cache.hits(), 1);
+	cache.selectLines(drinkA, BasketView(basket.data(), consumed.data(), 2), lines);
+	ASSERT_TRUE(lines.empty());
+	consumed[1] = 1;
+	cache.selectLines(mainC, BasketView(basket.data(), consumed.data(), 2), lines);
+	ASSERT_TRUE(lines.empty());
+	ASSERT_EQ(cache.misses(), 3);
+
+	std::vector<const Deal*> deals{ &dealA, &dealB, &dealC };
+	std::vector<Item> items{ sandwich, drink, sandwich, snack };
+	Checkout::CheckoutStats stats;
+	Checkout::CheckoutOptions options;
+	options.iStats = &stats;
+	for (SolverStrategy strategy : { ESolverBruteForce, ESolverBranchAndBound })
+	{
+		options.iStrategy = strategy;
+		ASSERT_EQ(Checkout::solve(items, deals, options).iTotal, 410);
+	}
+	ASSERT_GT(stats.iSelectionsShared, 0);
+}
+
+TEST(ItemTaxonomy, CategorySelectors)
+{
+	ItemTaxonomy taxonomy;
+	int food = taxonomy.addCategory(ItemTaxonomy::kRoot, "Food");
+	int sandwiches = taxonomy.addCategory(food, "Sandwiches");
+	int drinks = taxonomy.addCategory(food, "Drinks");
+	int chicken = taxonomy.addCategory(sandwiches, "Chicken");
+	ASSERT_EQ(taxonomy.addCategory(99, "Nowhere"), -1);
+
+	Item blt(1, 250, "BLT");
+	Item tikka(2, 300, "Chicken Tikka");
+	Item water(3, 90, "Water");
+	Item cola(4, 120, "Cola");
+	taxonomy.assign(blt.iId, sandwiches);
+	taxonomy.assign(tikka.iId, chicken);
+	taxonomy.assign(water.iId, drinks);
+
+	ASSERT_TRUE(taxonomy.inCategory(tikka.iId, sandwiches));
+	ASSERT_FALSE(taxonomy.inCategory(tikka.iId, sandwiches, false));
+	ASSERT_TRUE(taxonomy.inCategory(water.iId, food));
+	ASSERT_FALSE(taxonomy.inCategory(water.iId, sandwiches));
+	ASSERT_FALSE(taxonomy.inCategory(cola.iId, ItemTaxonomy::kRoot));
+	ASSERT_EQ(taxonomy.category(cola.iId), -1);
+	ASSERT_FALSE(taxonomy.inCategory(tikka.iId, -1));
+	ASSERT_FALSE(taxonomy.inCategory(tikka.iId, 99, false));
+
+	// Meal deal: any sandwich and any drink for 300
+	CountedCheapestInCategorySelector sandwich(taxonomy, sandwiches, 1), drink(taxonomy, drinks, 1);
+	DealSelectorSelectTargetPrice part0{ std::make_tuple(&sandwich, &sandwich, 220) }, part1{ std::make_tuple(&drink, &drink, 80) };
+	StrictDealSelector strict0(part0), strict1(part1);
+	std::vector<DealSelector*> parts{ &strict0, &strict1 };
+	MultiDealSelector multi(parts);
+	SmartDeal mealDeal(multi);
+	std::vector<const Deal*> deals{ &mealDeal };
+
+	Checkout::CheckoutOptions options;
+	std::vector<Item> items{ tikka, cola, water };
+	ASSERT_EQ(Checkout::solve(items, deals, options).iTotal, 300 + 120);
+
+	// A new drink (and a new category below Drinks) joins the deal without it being rebuilt
+	int fizzy = taxonomy.addCategory(drinks, "Fizzy");
+	taxonomy.assign(cola.iId, fizzy);
+	ASSERT_TRUE(taxonomy.inCategory(tikka.iId, sandwiches));
+	std::vector<Item> meal{ tikka, cola };
+	ASSERT_EQ(Checkout::solve(meal, deals, options).iTotal, 300);
+	ASSERT_EQ(Checkout::solve(items, deals, options).iTotal, 300 + 120);
+
+	std::vector<Item> selected = sandwich.select(items);
+	ASSERT_EQ(selected, std::vector<Item>{ tikka });
+	CountedInCategorySelector twoDrinks(taxonomy, drinks, 2);
+	ASSERT_EQ(twoDrinks.select(items), (std::vector<Item>{ cola, water }));
+	GreedyInCategorySelector exactlyDrinks(taxonomy, drinks, false);
+	ASSERT_EQ(exactlyDrinks.select(items), std::vector<Item>{ water });
+	GreedyInCategorySelector nowhere(taxonomy, -1);
+	ASSERT_TRUE(nowhere.select(items).empty());
+
+	std::vector<int> signature, other;
+	ASSERT_TRUE(sandwich.signature(signature));
+	ASSERT_TRUE(CountedCheapestInCategorySelector(taxonomy, sandwiches, 1).signature(other));
+	ASSERT_EQ(signature, other);
+	ItemTaxonomy another;
+	ASSERT_TRUE(CountedCheapestInCategorySelector(another, sandwiches, 1).signature(other));
+	ASSERT_NE(signature, other);
+}
+
+TEST(IdSetPool, SharedSets)
+{
+	IdSetPool pool;
+	IdSetHandle dense = pool.intern(std::set<int>{ 100, 101, 102, 103, 104, 105, 106, 107, 108, 140 });
+	IdSetHandle sparse = pool.intern(std::set<int>{ 5, 70000, -3 });
+	ASSERT_TRUE(dense->bitmap());
+	ASSERT_FALSE(sparse->bitmap());
+	ASSERT_EQ(dense->count(140), 1);
+	ASSERT_EQ(dense->count(139), 0);
+	ASSERT_EQ(dense->count(99), 0);
+	ASSERT_EQ(sparse->count(-3), 1);
+	ASSERT_EQ(sparse->count(6), 0);
+	ASSERT_EQ(dense->toSet(), (std::set<int>{ 100, 101, 102, 103, 104, 105, 106, 107, 108, 140 }));
+	ASSERT_EQ(sparse->toSet(), (std::set<int>{ -3, 5, 70000 }));
+	ASSERT_EQ(pool.intern(std::set<int>{})->count(0), 0);
+
+	// 100 deals over the same ids share one set
+	std::vector<std::unique_ptr<BuyInSetOfXCheapestFree>> deals;
+	for (int d = 0; d < 100; ++d)
+	{
+		deals.emplace_back(new BuyInSetOfXCheapestFree(pool.intern(std::set<int>{ 70000, 5, -3 }), 2 + d % 2));
+	}
+	ASSERT_EQ(deals[0]->selectionHandle(), sparse);
+	ASSERT_EQ(deals[99]->selectionIds(), *sparse);
+
+	IdSetPoolStats stats = pool.stats();
+	ASSERT_EQ(stats.iSets, 3);
+	ASSERT_EQ(stats.iInterned, 103);
+	ASSERT_EQ(stats.iShared, 100);
+	ASSERT_EQ(stats.iHandles, 102);
+	ASSERT_EQ(stats.bytesSaved(), 100 * sparse->bytes());
+	ASSERT_GT(stats.iBytesAsStdSets, stats.iBytesUnshared);
+
+	// selection() builds one std::set, shared by the deals
+	ASSERT_EQ(deals[99]->selection(), sparse->toSet());
+	ASSERT_EQ(&deals[0]->selection(), &deals[99]->selection());
+
+	// The deals price as before
+	std::vector<Item> items{ Item(5, 100, "A"), Item(-3, 60, "B"), Item(70000, 80, "C") };
+	std::vector<const Deal*> dealList{ deals[0].get() };
+	Checkout::CheckoutOptions options;
+	ASSERT_EQ(Checkout::solve(items, dealList, options).iTotal, 180);
+
+	deals.clear();
+	sparse.reset();
+	ASSERT_EQ(pool.collect(), 2);
+	ASSERT_EQ(pool.stats().iSets, 1);
+}
+
+TEST(ItemCatalog, MappedLookup)
+{
+	char directory[] = "/tmp/checkout_catalog_XXXXXX";
+	ASSERT_NE(mkdtemp(directory), nullptr);
+	std::string path = std::string(directory) + "/items";
+
+	std::vector<Item> items;
+	for (int i = 0; i < 1000; ++i)
+	{
+		items.push_back(Item(5000000 + i * 7919, 100 + i, "Item" + std::to_string(i)));
+	}
+	items.push_back(Item(-1, 0, ""));
+	ASSERT_TRUE(ItemCatalog::write(path, items));
+	ASSERT_TRUE(ItemCatalog::isCatalog(path));
+
+	// Two tills mapping the same file
+	ItemCatalog till1, till2;
+	ASSERT_TRUE(till1.open(path));
+	ASSERT_TRUE(till2.open(path));
+	ASSERT_EQ(till1.size(), items.size());
+	for (const Item& item : items)
+	{
+		int index = till2.find(item.iId);
+		ASSERT_GE(index, 0);
+		ASSERT_EQ(till2.id(index), item.iId);
+		ASSERT_EQ(till2.price(index), item.iUnitPrice);
+		size_t length;
+		const char* name = till1.name(index, length);
+		ASSERT_EQ(std::string(name, length), item.iName);
+	}
+	ASSERT_EQ(till1.find(5000001), -1);
+	ASSERT_EQ(till1.item(till1.find(5000000)), items[0]);
+	ASSERT_EQ(till1.item(till1.find(5000000)).iName, "Item0");
+
+	// Replacing the file does not disturb a till which has the old one mapped
+	std::vector<Item> replacement{ Item(1, 50, "New") };
+	ASSERT_TRUE(ItemCatalog::write(path, replacement));
+	ASSERT_EQ(till1.price(till1.find(5000000)), 100);
+	ASSERT_TRUE(till2.open(path));
+	ASSERT_EQ(till2.size(), 1);
+	ASSERT_EQ(till2.find(5000000), -1);
+	ASSERT_EQ(till2.price(till2.find(1)), 50);
+
+	std::vector<Item> repeated{ Item(1, 50, "A"), Item(1, 60, "B") };
+	ASSERT_FALSE(ItemCatalog::write(path + "2", repeated));
+
+	// Not a catalog
+	FILE* file = std::fopen((path + "3").c_str(), "wb");
+	std::fputs("1 100 Apple\n", file);
+	std::fclose(file);
+	ASSERT_FALSE(ItemCatalog::isCatalog(path + "3"));
+	ItemCatalog notCatalog;
+	ASSERT_FALSE(notCatalog.open(path + "3"));
+	ASSERT_EQ(notCatalog.find(1), -1);
+	ASSERT_FALSE(notCatalog.open(path + "4"));
+
+	// Corrupt tables: a catalog of 2 items has 4 slots (at 64), the ids (at 96), prices, and 3 name offsets (at 112)
+	std::vector<Item> two{ Item(1, 50, "A"), Item(2, 60, "BB") };
+	ASSERT_TRUE(ItemCatalog::write(path, two));
+	std::string bytes;
+	{
+		std::ifstream in(path, std::ios::binary);
+		bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	}
+	ASSERT_EQ(bytes.size(), 124 + 3);
+	auto opens = [&](size_t aOffset, uint32_t aValue)
+	{
+		std::string corrupt = bytes;
+		std::memcpy(&corrupt[aOffset], &aValue, sizeof(aValue));
+		std::ofstream out(path + "3", std::ios::binary | std::ios::trunc);
+		out << corrupt;
+		out.close();
+		ItemCatalog catalog;
+		return catalog.open(path + "3");
+	};
+	ASSERT_TRUE(opens(116, 1));
+	for (size_t slot = 64; slot < 96; slot += 8)
+	{
+		uint32_t index;
+		std::memcpy(&index, &bytes[slot + 4], sizeof(index));
+		ASSERT_FALSE(opens(slot + 4, index ? 3 : 1));		// an index past the items, or an item in two slots
+		ASSERT_EQ(opens(slot, 7), index == 0);					// a slot's id not its item's
+	}
+	ASSERT_TRUE(opens(116, 3));								// (an empty name)
+	ASSERT_FALSE(opens(112, 2));							// name offsets decreasing
+
+	std::remove(path.c_str());
+	std::remove((path + "3").c_str());
+	rmdir(directory);
+}
+
+TEST(BarcodeIndex, DenseIds)
+{
+	std::mt19937_64 random(11);
+	std::vector<uint64_t> barcodes;
+	std::set<uint64_t> seen;
+	while (barcodes.size() < 5000)
+	{
+		uint64_t barcode = 5000000000000ull + random() % 1000000000000ull;	// EAN-13
+		if (seen.insert(barcode).second)
+		{
+			barcodes.push_back(barcode);
+		}
+	}
+
+	BarcodeIndex index;
+	ASSERT_TRUE(index.build(barcodes));
+	ASSERT_EQ(index.size(), barcodes.size());
+	for (size_t b = 0; b < barcodes.size(); ++b)
+	{
+		ASSERT_EQ(index.find(barcodes[b]), (int)b);
+	}
+	ASSERT_EQ(index.find(4999999999999ull), -1);
+	ASSERT_EQ(index.find(0), -1);
+
+	// Items keyed by their dense index, so a deal's ids make a bitmap
+	std::set<int> ids;
+	for (size_t b = 0; b < 200; ++b)
+	{
+		ids.insert(index.find(barcodes[b]));
+	}
+	IdSetPool pool;
+	ASSERT_TRUE(pool.intern(ids)->bitmap());
+
+	std::vector<uint64_t> repeated{ 1, 2, 1 };
+	ASSERT_FALSE(index.build(repeated));
+	ASSERT_EQ(index.find(1), -1);
+	ASSERT_TRUE(index.build(std::vector<uint64_t>{}));
+	ASSERT_EQ(index.find(0), -1);
+	ASSERT_TRUE(index.build(std::vector<uint64_t>{ 42 }));
+	ASSERT_EQ(index.find(42), 0);
+}
+
+TEST(DealWindows, ActiveOnlyInWindows)
+{
+	const int64_t hour = 3600;
+	Item beer(1, 500, "Beer");
+	Item crisps(2, 100, "Crisps");
+
+	// Happy hour: beer half price, 17:00-19:00 on two days
+	BuyAofXGetBofYForZ happyHour(1, 1, 1, 1, 250);
+	ASSERT_TRUE(happyHour.addWindow(17 * hour, 19 * hour));
+	ASSERT_TRUE(happyHour.addWindow(41 * hour, 43 * hour));
+	ASSERT_TRUE(happyHour.addWindow(18 * hour, 20 * hour));	// (merged with the first)
+	ASSERT_FALSE(happyHour.addWindow(5 * hour, 5 * hour));
+	ASSERT_EQ(happyHour.windows().size(), 2);
+	ASSERT_EQ(happyHour.windows()[0].iUntil, 20 * hour);
+
+	ASSERT_FALSE(happyHour.activeAt(17 * hour - 1));
+	ASSERT_TRUE(happyHour.activeAt(17 * hour));
+	ASSERT_TRUE(happyHour.activeAt(20 * hour - 1));
+	ASSERT_FALSE(happyHour.activeAt(20 * hour));
+	ASSERT_TRUE(happyHour.activeAt(42 * hour));
+	ASSERT_FALSE(happyHour.activeAt(50 * hour));
+	ASSERT_TRUE(happyHour.activeAt(kAnyTime));
+
+	BuyAofXGetBofYForZ crispsDeal(2, 2, 1, 2, 0);	// always valid
+	std::vector<const Deal*> deals{ &happyHour, &crispsDeal };
+	DealCatalog catalog(deals, std::vector<Item>{ beer, crisps });
+	ASSERT_EQ(catalog.curve(beer), nullptr);
+	ASSERT_NE(catalog.curve(crisps), nullptr);
+
+	std::vector<Item> items{ beer, crisps, crisps };
+	ASSERT_EQ(catalog.filterDeals(items, 18 * hour), deals);
+	ASSERT_EQ(catalog.filterDeals(items, 12 * hour), std::vector<const Deal*>{ &crispsDeal });
+	ASSERT_EQ(catalog.filterDeals(items), deals);
+	ASSERT_EQ(catalog.nextChange(12 * hour), 17 * hour);
+	ASSERT_EQ(catalog.nextChange(17 * hour), 20 * hour);
+	ASSERT_EQ(catalog.nextChange(43 * hour), INT64_MAX);
+
+	// The same deals and catalog, at different times
+	Checkout::CheckoutOptions options;
+	options.iTime = 18 * hour;
+	ASSERT_EQ(Checkout::solve(items, catalog, options).iTotal, 350);
+	ASSERT_EQ(Checkout::solve(items, deals, options).iTotal, 350);
+	options.iTime = 12 * hour;
+	ASSERT_EQ(Checkout::solve(items, catalog, options).iTotal, 600);
+	ASSERT_EQ(Checkout::solve(items, deals, options).iTotal, 600);
+	options.iTime = kAnyTime;
+	ASSERT_EQ(Checkout::solve(items, deals, options).iTotal, 350);
+
+	Checkout::BatchOptions batchOptions;
+	batchOptions.iThreads = 1;
+	batchOptions.iCheckout.iTime = 42 * hour;
+	ASSERT_EQ(Checkout::checkoutBatch(std::vector<std::vector<Item>>{ items }, catalog, batchOptions)[0].iTotal, 350);
+}
+
+TEST(DealOverlay, CustomerDealsOnTopOfCatalog)
+{
+	Item coffee(1, 100, "Coffee");
+	Item cake(2, 200, "Cake");
+	Item milk(3, 80, "Milk");
+
+	BuyAofXGetBofYForZ threeCoffees(3, 1, 3, 1, 80);	// store wide: 3 coffees for 240
+	BuyAofXGetBofYForZ cakeDeal(2, 2, 1, 2, 0);		// store wide: buy 2 cakes get 1 free
+	std::vector<const Deal*> storeDeals{ &threeCoffees, &cakeDeal };
+	DealCatalog catalog(storeDeals, std::vector<Item>{ coffee, cake, milk });
+	ASSERT_NE(catalog.curve(coffee), nullptr);
+
+	// A loyalty customer: every coffee for 70, and free milk with a cake
+	BuyAofXGetBofYForZ loyaltyCoffee(1, 1, 1, 1, 70);
+	BuyAofXGetBofYForZ milkWithCake(1, 2, 1, 3, 0);
+	std::vector<const Deal*> customerDeals{ &loyaltyCoffee, &milkWithCake };
+	DealOverlay loyal(catalog, customerDeals);
+	DealOverlay other(catalog, std::vector<const Deal*>{});
+	ASSERT_EQ(&loyal.catalog(), &catalog);
+	ASSERT_EQ(loyal.deals(), customerDeals);
+
+	std::vector<Item> items{ coffee, coffee, coffee, cake, milk };
+	ASSERT_EQ(loyal.filterDeals(items), (std::vector<const Deal*>{ &threeCoffees, &cakeDeal, &loyaltyCoffee, &milkWithCake }));
+	ASSERT_EQ(other.filterDeals(items), catalog.filterDeals(items));
+
+	// As solving over the combined deals
+	std::vector<const Deal*> combined{ &threeCoffees, &cakeDeal, &loyaltyCoffee, &milkWithCake };
+	Checkout::CheckoutOptions options;
+	int expected = Checkout::solve(items, combined, options).iTotal;
+	ASSERT_EQ(expected, 210 + 200);
+	ASSERT_EQ(Checkout::solve(items, loyal, options).iTotal, expected);
+	ASSERT_EQ(Checkout::solve(items, other, options).iTotal, 240 + 200 + 80);
+
+	// Windows of the customer's deals are honoured too
+	loyaltyCoffee.addWindow(0, 100);
+	DealOverlay morning(catalog, customerDeals);
+	options.iTime = 200;
+	ASSERT_EQ(Checkout::solve(items, morning, options).iTotal, 240 + 200);
+	ASSERT_EQ(morning.nextChange(50), 100);
+	ASSERT_EQ(morning.nextChange(100), INT64_MAX);
+}
+
+TEST(DealCatalog, AppliesDeltas)
+{
+	Item coffee(1, 100, "Coffee");
+	Item cake(2, 200, "Cake");
+	Item milk(3, 80, "Milk");
+	std::vector<Item> priceList{ coffee, cake, milk };
+
+	BuyAofXGetBofYForZ threeCoffees(3, 1, 3, 1, 80);	// 3 coffees for 240
+	BuyAofXGetBofYForZ cakeDeal(2, 2, 1, 2, 0);		// buy 2 cakes get 1 free
+	CatalogSnapshots snapshots(std::make_shared<DealCatalog>(std::vector<const Deal*>{ &threeCoffees, &cakeDeal }, priceList));
+	std::shared_ptr<const DealCatalog> before = snapshots.current();
+	ASSERT_EQ(before->find("1"), 1);
+
+	// 3 coffees for 210, the cake deal retired, and milk half price
+	std::string text = "# loyalty week\n"
+		"~ 0 " + BuyAofXGetBofYForZ(3, 1, 3, 1, 70).serialise() + "\n"
+		"- 1\n"
+		"\n"
+		"+ milk " + BuyAofXGetBofYForZ(1, 3, 1, 3, 40).serialise() + "\n";
+	CatalogDelta delta;
+	std::string error;
+	ASSERT_TRUE(delta.deserialise(text, error));
+	ASSERT_EQ(delta.changes().size(), 3);
+	CatalogDelta copy;
+	ASSERT_TRUE(copy.deserialise(delta.serialise(), error));
+	ASSERT_EQ(copy.serialise(), delta.serialise());
+
+	CatalogDeltaStats stats;
+	ASSERT_TRUE(snapshots.apply(delta, error, &stats));
+	std::shared_ptr<const DealCatalog> after = snapshots.current();
+	ASSERT_NE(after, before);
+	ASSERT_EQ(stats.iAdded, 1);
+	ASSERT_EQ(stats.iReplaced, 1);
+	ASSERT_EQ(stats.iRetired, 1);
+	ASSERT_EQ(stats.iItemsTouched, 3);
+	ASSERT_EQ(stats.iCurvesBuilt, 2);
+	ASSERT_EQ(after->find("1"), -1);
+	ASSERT_EQ(after->find("milk"), 2);
+	ASSERT_EQ(after->deals().size(), 2);
+	ASSERT_EQ(after->curveCount(), 2);
+	ASSERT_EQ(after->curve(cake), nullptr);
+	ASSERT_EQ(after->curve(coffee)->price(3), 210);
+
+	// The old snapshot is as it was
+	std::vector<Item> items{ coffee, coffee, coffee, cake, cake, cake, milk };
+	Checkout::CheckoutOptions options;
+	ASSERT_EQ(before->deals(), (std::vector<const Deal*>{ &threeCoffees, &cakeDeal }));
+	ASSERT_EQ(before->curve(coffee)->price(3), 240);
+	ASSERT_EQ(Checkout::solve(items, *before, options).iTotal, 240 + 400 + 80);
+
+	// As a catalog built from the same deals
+	DealCatalog rebuilt(after->deals(), priceList);
+	ASSERT_EQ(after->filterDeals(items), rebuilt.filterDeals(items));
+	ASSERT_EQ(Checkout::solve(items, *after, options).iTotal, 210 + 600 + 40);
+	ASSERT_EQ(Checkout::solve(items, rebuilt, options).iTotal, 210 + 600 + 40);
+
+	// A delta which does not apply publishes nothing
+	CatalogDelta unknown;
+	unknown.retire("1");
+	ASSERT_FALSE(snapshots.apply(unknown, error));
+	ASSERT_EQ(error, "No deal has key 1");
+	ASSERT_EQ(snapshots.current(), after);
+	ASSERT_FALSE(unknown.deserialise("+ 7\n", error));
+	ASSERT_EQ(error, "Line 1: not a change");
+	ASSERT_FALSE(unknown.deserialise("# header\n~ 7 x\n", error));
+	ASSERT_EQ(error, "Line 2: invalid deal");
+	ASSERT_EQ(unknown.changes().size(), 1);
+}
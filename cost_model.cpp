@@ -0,0 +1,261 @@
+#include "cost_model.h"
+#include <algorithm>
+#include <fstream>
+#include <map>
+
+std::string strategyName(SolverStrategy aStrategy)
+{
+	switch (aStrategy)
+	{
+		case ESolverAuto: return "Auto";
+		case ESolverBruteForce: return "BruteForce";
+		case ESolverBranchAndBound: return "BranchAndBound";
+		case ESolverDecomposed: return "Decomposed";
+		case ESolverCheapestFree: return "CheapestFree";
+		default: return "Unknown";
+	}
+}
+
+/*
+ * Two deals overlap if they apply to a common item in the basket.
+ * Groups (components) of deals are found with a union-find over the overlaps.
+ */
+CheckoutFeatures checkoutFeatures(const std::vector<Item>& aItems, const std::vector<const Deal*>& aDeals)
+{
+	CheckoutFeatures features;
+	features.iItems = aItems.size();
+	features.iDeals = aDeals.size();
+
+	// Which items each deal applies to
+	std::vector<std::vector<bool>> touches(aDeals.size(), std::vector<bool>(aItems.size(), false));
+	for (int d = 0; d < aDeals.size(); ++d)
+	{
+		const Deal* deal = aDeals[d];
+		for (int i = 0; i < aItems.size(); ++i)
+		{
+			touches[d][i] = deal->selectsOn(aItems[i]) || deal->targets(aItems[i]);
+		}
+
+		if (dynamic_cast<const BuyInSetOfXCheapestFree*>(deal))
+		{
+			++features.iModelDeals;
+			++features.iCheapestFreeDeals;
+		}
+		else if (dynamic_cast<const BuyAofXGetBofYForZ*>(deal))
+		{
+			++features.iModelDeals;
+		}
+	}
+
+	std::vector<int> parent(aDeals.size());
+	for (int d = 0; d < aDeals.size(); ++d)
+	{
+		parent[d] = d;
+	}
+
+	auto root = [&parent](int d)
+	{
+		while (parent[d] != d)
+		{
+			d = parent[d] = parent[parent[d]];
+		}
+		return d;
+	};
+
+	for (int a = 0; a < aDeals.size(); ++a)
+	{
+		for (int b = a + 1; b < aDeals.size(); ++b)
+		{
+			for (int i = 0; i < aItems.size(); ++i)
+			{
+				if (touches[a][i] && touches[b][i])
+				{
+					++features.iOverlaps;
+					parent[root(a)] = root(b);
+					break;
+				}
+			}
+		}
+	}
+
+	int pairs = features.iDeals * (features.iDeals - 1) / 2;
+	features.iDensity = (pairs == 0) ? 0.0 : (double)features.iOverlaps / pairs;
+
+	// Components, in order of their first deal
+	std::map<int, int> componentOfRoot;
+	for (int d = 0; d < aDeals.size(); ++d)
+	{
+		int r = root(d);
+		if (componentOfRoot.count(r) == 0)
+		{
+			componentOfRoot[r] = features.iComponents.size();
+			features.iComponents.push_back(std::vector<int>{});
+		}
+		features.iComponents[componentOfRoot[r]].push_back(d);
+	}
+
+	return features;
+}
+
+SolverStrategy CostModel::choose(const CheckoutFeatures& aFeatures) const
+{
+	if (aFeatures.iDeals > 0 && aFeatures.iCheapestFreeDeals == aFeatures.iDeals)
+	{
+		return ESolverCheapestFree;
+	}
+
+	if (aFeatures.iDeals <= iBruteForceMaxDeals && aFeatures.iItems <= iBruteForceMaxItems)
+	{
+		return ESolverBruteForce;
+	}
+
+	if (aFeatures.iComponents.size() > 1 && aFeatures.iDensity <= iDecomposeMaxDensity)
+	{
+		return ESolverDecomposed;
+	}
+
+	return ESolverBranchAndBound;
+}
+
+namespace
+{
+	// Mean time of two strategies over a group of samples
+	struct Timings
+	{
+		double iFirst{ 0.0 };
+		double iSecond{ 0.0 };
+		int iCount{ 0 };
+
+		void add(const CostSample& aSample, SolverStrategy aFirst, SolverStrategy aSecond)
+		{
+			iFirst += aSample.iMicros[aFirst];
+			iSecond += aSample.iMicros[aSecond];
+			++iCount;
+		}
+
+		// Is the first strategy (on average) no slower than the second?
+		bool firstWins() const { return iFirst <= iSecond; };
+	};
+}
+
+/*
+ * Each threshold is raised for as long as the cheaper strategy keeps winning
+ * (in increasing order of deal count, basket size or density).
+ * Thresholds with no samples to decide them are left unchanged.
+ */
+void CostModel::calibrate(const std::vector<CostSample>& aSamples)
+{
+	// Brute force vs branch and bound, by number of deals
+	std::map<int, Timings> byDeals;
+	for (const CostSample& sample : aSamples)
+	{
+		byDeals[sample.iFeatures.iDeals].add(sample, ESolverBruteForce, ESolverBranchAndBound);
+	}
+
+	if (!byDeals.empty())
+	{
+		int maxDeals = 0;
+		for (auto& entry : byDeals)
+		{
+			if (!entry.second.firstWins())
+			{
+				break;
+			}
+			maxDeals = entry.first;
+		}
+		iBruteForceMaxDeals = maxDeals;
+	}
+
+	// ... and by basket size (for the deal counts where brute force is used)
+	std::map<int, Timings> byItems;
+	for (const CostSample& sample : aSamples)
+	{
+		if (sample.iFeatures.iDeals <= iBruteForceMaxDeals)
+		{
+			byItems[sample.iFeatures.iItems].add(sample, ESolverBruteForce, ESolverBranchAndBound);
+		}
+	}
+
+	if (!byItems.empty())
+	{
+		int maxItems = 0;
+		for (auto& entry : byItems)
+		{
+			if (!entry.second.firstWins())
+			{
+				break;
+			}
+			maxItems = entry.first;
+		}
+		iBruteForceMaxItems = maxItems;
+	}
+
+	// Decomposed vs branch and bound, by density (only where there is something to decompose)
+	std::map<double, Timings> byDensity;
+	for (const CostSample& sample : aSamples)
+	{
+		if (sample.iFeatures.iComponents.size() > 1)
+		{
+			byDensity[sample.iFeatures.iDensity].add(sample, ESolverDecomposed, ESolverBranchAndBound);
+		}
+	}
+
+	if (!byDensity.empty())
+	{
+		double maxDensity = -1.0;
+		for (auto& entry : byDensity)
+		{
+			if (!entry.second.firstWins())
+			{
+				break;
+			}
+			maxDensity = entry.first;
+		}
+		iDecomposeMaxDensity = maxDensity;
+	}
+}
+
+bool CostModel::save(const std::string& aPath) const
+{
+	std::ofstream file(aPath);
+	if (!file)
+	{
+		return false;
+	}
+
+	file << "iBruteForceMaxDeals " << iBruteForceMaxDeals << "\n";
+	file << "iBruteForceMaxItems " << iBruteForceMaxItems << "\n";
+	file << "iDecomposeMaxDensity " << iDecomposeMaxDensity << "\n";
+	return (bool)file;
+}
+
+bool CostModel::load(const std::string& aPath)
+{
+	std::ifstream file(aPath);
+	if (!file)
+	{
+		return false;
+	}
+
+	std::string name;
+	while (file >> name)
+	{
+		if (name == "iBruteForceMaxDeals")
+		{
+			file >> iBruteForceMaxDeals;
+		}
+		else if (name == "iBruteForceMaxItems")
+		{
+			file >> iBruteForceMaxItems;
+		}
+		else if (name == "iDecomposeMaxDensity")
+		{
+			file >> iDecomposeMaxDensity;
+		}
+		else
+		{
+			return false;
+		}
+	}
+	return true;
+}
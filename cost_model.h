@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "deal.h"
+
+/*
+ * The ways checkoutItems can search for the best deals.
+ */
+enum SolverStrategy
+{
+	ESolverAuto = -1,				// let the CostModel choose
+	ESolverBruteForce = 0,			// evaluate every permutation from scratch
+	ESolverBranchAndBound = 1,		// depth first search, abandoning orderings which cannot win
+	ESolverDecomposed = 2,			// search groups of deals which share no items separately
+	ESolverCheapestFree = 3,		// only BuyInSetOfXCheapestFree deals: see cheapest_free.h (otherwise branch and bound)
+	ESolverCount
+};
+
+std::string strategyName(SolverStrategy aStrategy);
+
+/*
+ * Cheap features of a checkout (after filtering the deals).
+ */
+struct CheckoutFeatures
+{
+	int iItems{ 0 };
+	int iDeals{ 0 };
+	int iOverlaps{ 0 };			// pairs of deals which apply to a common item
+	double iDensity{ 0.0 };		// iOverlaps / number of pairs of deals
+	int iModelDeals{ 0 };		// BuyAofXGetBofYForZ or BuyInSetOfXCheapestFree
+	int iCheapestFreeDeals{ 0 };
+
+	// Groups of deals (as positions in the deal list) which share no items with other groups
+	std::vector<std::vector<int>> iComponents;
+};
+
+CheckoutFeatures checkoutFeatures(const std::vector<Item>& aItems, const std::vector<const Deal*>& aDeals);
+
+/*
+ * Limits shared by every search made for one checkout (from CheckoutOptions::iWorkBudget, iTimeBudget and iCancel).
+ */
+struct SearchBudget
+{
+	long iEvaluationLimit{ 0 };		// stop when CheckoutStats::iDealEvaluations reaches this (0 = no limit)
+	bool iTimed{ false };
+	std::chrono::steady_clock::time_point iDeadline;
+	const std::atomic<bool>* iCancel{ nullptr };
+
+	// Has a search which has made aEvaluations (counted as CheckoutStats::iDealEvaluations) run out?
+	bool exhausted(long aEvaluations) const
+	{
+		return (iEvaluationLimit > 0 && aEvaluations >= iEvaluationLimit) ||
+			(iTimed && std::chrono::steady_clock::now() >= iDeadline) ||
+			(iCancel && iCancel->load(std::memory_order_relaxed));
+	};
+};
+
+/*
+ * A timing of each strategy on one checkout (from the benchmark), used to calibrate a CostModel.
+ */
+struct CostSample
+{
+	CheckoutFeatures iFeatures;
+	double iMicros[ESolverCount];
+};
+
+/*
+ * Chooses a strategy per checkout from its features.
+ *
+ *  - Only "cheapest in set free" deals: the specialised solver.
+ *  - Few deals and a small basket: brute force has the least overhead.
+ *  - Deals which split into independent groups (and a sparse overlap graph): search each group separately.
+ *  - Otherwise: branch and bound.
+ *
+ * The thresholds can be calibrated from benchmark timings, and saved/loaded so each store can use its own.
+ */
+class CostModel
+{
+public:
+	SolverStrategy choose(const CheckoutFeatures& aFeatures) const;
+
+	void calibrate(const std::vector<CostSample>& aSamples);
+
+	// One "name value" pair per line
+	bool save(const std::string& aPath) const;
+	bool load(const std::string& aPath);
+
+	int iBruteForceMaxDeals{ 2 };
+	int iBruteForceMaxItems{ 50 };
+	double iDecomposeMaxDensity{ 0.5 };
+};
@@ -16,6 +16,109 @@ std::string& Deal::name()
 	return iName;
 }
 
+size_t Deal::writeName(char* aBuffer, size_t aSize) const
+{
+	std::string name = this->name();
+	name.copy(aBuffer, aSize);
+	return name.size();
+}
+
+bool Deal::addWindow(int64_t aFrom, int64_t aUntil)
+{
+	if (aFrom >= aUntil)
+	{
+		return false;
+	}
+
+	std::vector<DealWindow> windows;
+	DealWindow added{ aFrom, aUntil };
+	for (const DealWindow& window : iWindows)
+	{
+		if (window.iUntil < added.iFrom || window.iFrom > added.iUntil)
+		{
+			windows.push_back(window);
+		}
+		else
+		{
+			added.iFrom = std::min(added.iFrom, window.iFrom);
+			added.iUntil = std::max(added.iUntil, window.iUntil);
+		}
+	}
+	windows.insert(std::upper_bound(windows.begin(), windows.end(), added,
+		[](const DealWindow& aWindow, const DealWindow& aOther) { return aWindow.iFrom < aOther.iFrom; }), added);
+	iWindows.swap(windows);
+	return true;
+}
+
+bool Deal::activeAt(int64_t aTime) const
+{
+	if (iWindows.empty() || aTime == kAnyTime)
+	{
+		return true;
+	}
+	auto after = std::upper_bound(iWindows.begin(), iWindows.end(), aTime,
+		[](int64_t aTime, const DealWindow& aWindow) { return aTime < aWindow.iFrom; });
+	return after != iWindows.begin() && aTime < (after - 1)->iUntil;
+}
+
+namespace
+{
+	// Marks the first available line equal to aItem as used. Returns the line (-1 if there is none).
+	int takeLine(const BasketView& aBasket, unsigned char* aConsumed, const Item& aItem)
+	{
+		for (int line = 0; line < aBasket.iSize; ++line)
+		{
+			if (!aConsumed[line] && aBasket.iItems[line] == aItem)
+			{
+				aConsumed[line] = 1;
+				return line;
+			}
+		}
+		return -1;
+	}
+
+	// Through the basket's SelectionCache, if it has one
+	void selectLines(Selector* aSelector, const BasketView& aBasket, std::vector<int>& aLines)
+	{
+		if (aBasket.iCache)
+		{
+			aBasket.iCache->selectLines(*aSelector, aBasket, aLines);
+		}
+		else
+		{
+			aSelector->selectLines(aBasket, aLines);
+		}
+	}
+}
+
+/*
+ Adapter for deals which only implement evaluate(): each item in the result is taken
+ from the first available line equal to it (as the search used to remove it from the basket).
+ */
+void Deal::evaluateLines(const BasketView& aBasket, std::vector<LinePrice>& aResult) const
+{
+	std::vector<Item> items;
+	for (int line = 0; line < aBasket.iSize; ++line)
+	{
+		if (aBasket.available(line))
+		{
+			items.push_back(aBasket.iItems[line]);
+		}
+	}
+
+	std::vector<std::pair<Item, int>> result = evaluate(items);
+	std::vector<unsigned char> consumed(aBasket.iConsumed, aBasket.iConsumed + aBasket.iSize);
+	aResult.clear();
+	for (std::pair<Item, int>& pair : result)
+	{
+		int line = takeLine(aBasket, &consumed[0], pair.first);
+		if (line >= 0)
+		{
+			aResult.push_back(LinePrice(line, pair.second));
+		}
+	}
+}
+
 std::shared_ptr<Deal> Deal::deserialise(std::string aData)
 {
 	auto spaceIter = std::find_if(aData.begin(), aData.end(), [](char aChar) { return aChar == ' '; });
@@ -64,7 +167,41 @@ bool SmartDeal::targets(const Item & aItem) const
 	return false;
 }
 
-std::string SmartDeal::serialise()
+bool SmartDeal::coveredIds(std::set<int>& aIds) const
+{
+	for (DealSelector* ds : iSelectors.selectors())
+	{
+		if (!std::get<0>(ds->iSelector)->coveredIds(aIds) || !std::get<1>(ds->iSelector)->coveredIds(aIds))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Every strict DealSelector must select and target something
+void SmartDeal::eligibilityRules(std::vector<ItemCountRule>& aRules) const
+{
+	for (DealSelector* ds : iSelectors.selectors())
+	{
+		if (!ds->strict())
+		{
+			continue;
+		}
+
+		ItemCountRule rule;
+		if (std::get<0>(ds->iSelector)->eligibilityRule(rule))
+		{
+			aRules.push_back(rule);
+		}
+		if (std::get<1>(ds->iSelector)->eligibilityRule(rule))
+		{
+			aRules.push_back(rule);
+		}
+	}
+}
+
+std::string SmartDeal::serialise() const
 {
 	return std::string();
 }
@@ -161,4 +298,74 @@ std::vector<std::pair<Item, int>> SmartDeal::evaluate(std::vector<Item>& aInput)
 	}
 
 	return result;
+}
+
+/*
+ As evaluate(), with its copy of the input replaced by a copy of the consumed mask.
+ Items are taken from the first available line equal to them, as evaluate() erases them,
+ so the selectors see the same items in the same order.
+ Selectors are run through the basket's SelectionCache (if any), so other deals with the same selectors share their results.
+ */
+void SmartDeal::evaluateLines(const BasketView& aBasket, std::vector<LinePrice>& aResult) const
+{
+	aResult.clear();
+
+	std::vector<unsigned char> consumed(aBasket.iConsumed, aBasket.iConsumed + aBasket.iSize);
+	BasketView input(aBasket.iItems, consumed.empty() ? nullptr : &consumed[0], aBasket.iSize, aBasket.iCache);
+	std::vector<int> selected;
+	std::vector<int> targets;
+
+	for (DealSelector* ds : iSelectors.selectors())
+	{
+		DealSelectorSelectTargetPrice& selectorPair = ds->iSelector;
+
+		selectLines(std::get<0>(selectorPair), input, selected);
+		if (selected.empty())
+		{
+			if (ds->strict())
+			{
+				aResult.clear();
+				return;
+			}
+			continue;
+		}
+
+		selectLines(std::get<1>(selectorPair), input, targets);
+		if (targets.empty())
+		{
+			if (ds->strict())
+			{
+				aResult.clear();
+				return;
+			}
+			continue;
+		}
+
+		// Selected items which are also targets are only targets
+		for (int target : targets)
+		{
+			auto findItemInSelected = std::find_if(selected.begin(), selected.end(), [&aBasket, target](int aLine)
+			{
+				return aBasket.iItems[aLine] == aBasket.iItems[target];
+			});
+			if (findItemInSelected != selected.end())
+			{
+				selected.erase(findItemInSelected);
+			}
+		}
+
+		for (int target : targets)
+		{
+			int line = takeLine(aBasket, &consumed[0], aBasket.iItems[target]);
+			aResult.push_back(LinePrice(line, std::get<2>(selectorPair)));
+		}
+		for (int selection : selected)
+		{
+			int line = takeLine(aBasket, &consumed[0], aBasket.iItems[selection]);
+			if (line >= 0)
+			{
+				aResult.push_back(LinePrice(line, aBasket.iItems[line].iUnitPrice));
+			}
+		}
+	}
 }
\ No newline at end of file
@@ -1,13 +1,28 @@
 #pragma once
 
+#include <cstdint>
 #include <set>
 #include <vector>
 #include <tuple>
 #include <memory>
 
 #include "item.hpp"
+#include "id_set_pool.h"
 #include "selectors.h"
 
+// <line in the basket, price charged> (see Deal::evaluateLines)
+typedef std::pair<int, int> LinePrice;
+
+// A time a deal is valid in: [iFrom, iUntil), in seconds (e.g. since the epoch, as CheckoutOptions::iTime)
+struct DealWindow
+{
+	int64_t iFrom;
+	int64_t iUntil;
+};
+
+// For CheckoutOptions::iTime: every deal applies, whatever its windows
+const int64_t kAnyTime = INT64_MIN;
+
 /*
  * A 'Deal' interface.
  */
@@ -20,14 +35,41 @@ public:
 	virtual std::string name() const;
 	std::string& name();
 
+	// Writes the first aSize characters of name() to aBuffer (not terminated). Returns the length of the whole name.
+	// By default this calls name(); deals which build their name override it to write without allocating.
+	virtual size_t writeName(char* aBuffer, size_t aSize) const;
+
 	virtual std::vector<std::pair<Item,int>> evaluate(std::vector<Item>& aInput) const = 0;
+
+	// As evaluate(), on the available lines of aBasket, without copying items: aResult is set to the lines used and their prices (empty if the deal does not apply).
+	// aResult is kept by the caller, so its memory is reused. By default the available items are copied and passed to evaluate().
+	virtual void evaluateLines(const BasketView& aBasket, std::vector<LinePrice>& aResult) const;
 	virtual bool selectsOn(const Item& aItem) const = 0;
 	virtual bool targets(const Item& aItem) const = 0;
-	virtual std::string serialise() = 0;
+	virtual std::string serialise() const = 0;
+
+	// Adds the ids of all items this deal can select or target.
+	// Returns false if they cannot be listed (the deal must then be checked with selectsOn/targets).
+	virtual bool coveredIds(std::set<int>&) const { return false; };
+
+	// Adds rules the basket must meet before this deal can apply (none if they are not known).
+	// Meeting them does not mean the deal applies, only that it might.
+	virtual void eligibilityRules(std::vector<ItemCountRule>&) const {};
 
 	static std::shared_ptr<Deal> deserialise(std::string aData);
 
+	// Limits the deal to its windows (e.g. happy hour each day of the week): a deal without any is always valid.
+	// Overlapping windows are merged. Returns false (adding nothing) for an empty window.
+	bool addWindow(int64_t aFrom, int64_t aUntil);
+	const std::vector<DealWindow>& windows() const { return iWindows; };
+
+	// The deal is valid at aTime (a binary search of its windows)
+	bool activeAt(int64_t aTime) const;
+
 	std::string iName{ "Default Deal" };
+
+private:
+	std::vector<DealWindow> iWindows;	// in order, not overlapping
 };
 
 class MultiDealSelector;
@@ -45,11 +87,16 @@ public:
 	virtual ~SmartDeal() = default;
 
 	virtual std::vector<std::pair<Item, int>> evaluate(std::vector<Item>& aInput) const;
+	virtual void evaluateLines(const BasketView& aBasket, std::vector<LinePrice>& aResult) const;
 	virtual bool selectsOn(const Item& aItem) const;
 	virtual bool targets(const Item& aItem) const;
-	virtual std::string serialise();
+	virtual std::string serialise() const;
+	virtual bool coveredIds(std::set<int>& aIds) const;
+	virtual void eligibilityRules(std::vector<ItemCountRule>& aRules) const;
 	static SmartDeal* deserialise(std::string aData);
 
+	MultiDealSelector& dealSelectors() const { return iSelectors; };
+
 private:
 	MultiDealSelector& iSelectors;
 };
@@ -62,26 +109,38 @@ enum DealType
 	EBuyAofXGetBofYFZ = 1
 };
 
+/*
+ * The set is interned in an IdSetPool (the shared one, unless a handle is given),
+ * so deals over the same ids share one copy.
+ */
 class BuyInSetOfXCheapestFree : public Deal
 {
 public:
 	BuyInSetOfXCheapestFree(std::set<int> aInputSet, int aTargetCount)
+		: Deal("BuyInSetOfXCheapestFree"), iInputSet(IdSetPool::shared().intern(aInputSet)), iTargetCount(aTargetCount) {};
+	BuyInSetOfXCheapestFree(IdSetHandle aInputSet, int aTargetCount)
 		: Deal("BuyInSetOfXCheapestFree"), iInputSet(aInputSet), iTargetCount(aTargetCount) {};
 
 	virtual std::string name() const;
+	virtual size_t writeName(char* aBuffer, size_t aSize) const;
 
 	virtual std::vector<std::pair<Item, int>> evaluate(std::vector<Item>& aInput) const;
+	virtual void evaluateLines(const BasketView& aBasket, std::vector<LinePrice>& aResult) const;
 
 	virtual bool selectsOn(const Item& aItem) const;
 	virtual bool targets(const Item& aItem) const;
 
-	virtual std::string serialise();
+	virtual std::string serialise() const;
+	virtual bool coveredIds(std::set<int>& aIds) const;
+	virtual void eligibilityRules(std::vector<ItemCountRule>& aRules) const;
 	static BuyInSetOfXCheapestFree* deserialise(std::string aData);
 
 	const std::set<int>& selection() const;
+	const IdSet& selectionIds() const { return *iInputSet; };
+	const IdSetHandle& selectionHandle() const { return iInputSet; };
 	int targetCount() const;
 private:
-	std::set<int> iInputSet;
+	IdSetHandle iInputSet;
 	int iTargetCount;
 };
 
@@ -98,20 +157,24 @@ public:
 	};
 
 	virtual std::string name() const;
+	virtual size_t writeName(char* aBuffer, size_t aSize) const;
 
 	virtual bool selectsOn(const Item& aItem) const;
 	virtual bool targets(const Item& aItem) const;
 
 	virtual std::vector<std::pair<Item, int>> evaluate(std::vector<Item>& aInput) const;
+	virtual void evaluateLines(const BasketView& aBasket, std::vector<LinePrice>& aResult) const;
 
-	virtual std::string serialise();
+	virtual std::string serialise() const;
+	virtual bool coveredIds(std::set<int>& aIds) const;
+	virtual void eligibilityRules(std::vector<ItemCountRule>& aRules) const;
 	static BuyAofXGetBofYForZ* deserialise(std::string aData);
 
-	inline int selectionCount() { return iSelectionCount; }
-	inline int selectionId() { return iSelectionId; }
-	inline int targetCount() { return iTargetCount; }
-	inline int targetId() { return iTargetId; }
-	inline int targetUnitPrice() { return iTargetUnitPrice; }
+	inline int selectionCount() const { return iSelectionCount; }
+	inline int selectionId() const { return iSelectionId; }
+	inline int targetCount() const { return iTargetCount; }
+	inline int targetId() const { return iTargetId; }
+	inline int targetUnitPrice() const { return iTargetUnitPrice; }
 
 private:
 	int iSelectionCount;	//A
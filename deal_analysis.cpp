@@ -0,0 +1,127 @@
+#include "deal_analysis.h"
+#include <algorithm>
+
+bool dominates(const Deal* aBetter, const Deal* aWorse)
+{
+	const BuyAofXGetBofYForZ* better = dynamic_cast<const BuyAofXGetBofYForZ*>(aBetter);
+	const BuyAofXGetBofYForZ* worse = dynamic_cast<const BuyAofXGetBofYForZ*>(aWorse);
+	if (better && worse)
+	{
+		return better->selectionCount() == worse->selectionCount() &&
+			better->selectionId() == worse->selectionId() &&
+			better->targetCount() == worse->targetCount() &&
+			better->targetId() == worse->targetId() &&
+			better->targetUnitPrice() <= worse->targetUnitPrice();
+	}
+
+	const BuyInSetOfXCheapestFree* betterInSet = dynamic_cast<const BuyInSetOfXCheapestFree*>(aBetter);
+	const BuyInSetOfXCheapestFree* worseInSet = dynamic_cast<const BuyInSetOfXCheapestFree*>(aWorse);
+	if (betterInSet && worseInSet)
+	{
+		return betterInSet->targetCount() == worseInSet->targetCount() &&
+			betterInSet->selectionIds() == worseInSet->selectionIds();
+	}
+
+	return false;
+}
+
+std::vector<const Deal*> removeDominatedDeals(const std::vector<const Deal*>& aDeals, long& aPruned)
+{
+	std::vector<const Deal*> result;
+
+	for (int j = 0; j < aDeals.size(); ++j)
+	{
+		bool dominated = false;
+		for (int i = 0; i < aDeals.size() && !dominated; ++i)
+		{
+			if (i == j || !dominates(aDeals[i], aDeals[j]))
+			{
+				continue;
+			}
+
+			// Equal deals dominate each other - keep the first
+			dominated = !dominates(aDeals[j], aDeals[i]) || i < j;
+		}
+
+		if (dominated)
+		{
+			++aPruned;
+		}
+		else
+		{
+			result.push_back(aDeals[j]);
+		}
+	}
+
+	return result;
+}
+
+/*
+ * BuyAofXGetBofYForZ (X == Y) first takes B items at Z (which also count as selected), then any more
+ * selected items (A > B) at their unit price.
+ * A SmartDeal selects N items and targets K (from the same items), then drops one selected item per target,
+ * so it is the same shape: max(N, K) items, K of them at the deal price.
+ */
+bool singleItemBundle(const Deal* aDeal, SingleItemBundle& aBundle)
+{
+	aBundle = SingleItemBundle();
+	aBundle.iDeal = aDeal;
+
+	int selectionCount = 0;
+	int targetCount = 0;
+
+	const BuyAofXGetBofYForZ* model = dynamic_cast<const BuyAofXGetBofYForZ*>(aDeal);
+	const SmartDeal* smart = dynamic_cast<const SmartDeal*>(aDeal);
+	if (model)
+	{
+		if (model->selectionId() != model->targetId())
+		{
+			return false;
+		}
+
+		aBundle.iItemId = model->selectionId();
+		aBundle.iDealUnitPrice = model->targetUnitPrice();
+		selectionCount = model->selectionCount();
+		targetCount = model->targetCount();
+	}
+	else if (smart)
+	{
+		std::vector<DealSelector*>& selectors = smart->dealSelectors().selectors();
+		if (selectors.size() != 1 || !selectors[0]->strict())
+		{
+			return false;
+		}
+
+		DealSelectorSelectTargetPrice& parts = selectors[0]->iSelector;
+		const SingleItemSelector* selection = dynamic_cast<const SingleItemSelector*>(std::get<0>(parts));
+		const SingleItemSelector* target = dynamic_cast<const SingleItemSelector*>(std::get<1>(parts));
+		if (!selection || !target ||
+			selection->item().iId != target->item().iId || selection->item().iUnitPrice != target->item().iUnitPrice)
+		{
+			return false;
+		}
+
+		const CountedSpecificItemSelector* countedSelection = dynamic_cast<const CountedSpecificItemSelector*>(selection);
+		const CountedSpecificItemSelector* countedTarget = dynamic_cast<const CountedSpecificItemSelector*>(target);
+
+		aBundle.iItemId = selection->item().iId;
+		aBundle.iItemPrice = selection->item().iUnitPrice;
+		aBundle.iDealUnitPrice = std::get<2>(parts);
+		selectionCount = countedSelection ? countedSelection->selectionCount() : 1;
+		targetCount = countedTarget ? countedTarget->selectionCount() : 1;
+
+		// (a selector looking for no items never matches)
+		if (selectionCount < 1 || targetCount < 1)
+		{
+			return false;
+		}
+	}
+	else
+	{
+		return false;
+	}
+
+	aBundle.iUnits = std::max(selectionCount, targetCount);
+	aBundle.iDealUnits = targetCount;
+	return aBundle.iUnits > 0;
+}
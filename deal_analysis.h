@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+
+#include "deal.h"
+
+/*
+ * Static analysis of deals, using only the deal parameters (so it holds for any basket).
+ *
+ * Currently covers the model deals, whose parameters are fully visible:
+ *   BuyAofXGetBofYForZ: same selection and target (count and id), cheaper (or equal) unit price
+ *   BuyInSetOfXCheapestFree: same set and count
+ * In both cases the two deals match exactly the same items. Whichever is evaluated first
+ * is applied until it no longer matches, after which the other cannot match either (fewer items remain).
+ * So only the first of the two in an ordering matters, and the better one is never worse there.
+ */
+
+// Is aBetter never worse than aWorse, on any basket and in any ordering?
+bool dominates(const Deal* aBetter, const Deal* aWorse);
+
+// Remove deals dominated by another deal in the list (of equal deals, the first is kept).
+// aPruned is increased by the number of deals removed.
+std::vector<const Deal*> removeDominatedDeals(const std::vector<const Deal*>& aDeals, long& aPruned);
+
+/*
+ * A deal which only ever applies to one item (e.g. buy 3 for 250).
+ * Each time it applies it takes iUnits of the item: iDealUnits of them at iDealUnitPrice, the rest at their unit price.
+ */
+struct SingleItemBundle
+{
+	const Deal* iDeal{ nullptr };
+	int iItemId{ 0 };
+	int iItemPrice{ -1 };		// the deal only matches the item at this unit price (-1 if any)
+	int iUnits{ 0 };
+	int iDealUnits{ 0 };
+	int iDealUnitPrice{ 0 };
+
+	int cost(int aUnitPrice) const { return iDealUnits * iDealUnitPrice + (iUnits - iDealUnits) * aUnitPrice; };
+};
+
+// Is aDeal a single item deal? If so, describe it in aBundle.
+// (BuyAofXGetBofYForZ where X == Y, or a SmartDeal made of one strict DealSelector using SingleItemSelector/CountedSpecificItemSelector on the same item)
+bool singleItemBundle(const Deal* aDeal, SingleItemBundle& aBundle);
@@ -0,0 +1,513 @@
+#include "deal_catalog.h"
+#include <algorithm>
+#include <set>
+#include <sstream>
+
+namespace
+{
+	// A power of two, about one block for every 16 entries (a customer's few deals in a DealOverlay get one)
+	size_t shardCount(size_t aEntries)
+	{
+		size_t count = 1;
+		while (count * 16 < aEntries)
+		{
+			count *= 2;
+		}
+		return count;
+	}
+
+	// aBlock, copied first if another index or catalog shares it (counted in aCopied)
+	template<typename Block>
+	Block& writable(std::shared_ptr<Block>& aBlock, size_t& aCopied)
+	{
+		if (aBlock.use_count() > 1)
+		{
+			aBlock = std::make_shared<Block>(*aBlock);
+			++aCopied;
+		}
+		return *aBlock;
+	}
+
+	const char kChangeMarks[] = { '+', '~', '-' };
+}
+
+DealIndex::DealIndex(const std::vector<const Deal*>& aDeals)
+	: iItems(shardCount(aDeals.size())), iKeys(shardCount(aDeals.size() / 16))		// (only added deals' keys are stored)
+{
+	for (std::shared_ptr<ItemShard>& shard : iItems)
+	{
+		shard = std::make_shared<ItemShard>();
+	}
+	for (std::shared_ptr<KeyShard>& shard : iKeys)
+	{
+		shard = std::make_shared<KeyShard>();
+	}
+
+	iInitial = aDeals.size();
+	for (int d = 0; d < aDeals.size(); ++d)
+	{
+		// The caller keeps these deals: the index only refers to them (without a count)
+		place(iPositions++, std::string(), std::shared_ptr<const Deal>(std::shared_ptr<const Deal>(), aDeals[d]));
+		index(d, nullptr);
+		for (const DealWindow& window : aDeals[d]->windows())
+		{
+			iChanges.push_back(window.iFrom);
+			iChanges.push_back(window.iUntil);
+		}
+	}
+	std::sort(iChanges.begin(), iChanges.end());
+}
+
+std::vector<const Deal*> DealIndex::deals() const
+{
+	std::vector<const Deal*> deals;
+	deals.reserve(iLive);
+	for (const std::shared_ptr<DealBlock>& block : iBlocks)
+	{
+		for (const Slot& slot : block->iSlots)
+		{
+			if (slot.iDeal)
+			{
+				deals.push_back(slot.iDeal.get());
+			}
+		}
+	}
+	return deals;
+}
+
+void DealIndex::filterDeals(const std::vector<Item>& aItems, int64_t aTime, std::vector<const Deal*>& aResult) const
+{
+	std::vector<int> candidates = iUnindexed;
+	for (const Item& item : aItems)
+	{
+		const std::vector<int>* positions = dealsFor(item.iId);
+		if (positions)
+		{
+			candidates.insert(candidates.end(), positions->begin(), positions->end());
+		}
+	}
+
+	std::sort(candidates.begin(), candidates.end());
+	candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+	// Indexed deals may still depend on more than the id (e.g. a SmartDeal also matches the price)
+	for (int d : candidates)
+	{
+		const Deal* deal = this->deal(d);
+		if (!deal->activeAt(aTime))
+		{
+			continue;
+		}
+		for (const Item& item : aItems)
+		{
+			if (deal->selectsOn(item) || deal->targets(item))
+			{
+				aResult.push_back(deal);
+				break;
+			}
+		}
+	}
+}
+
+const std::vector<int>* DealIndex::dealsFor(int aId) const
+{
+	const ItemShard& shard = itemShard(aId);
+	auto find = shard.iPositions.find(aId);
+	return find == shard.iPositions.end() ? nullptr : &find->second;
+}
+
+std::vector<int> DealIndex::itemIds() const
+{
+	std::vector<int> ids;
+	for (const std::shared_ptr<ItemShard>& shard : iItems)
+	{
+		for (auto& entry : shard->iPositions)
+		{
+			ids.push_back(entry.first);
+		}
+	}
+	return ids;
+}
+
+int64_t DealIndex::nextChange(int64_t aTime) const
+{
+	auto next = std::upper_bound(iChanges.begin(), iChanges.end(), aTime);
+	return next == iChanges.end() ? INT64_MAX : *next;
+}
+
+int DealIndex::find(const std::string& aKey) const
+{
+	const KeyShard& shard = *iKeys[std::hash<std::string>()(aKey) & (iKeys.size() - 1)];
+	auto find = shard.iPositions.find(aKey);
+	if (find != shard.iPositions.end())
+	{
+		return find->second;
+	}
+
+	// The constructor's deals, by position
+	int position = 0;
+	for (char digit : aKey)
+	{
+		if (digit < '0' || digit > '9' || position >= iInitial)
+		{
+			return -1;
+		}
+		position = position * 10 + (digit - '0');
+	}
+	if (aKey.empty() || (aKey[0] == '0' && aKey.size() > 1) || position >= iInitial)
+	{
+		return -1;
+	}
+	const Slot& slot = iBlocks[position / kBlockDeals]->iSlots[position % kBlockDeals];
+	return (slot.iDeal && slot.iKey.empty()) ? position : -1;
+}
+
+void DealIndex::add(const std::string& aKey, const std::shared_ptr<const Deal>& aDeal, std::set<int>& aTouched)
+{
+	int position = iPositions++;
+	place(position, aKey, aDeal);
+	index(position, &aTouched);
+	addWindows(*aDeal);
+}
+
+void DealIndex::replace(int aPosition, const std::shared_ptr<const Deal>& aDeal, std::set<int>& aTouched)
+{
+	unindex(aPosition, aTouched);
+	removeWindows(*deal(aPosition));
+	writable(iBlocks[aPosition / kBlockDeals], iBlocksCopied).iSlots[aPosition % kBlockDeals].iDeal = aDeal;
+	index(aPosition, &aTouched);
+	addWindows(*aDeal);
+}
+
+void DealIndex::retire(int aPosition, std::set<int>& aTouched)
+{
+	unindex(aPosition, aTouched);
+	removeWindows(*deal(aPosition));
+	Slot& slot = writable(iBlocks[aPosition / kBlockDeals], iBlocksCopied).iSlots[aPosition % kBlockDeals];
+	if (!slot.iKey.empty())
+	{
+		writable(keyShard(slot.iKey), iBlocksCopied).iPositions.erase(slot.iKey);
+	}
+	slot.iDeal.reset();
+	--iLive;
+}
+
+void DealIndex::place(int aPosition, const std::string& aKey, const std::shared_ptr<const Deal>& aDeal)
+{
+	if (aPosition / kBlockDeals == iBlocks.size())
+	{
+		iBlocks.push_back(std::make_shared<DealBlock>());
+		// (the constructor's last block only needs room for its deals)
+		int slots = aPosition < iInitial ? iInitial - aPosition : kBlockDeals;
+		iBlocks.back()->iSlots.reserve(slots < kBlockDeals ? slots : kBlockDeals);
+	}
+	writable(iBlocks[aPosition / kBlockDeals], iBlocksCopied).iSlots.push_back(Slot{ aKey, aDeal });
+	if (!aKey.empty())
+	{
+		writable(keyShard(aKey), iBlocksCopied).iPositions[aKey] = aPosition;
+	}
+	++iLive;
+}
+
+void DealIndex::index(int aPosition, std::set<int>* aTouched)
+{
+	std::set<int> ids;
+	if (!deal(aPosition)->coveredIds(ids))
+	{
+		iUnindexed.insert(std::upper_bound(iUnindexed.begin(), iUnindexed.end(), aPosition), aPosition);
+		return;
+	}
+
+	for (int id : ids)
+	{
+		std::vector<int>& positions = writable(itemShard(id), iBlocksCopied).iPositions[id];
+		positions.insert(std::upper_bound(positions.begin(), positions.end(), aPosition), aPosition);
+		if (aTouched)
+		{
+			aTouched->insert(id);
+		}
+	}
+}
+
+void DealIndex::unindex(int aPosition, std::set<int>& aTouched)
+{
+	std::set<int> ids;
+	if (!deal(aPosition)->coveredIds(ids))
+	{
+		iUnindexed.erase(std::lower_bound(iUnindexed.begin(), iUnindexed.end(), aPosition));
+		return;
+	}
+
+	for (int id : ids)
+	{
+		std::unordered_map<int, std::vector<int>>& byItem = writable(itemShard(id), iBlocksCopied).iPositions;
+		std::vector<int>& positions = byItem[id];
+		positions.erase(std::lower_bound(positions.begin(), positions.end(), aPosition));
+		if (positions.empty())
+		{
+			byItem.erase(id);
+		}
+		aTouched.insert(id);
+	}
+}
+
+void DealIndex::addWindows(const Deal& aDeal)
+{
+	for (const DealWindow& window : aDeal.windows())
+	{
+		iChanges.insert(std::upper_bound(iChanges.begin(), iChanges.end(), window.iFrom), window.iFrom);
+		iChanges.insert(std::upper_bound(iChanges.begin(), iChanges.end(), window.iUntil), window.iUntil);
+	}
+}
+
+void DealIndex::removeWindows(const Deal& aDeal)
+{
+	for (const DealWindow& window : aDeal.windows())
+	{
+		iChanges.erase(std::lower_bound(iChanges.begin(), iChanges.end(), window.iFrom));
+		iChanges.erase(std::lower_bound(iChanges.begin(), iChanges.end(), window.iUntil));
+	}
+}
+
+std::string CatalogDelta::serialise() const
+{
+	std::string data;
+	for (const Change& change : iChanges)
+	{
+		data += kChangeMarks[change.iType];
+		data += ' ';
+		data += change.iKey;
+		if (change.iDeal)
+		{
+			data += ' ';
+			data += change.iDeal->serialise();
+		}
+		data += '\n';
+	}
+	return data;
+}
+
+bool CatalogDelta::deserialise(const std::string& aData, std::string& aError)
+{
+	CatalogDelta delta;
+	std::istringstream lines(aData);
+	std::string line;
+	for (int number = 1; std::getline(lines, line); ++number)
+	{
+		if (!line.empty() && line.back() == '\r')
+		{
+			line.pop_back();
+		}
+		if (line.empty() || line[0] == '#')
+		{
+			continue;
+		}
+
+		const char* mark = std::find(kChangeMarks, kChangeMarks + 3, line[0]);
+		std::string::size_type keyEnd = line.find(' ', 2);
+		std::string key = line.size() > 2 ? line.substr(2, keyEnd == std::string::npos ? std::string::npos : keyEnd - 2) : "";
+		CatalogChangeType type = (CatalogChangeType)(mark - kChangeMarks);
+		if (mark == kChangeMarks + 3 || line.size() < 3 || line[1] != ' ' || key.empty() || (type == ECatalogRetire) != (keyEnd == std::string::npos))
+		{
+			aError = "Line " + std::to_string(number) + ": not a change";
+			return false;
+		}
+
+		std::shared_ptr<const Deal> deal;
+		if (type != ECatalogRetire)
+		{
+			try
+			{
+				deal = Deal::deserialise(line.substr(keyEnd + 1));
+			}
+			catch (...)
+			{
+			}
+			if (!deal)
+			{
+				aError = "Line " + std::to_string(number) + ": invalid deal";
+				return false;
+			}
+		}
+		delta.iChanges.push_back(Change{ type, key, deal });
+	}
+
+	iChanges.insert(iChanges.end(), delta.iChanges.begin(), delta.iChanges.end());
+	return true;
+}
+
+DealCatalog::DealCatalog(const std::vector<const Deal*>& aDeals, const std::vector<Item>& aPriceList)
+	: iIndex(aDeals)
+{
+	std::vector<int> ids = iIndex.itemIds();
+	// (smaller shards than the index's: a curve costs more to copy than an index entry)
+	iCurves.resize(shardCount(4 * std::max(ids.size(), aPriceList.size())));
+	for (std::shared_ptr<CurveShard>& shard : iCurves)
+	{
+		shard = std::make_shared<CurveShard>();
+	}
+	for (const Item& item : aPriceList)
+	{
+		curveShard(item.iId)->iUnitPrices[item.iId] = item.iUnitPrice;
+	}
+
+	size_t copied = 0;
+	for (int id : ids)
+	{
+		buildCurve(id, copied);
+	}
+}
+
+/*
+ * An item gets a curve if every (indexed) deal touching it is a single item deal on that item (and there are few enough).
+ * Deals which did not give their ids may still touch it - that is checked per basket, at checkout.
+ */
+bool DealCatalog::buildCurve(int aId, size_t& aBlocksCopied)
+{
+	const CurveShard& current = *curveShard(aId);
+	auto price = current.iUnitPrices.find(aId);
+	int unitPrice = price == current.iUnitPrices.end() ? -1 : price->second;
+
+	const std::vector<int>* positions = iIndex.dealsFor(aId);
+	std::vector<SingleItemBundle> bundles;
+	bool singleItem = positions != nullptr;
+	for (size_t d = 0; singleItem && d < positions->size(); ++d)
+	{
+		const Deal* deal = iIndex.deal((*positions)[d]);
+		SingleItemBundle bundle;
+		if (!singleItemBundle(deal, bundle) || bundle.iItemId != aId || !deal->windows().empty())
+		{
+			singleItem = false;
+			break;
+		}
+
+		// SmartDeals match on the item's price too
+		if (bundle.iItemPrice != -1)
+		{
+			if (unitPrice == -1)
+			{
+				unitPrice = bundle.iItemPrice;
+			}
+			else if (unitPrice != bundle.iItemPrice)
+			{
+				singleItem = false;
+				break;
+			}
+		}
+		bundles.push_back(bundle);
+	}
+
+	bool hasCurve = singleItem && unitPrice != -1 && bundles.size() <= PriceCurve::kMaxBundles;
+	if (!hasCurve && !current.iCurves.count(aId))
+	{
+		return false;
+	}
+
+	CurveShard& shard = writable(curveShard(aId), aBlocksCopied);
+	iCurveCount -= shard.iCurves.erase(aId);
+	if (hasCurve)
+	{
+		shard.iCurves[aId] = PriceCurve(unitPrice, bundles);
+		++iCurveCount;
+	}
+	return hasCurve;
+}
+
+std::vector<const Deal*> DealCatalog::filterDeals(const std::vector<Item>& aItems, int64_t aTime) const
+{
+	std::vector<const Deal*> result;
+	iIndex.filterDeals(aItems, aTime, result);
+	return result;
+}
+
+const PriceCurve* DealCatalog::curve(const Item& aItem) const
+{
+	const CurveShard& shard = curveShard(aItem.iId);
+	auto find = shard.iCurves.find(aItem.iId);
+	if (find == shard.iCurves.end() || find->second.unitPrice() != aItem.iUnitPrice)
+	{
+		return nullptr;
+	}
+	return &find->second;
+}
+
+std::shared_ptr<const DealCatalog> DealCatalog::apply(const CatalogDelta& aDelta, std::string& aError, CatalogDeltaStats* aStats) const
+{
+	// Shares every block with this catalog until it is changed
+	std::shared_ptr<DealCatalog> next = std::make_shared<DealCatalog>(*this);
+	size_t copiedBefore = next->iIndex.blocksCopied();
+
+	CatalogDeltaStats stats;
+	std::set<int> touched;
+	for (const CatalogDelta::Change& change : aDelta.changes())
+	{
+		int position = next->iIndex.find(change.iKey);
+		if (change.iType == ECatalogAdd && position != -1)
+		{
+			aError = "A deal already has key " + change.iKey;
+			return nullptr;
+		}
+		if (change.iType != ECatalogAdd && position == -1)
+		{
+			aError = "No deal has key " + change.iKey;
+			return nullptr;
+		}
+		if (change.iType != ECatalogRetire && !change.iDeal)
+		{
+			aError = "No deal given for key " + change.iKey;
+			return nullptr;
+		}
+
+		switch (change.iType)
+		{
+			case ECatalogAdd:
+				next->iIndex.add(change.iKey, change.iDeal, touched);
+				++stats.iAdded;
+				break;
+			case ECatalogReplace:
+				next->iIndex.replace(position, change.iDeal, touched);
+				++stats.iReplaced;
+				break;
+			case ECatalogRetire:
+				next->iIndex.retire(position, touched);
+				++stats.iRetired;
+				break;
+		}
+	}
+
+	size_t curvesCopied = 0;
+	for (int id : touched)
+	{
+		if (next->buildCurve(id, curvesCopied))
+		{
+			++stats.iCurvesBuilt;
+		}
+	}
+
+	if (aStats)
+	{
+		stats.iItemsTouched = touched.size();
+		stats.iBlocksCopied = next->iIndex.blocksCopied() - copiedBefore + curvesCopied;
+		*aStats = stats;
+	}
+	return next;
+}
+
+bool CatalogSnapshots::apply(const CatalogDelta& aDelta, std::string& aError, CatalogDeltaStats* aStats)
+{
+	std::lock_guard<std::mutex> lock(iWriter);
+	std::shared_ptr<const DealCatalog> next = current()->apply(aDelta, aError, aStats);
+	if (!next)
+	{
+		return false;
+	}
+	std::atomic_store(&iCurrent, next);
+	return true;
+}
+
+std::vector<const Deal*> DealOverlay::filterDeals(const std::vector<Item>& aItems, int64_t aTime) const
+{
+	std::vector<const Deal*> result = iCatalog.filterDeals(aItems, aTime);
+	iIndex.filterDeals(aItems, aTime, result);
+	return result;
+}
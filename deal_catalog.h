@@ -0,0 +1,262 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "deal.h"
+#include "price_curve.h"
+
+/*
+ * Deals indexed by the item ids they apply to (Deal::coveredIds), so finding the deals
+ * for a basket does not look at every deal. Deals which cannot list their ids are always checked.
+ *
+ * Each deal has a position (the order it was given or added in) and a key, by which a CatalogDelta refers to it
+ * (the deals given to the constructor are keyed by their positions: "0", "1", ..., which are not stored).
+ *
+ * The deals, and the index by item and by key, are kept in blocks shared between copies of the index:
+ * copying an index copies a pointer per block, and add(), replace() and retire() copy only the blocks
+ * they change (copy on write), so a patched copy can be made while the original is still being read.
+ */
+class DealIndex
+{
+public:
+	DealIndex(const std::vector<const Deal*>& aDeals);
+
+	// The deals not retired, in order
+	std::vector<const Deal*> deals() const;
+	size_t size() const { return iLive; };
+
+	// Adds the deals which apply to aItems (in index order), as Checkout::filterDeals, and are valid at aTime
+	void filterDeals(const std::vector<Item>& aItems, int64_t aTime, std::vector<const Deal*>& aResult) const;
+
+	// The positions of the deals indexed under aId, in order (nullptr if there are none)
+	const std::vector<int>* dealsFor(int aId) const;
+	const Deal* deal(int aPosition) const { return iBlocks[aPosition / kBlockDeals]->iSlots[aPosition % kBlockDeals].iDeal.get(); };
+
+	// Every id deals are indexed under
+	std::vector<int> itemIds() const;
+
+	// The first time after aTime any deal's window opens or closes (INT64_MAX if none does)
+	int64_t nextChange(int64_t aTime) const;
+
+	// The position of the deal with aKey (-1 if there is none)
+	int find(const std::string& aKey) const;
+
+	// Each adds the ids the deal was, or now is, indexed under to aTouched
+	void add(const std::string& aKey, const std::shared_ptr<const Deal>& aDeal, std::set<int>& aTouched);
+	void replace(int aPosition, const std::shared_ptr<const Deal>& aDeal, std::set<int>& aTouched);
+	void retire(int aPosition, std::set<int>& aTouched);
+
+	// Blocks copied (rather than shared) by add(), replace() and retire()
+	size_t blocksCopied() const { return iBlocksCopied; };
+
+private:
+	static const int kBlockDeals = 64;
+
+	struct Slot
+	{
+		std::string iKey;						// (empty for the constructor's deals)
+		std::shared_ptr<const Deal> iDeal;		// (null once retired)
+	};
+	struct DealBlock
+	{
+		std::vector<Slot> iSlots;
+	};
+	struct ItemShard
+	{
+		std::unordered_map<int, std::vector<int>> iPositions;			// by item id
+	};
+	struct KeyShard
+	{
+		std::unordered_map<std::string, int> iPositions;		// of the deals added since
+	};
+
+	std::shared_ptr<ItemShard>& itemShard(int aId) { return iItems[((uint32_t)aId * 2654435761u >> 7) & (iItems.size() - 1)]; };
+	const ItemShard& itemShard(int aId) const { return *iItems[((uint32_t)aId * 2654435761u >> 7) & (iItems.size() - 1)]; };
+	std::shared_ptr<KeyShard>& keyShard(const std::string& aKey) { return iKeys[std::hash<std::string>()(aKey) & (iKeys.size() - 1)]; };
+
+	void place(int aPosition, const std::string& aKey, const std::shared_ptr<const Deal>& aDeal);
+	// (aTouched may be nullptr)
+	void index(int aPosition, std::set<int>* aTouched);
+	void unindex(int aPosition, std::set<int>& aTouched);
+	void addWindows(const Deal& aDeal);
+	void removeWindows(const Deal& aDeal);
+
+	std::vector<std::shared_ptr<DealBlock>> iBlocks;		// kBlockDeals positions each
+	std::vector<std::shared_ptr<ItemShard>> iItems;			// a power of two of them
+	std::vector<std::shared_ptr<KeyShard>> iKeys;			// a power of two of them
+	std::vector<int> iUnindexed;							// deals which did not give their ids, in order
+	std::vector<int64_t> iChanges;							// every window's start and end, in order (repeats kept)
+	int iPositions{ 0 };
+	int iInitial{ 0 };				// deals given to the constructor
+	size_t iLive{ 0 };
+	size_t iBlocksCopied{ 0 };
+};
+
+enum CatalogChangeType
+{
+	ECatalogAdd = 0,
+	ECatalogReplace = 1,
+	ECatalogRetire = 2
+};
+
+/*
+ * Changes to a DealCatalog, as text in the style of Deal::serialise, one change per line:
+ *   + <key> <Deal::serialise()>		add a deal (keys have no spaces)
+ *   ~ <key> <Deal::serialise()>		replace the deal with this key (it keeps its place in the catalog)
+ *   - <key>							retire the deal with this key
+ * Blank lines and lines starting with '#' are skipped.
+ */
+class CatalogDelta
+{
+public:
+	struct Change
+	{
+		CatalogChangeType iType;
+		std::string iKey;
+		std::shared_ptr<const Deal> iDeal;		// (null for ECatalogRetire)
+	};
+
+	void add(const std::string& aKey, const std::shared_ptr<const Deal>& aDeal) { iChanges.push_back(Change{ ECatalogAdd, aKey, aDeal }); };
+	void replace(const std::string& aKey, const std::shared_ptr<const Deal>& aDeal) { iChanges.push_back(Change{ ECatalogReplace, aKey, aDeal }); };
+	void retire(const std::string& aKey) { iChanges.push_back(Change{ ECatalogRetire, aKey, nullptr }); };
+
+	const std::vector<Change>& changes() const { return iChanges; };
+
+	std::string serialise() const;
+
+	// false (with the line and what is wrong with it in aError) if a line is not a change
+	bool deserialise(const std::string& aData, std::string& aError);
+
+private:
+	std::vector<Change> iChanges;
+};
+
+struct CatalogDeltaStats
+{
+	int iAdded{ 0 };
+	int iReplaced{ 0 };
+	int iRetired{ 0 };
+	size_t iItemsTouched{ 0 };		// ids deals were, or now are, indexed under
+	size_t iCurvesBuilt{ 0 };		// touched items given a curve (no other curve is rebuilt)
+	size_t iBlocksCopied{ 0 };		// index and curve blocks copied; the rest are shared with the old catalog
+};
+
+/*
+ * The store's deals, prepared once when they are loaded.
+ *
+ *  - Deals are indexed (see DealIndex).
+ *  - Items only affected by single item deals (see SingleItemBundle) get a PriceCurve,
+ *    so they can be priced without searching deal orderings (at the price the search would find).
+ *    The unit price comes from aPriceList (or from the deals themselves, for SmartDeals).
+ *    Items touched by a deal with validity windows, or by more than PriceCurve::kMaxBundles deals, are not given a curve.
+ *  - Deals with validity windows (Deal::addWindow) are checked against the checkout's time as they are found,
+ *    so nothing is rebuilt as windows open and close.
+ *  - apply() makes a new catalog with a CatalogDelta applied, patching the index and rebuilding only the curves
+ *    of the items the changed deals touch. The new catalog shares what did not change with this one,
+ *    which is left as it was (see CatalogSnapshots).
+ *
+ * The deals given to the constructor must outlive every catalog made from it; deals added by a delta are
+ * kept by the catalogs which have them.
+ */
+class DealCatalog
+{
+public:
+	DealCatalog(const std::vector<const Deal*>& aDeals, const std::vector<Item>& aPriceList = std::vector<Item>());
+
+	std::vector<const Deal*> deals() const { return iIndex.deals(); };
+
+	// The position of the deal with aKey in the catalog (-1 if there is none)
+	int find(const std::string& aKey) const { return iIndex.find(aKey); };
+
+	// The deals which apply to aItems (in catalog order), as Checkout::filterDeals, and are valid at aTime
+	std::vector<const Deal*> filterDeals(const std::vector<Item>& aItems, int64_t aTime = kAnyTime) const;
+
+	// The first time after aTime any deal's window opens or closes (INT64_MAX if none does),
+	// so a caller keeping deals found for aTime knows how long they hold
+	int64_t nextChange(int64_t aTime) const { return iIndex.nextChange(aTime); };
+
+	// The price curve for aItem (nullptr if there is none, or aItem is not at the curve's unit price)
+	const PriceCurve* curve(const Item& aItem) const;
+
+	size_t curveCount() const { return iCurveCount; };
+
+	// This catalog with aDelta applied (nullptr, with the reason in aError, if a change refers to a key
+	// which is not in the catalog, or adds one which is)
+	std::shared_ptr<const DealCatalog> apply(const CatalogDelta& aDelta, std::string& aError, CatalogDeltaStats* aStats = nullptr) const;
+
+private:
+	struct CurveShard
+	{
+		std::unordered_map<int, PriceCurve> iCurves;	// by item id
+		std::unordered_map<int, int> iUnitPrices;		// from the price list, by item id
+	};
+
+	std::shared_ptr<CurveShard>& curveShard(int aId) { return iCurves[((uint32_t)aId * 2654435761u >> 7) & (iCurves.size() - 1)]; };
+	const CurveShard& curveShard(int aId) const { return *iCurves[((uint32_t)aId * 2654435761u >> 7) & (iCurves.size() - 1)]; };
+
+	// (Re)builds aId's curve from the deals indexed under it, counting shards copied in aBlocksCopied.
+	// Returns whether aId has a curve.
+	bool buildCurve(int aId, size_t& aBlocksCopied);
+
+	DealIndex iIndex;
+	std::vector<std::shared_ptr<CurveShard>> iCurves;	// a power of two of them
+	size_t iCurveCount{ 0 };
+};
+
+/*
+ * The current DealCatalog, for checkouts to take while deltas replace it: a checkout holds the snapshot
+ * it took for as long as it uses it, and apply() publishes a new catalog without waiting for them.
+ * Safe to use from several threads (deltas are applied one at a time).
+ * apply() does work in proportion to the delta: the id sets of retired deals stay in their IdSetPool
+ * until the owner calls IdSetPool::collect() (e.g. from time to time, once old snapshots are released).
+ */
+class CatalogSnapshots
+{
+public:
+	CatalogSnapshots(const std::shared_ptr<const DealCatalog>& aCatalog) : iCurrent(aCatalog) {};
+
+	std::shared_ptr<const DealCatalog> current() const { return std::atomic_load(&iCurrent); };
+
+	// Applies aDelta to the current catalog and publishes the result (false, with the reason in aError,
+	// and nothing published, if the delta does not apply)
+	bool apply(const CatalogDelta& aDelta, std::string& aError, CatalogDeltaStats* aStats = nullptr);
+
+private:
+	std::mutex iWriter;
+	std::shared_ptr<const DealCatalog> iCurrent;
+};
+
+/*
+ * A customer's own deals (e.g. loyalty card offers) on top of the store's DealCatalog.
+ *
+ * Only the customer's deals are indexed (in an index of their own), and the catalog is shared, not copied,
+ * so an overlay per session is cheap. The deals for a basket are the catalog's, then the customer's.
+ * Checkout::solve with an overlay prices as with the catalog: an item with a PriceCurve which one of the
+ * customer's deals also touches is searched instead.
+ * The catalog must outlive the overlay.
+ */
+class DealOverlay
+{
+public:
+	DealOverlay(const DealCatalog& aCatalog, const std::vector<const Deal*>& aDeals) : iCatalog(aCatalog), iIndex(aDeals) {};
+
+	const DealCatalog& catalog() const { return iCatalog; };
+
+	// The customer's deals
+	std::vector<const Deal*> deals() const { return iIndex.deals(); };
+
+	// As DealCatalog::filterDeals, for the catalog's deals and the customer's
+	std::vector<const Deal*> filterDeals(const std::vector<Item>& aItems, int64_t aTime = kAnyTime) const;
+
+	int64_t nextChange(int64_t aTime) const { return std::min(iCatalog.nextChange(aTime), iIndex.nextChange(aTime)); };
+
+private:
+	const DealCatalog& iCatalog;
+	DealIndex iIndex;
+};
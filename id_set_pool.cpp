@@ -0,0 +1,133 @@
+#include "id_set_pool.h"
+
+namespace
+{
+	// A std::set<int> node: the id, the colour, and three pointers (libstdc++)
+	const size_t kSetNodeBytes = 4 * sizeof(void*) + sizeof(int);
+}
+
+IdSet::IdSet(const std::set<int>& aIds) :
+	iSize(aIds.size())
+{
+	// FNV-1a
+	iHash = 14695981039346656037ull;
+	for (int id : aIds)
+	{
+		iHash = (iHash ^ (uint32_t)id) * 1099511628211ull;
+	}
+	if (aIds.empty())
+	{
+		return;
+	}
+
+	iMin = *aIds.begin();
+	iMax = *aIds.rbegin();
+	uint64_t words = ((uint64_t)((int64_t)iMax - iMin) >> 6) + 1;
+	if (words * sizeof(uint64_t) < iSize * sizeof(int))
+	{
+		iBits.resize(words);
+		for (int id : aIds)
+		{
+			uint32_t bit = (uint32_t)id - (uint32_t)iMin;
+			iBits[bit >> 6] |= 1ull << (bit & 63);
+		}
+	}
+	else
+	{
+		iIds.assign(aIds.begin(), aIds.end());
+	}
+}
+
+std::set<int> IdSet::toSet() const
+{
+	std::set<int> ids;
+	forEach([&ids](int aId) { ids.insert(ids.end(), aId); });
+	return ids;
+}
+
+const std::set<int>& IdSet::asSet() const
+{
+	std::call_once(iSetOnce, [this]()
+	{
+		iSet.reset(new std::set<int>(toSet()));
+		iSetBuilt.store(true, std::memory_order_release);
+	});
+	return *iSet;
+}
+
+size_t IdSet::bytes() const
+{
+	return sizeof(IdSet) + iIds.capacity() * sizeof(int) + iBits.capacity() * sizeof(uint64_t)
+		+ (iSetBuilt.load(std::memory_order_acquire) ? iSet->size() * kSetNodeBytes : 0);
+}
+
+bool IdSet::operator==(const IdSet& aOther) const
+{
+	return this == &aOther || (iSize == aOther.iSize && iHash == aOther.iHash &&
+		iMin == aOther.iMin && iMax == aOther.iMax && iIds == aOther.iIds && iBits == aOther.iBits);
+}
+
+IdSetHandle IdSetPool::intern(const std::set<int>& aIds)
+{
+	// (built before looking, so the lock is not held while it is)
+	IdSetHandle set = std::make_shared<const IdSet>(aIds);
+
+	std::lock_guard<std::mutex> lock(iMutex);
+	++iInterned;
+	auto range = iSets.equal_range(set->hash());
+	for (auto iter = range.first; iter != range.second; ++iter)
+	{
+		if (*iter->second == *set)
+		{
+			++iShared;
+			return iter->second;
+		}
+	}
+	iSets.insert(std::make_pair(set->hash(), set));
+	return set;
+}
+
+size_t IdSetPool::collect()
+{
+	std::lock_guard<std::mutex> lock(iMutex);
+	size_t dropped = 0;
+	for (auto iter = iSets.begin(); iter != iSets.end();)
+	{
+		if (iter->second.use_count() == 1)
+		{
+			iter = iSets.erase(iter);
+			++dropped;
+		}
+		else
+		{
+			++iter;
+		}
+	}
+	return dropped;
+}
+
+// (handles copied or released meanwhile on other threads may or may not be counted)
+IdSetPoolStats IdSetPool::stats() const
+{
+	std::lock_guard<std::mutex> lock(iMutex);
+	IdSetPoolStats stats;
+	stats.iSets = iSets.size();
+	stats.iInterned = iInterned;
+	stats.iShared = iShared;
+	for (const auto& entry : iSets)
+	{
+		const IdSet& set = *entry.second;
+		size_t handles = entry.second.use_count() - 1;
+		stats.iHandles += handles;
+		stats.iBytes += set.bytes();
+		stats.iBytesUnshared += std::max(handles, (size_t)1) * set.bytes();
+		stats.iBytesAsStdSets += handles * (sizeof(std::set<int>) + set.size() * kSetNodeBytes);
+	}
+	return stats;
+}
+
+IdSetPool& IdSetPool::shared()
+{
+	static IdSetPool pool;
+	return pool;
+}
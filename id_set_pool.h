@@ -0,0 +1,129 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * An immutable set of item ids, stored as a sorted array, or as a bitmap when that is smaller
+ * (ids close together: a bitmap costs one bit per id in the range, an array 32 bits per id in the set).
+ * Either way count() is a lookup without allocating or chasing pointers
+ * (a bit test, or a binary search of one contiguous array).
+ */
+class IdSet
+{
+public:
+	IdSet(const std::set<int>& aIds);
+
+	size_t count(int aId) const
+	{
+		if (aId < iMin || aId > iMax)
+		{
+			return 0;
+		}
+		if (!iBits.empty())
+		{
+			uint32_t bit = (uint32_t)aId - (uint32_t)iMin;
+			return (iBits[bit >> 6] >> (bit & 63)) & 1;
+		}
+		return std::binary_search(iIds.begin(), iIds.end(), aId) ? 1 : 0;
+	};
+
+	size_t size() const { return iSize; };
+	bool empty() const { return iSize == 0; };
+	bool bitmap() const { return !iBits.empty(); };
+
+	// Calls aVisit(id) for each id, in ascending order
+	template <typename F>
+	void forEach(F aVisit) const
+	{
+		for (int id : iIds)
+		{
+			aVisit(id);
+		}
+		for (size_t word = 0; word < iBits.size(); ++word)
+		{
+			for (uint64_t bits = iBits[word]; bits; bits &= bits - 1)
+			{
+				aVisit((int)((uint32_t)iMin + (uint32_t)(word * 64 + __builtin_ctzll(bits))));
+			}
+		}
+	};
+
+	std::set<int> toSet() const;
+
+	// The ids as a std::set, built on the first call and kept with this set
+	const std::set<int>& asSet() const;
+
+	// Of the ids (not of how they are stored)
+	size_t hash() const { return iHash; };
+
+	// Memory used, including this object
+	size_t bytes() const;
+
+	bool operator==(const IdSet& aOther) const;
+	bool operator!=(const IdSet& aOther) const { return !(*this == aOther); };
+
+private:
+	size_t iSize{ 0 };
+	size_t iHash{ 0 };
+	int iMin{ 1 };		// (an empty set has iMin > iMax)
+	int iMax{ 0 };
+	std::vector<int> iIds;			// sorted (empty for a bitmap)
+	std::vector<uint64_t> iBits;	// bit (id - iMin) set for each id
+	mutable std::once_flag iSetOnce;
+	mutable std::unique_ptr<const std::set<int>> iSet;	// (asSet)
+	mutable std::atomic<bool> iSetBuilt{ false };			// iSet may be read (set once it is built)
+};
+
+typedef std::shared_ptr<const IdSet> IdSetHandle;
+
+struct IdSetPoolStats
+{
+	size_t iSets{ 0 };				// distinct sets in the pool
+	size_t iHandles{ 0 };			// handles to them held outside the pool
+	size_t iBytes{ 0 };				// used by the pool's sets
+	size_t iBytesUnshared{ 0 };		// used if every handle had its own copy
+	size_t iBytesAsStdSets{ 0 };	// (estimated) used if every handle had its own std::set<int>
+	long iInterned{ 0 };			// sets passed to intern()
+	long iShared{ 0 };				// of which were already in the pool
+
+	size_t bytesSaved() const { return iBytesUnshared - iBytes; };
+};
+
+/*
+ * Content addressed pool of IdSets: interning a set returns the pool's handle to a set
+ * with the same ids, adding one if there is none, so deals over the same ids share one copy.
+ *
+ * The pool holds a handle to every set, so sets stay in the pool after their deals are gone,
+ * until collect() drops the ones nothing else holds. Safe to use from several threads.
+ */
+class IdSetPool
+{
+public:
+	IdSetPool() {};
+
+	IdSetPool(const IdSetPool&) = delete;
+	IdSetPool& operator=(const IdSetPool&) = delete;
+
+	IdSetHandle intern(const std::set<int>& aIds);
+
+	// Drops the sets only the pool holds. Returns how many were dropped.
+	size_t collect();
+
+	IdSetPoolStats stats() const;
+
+	// The pool deals intern their sets in by default
+	static IdSetPool& shared();
+
+private:
+	mutable std::mutex iMutex;
+	std::unordered_multimap<size_t, IdSetHandle> iSets;	// by IdSet::hash
+	long iInterned{ 0 };
+	long iShared{ 0 };
+};
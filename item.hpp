@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <set>
 #include <functional>
 
 struct Item
@@ -9,7 +10,7 @@ struct Item
 		iId(aId), iUnitPrice(aUnitPrice), iName(aName)
 	{};
 
-	bool operator==(const Item& other) 
+	bool operator==(const Item& other) const
 	{
 		return other.iId == iId &&
 			other.iUnitPrice == iUnitPrice;
@@ -51,3 +52,44 @@ struct Item
 	int iUnitPrice;
 	std::string iName;
 };
+
+class SelectionCache;
+
+/*
+ * A read-only view of a basket, for Selector::selectLines and Deal::evaluateLines:
+ * the items (one per line) and a mask of the lines deals have already used.
+ * Selectors and deals only look at the lines still available, in order, and report what they match by line.
+ * iCache (optional) shares selector results between the deals evaluated on the same basket (see SelectionCache).
+ */
+struct BasketView
+{
+	BasketView(const Item* aItems, const unsigned char* aConsumed, int aSize, SelectionCache* aCache = nullptr) :
+		iItems(aItems), iConsumed(aConsumed), iSize(aSize), iCache(aCache)
+	{};
+
+	const Item* iItems;
+	const unsigned char* iConsumed;		// non-zero for a line already used
+	int iSize;
+	SelectionCache* iCache;
+
+	bool available(int aLine) const
+	{
+		return !iConsumed[aLine];
+	};
+};
+
+/*
+ * A basket must have at least iCount items matching this (by id, and price if given)
+ * before a deal can apply (see Deal::eligibilityRules).
+ */
+struct ItemCountRule
+{
+	std::set<int> iIds;
+	int iUnitPrice{ -1 };	// -1: any price
+	int iCount{ 1 };
+
+	bool matches(const Item& aItem) const
+	{
+		return iIds.count(aItem.iId) && (iUnitPrice == -1 || iUnitPrice == aItem.iUnitPrice);
+	};
+};
@@ -0,0 +1,233 @@
+#include "item_catalog.h"
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+	const char kMagic[8] = { 'C', 'K', 'I', 'T', 'E', 'M', 'S', '1' };
+
+	struct CatalogHeader
+	{
+		char iMagic[8];
+		uint32_t iCount;
+		uint32_t iSlotCount;
+		uint64_t iSlots;		// offsets from the start of the file
+		uint64_t iIds;
+		uint64_t iPrices;
+		uint64_t iNameOffsets;
+		uint64_t iNames;
+		uint64_t iSize;			// of the whole file
+	};
+
+	static_assert(sizeof(CatalogHeader) == 64, "catalog header layout");
+
+	bool validHeader(const CatalogHeader& aHeader, size_t aFileSize)
+	{
+		uint64_t count = aHeader.iCount;
+		return std::memcmp(aHeader.iMagic, kMagic, sizeof(kMagic)) == 0 &&
+			aHeader.iSize == aFileSize &&
+			aHeader.iSlotCount >= 2 * count && aHeader.iSlotCount > 0 && (aHeader.iSlotCount & (aHeader.iSlotCount - 1)) == 0 &&
+			aHeader.iSlots == sizeof(CatalogHeader) &&
+			aHeader.iIds == aHeader.iSlots + 8 * (uint64_t)aHeader.iSlotCount &&
+			aHeader.iPrices == aHeader.iIds + 4 * count &&
+			aHeader.iNameOffsets == aHeader.iPrices + 4 * count &&
+			aHeader.iNames == aHeader.iNameOffsets + 4 * (count + 1) &&
+			aHeader.iNames <= aFileSize;
+	}
+}
+
+const ItemCatalog::Slot ItemCatalog::kEmptySlot = { 0, 0 };
+
+ItemCatalog::~ItemCatalog()
+{
+	close();
+}
+
+bool ItemCatalog::write(const std::string& aPath, const std::vector<Item>& aItems)
+{
+	CatalogHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.iMagic, kMagic, sizeof(kMagic));
+	header.iCount = (uint32_t)aItems.size();
+	header.iSlotCount = 2;
+	while (header.iSlotCount < 2 * header.iCount)
+	{
+		header.iSlotCount *= 2;
+	}
+
+	std::vector<Slot> slots(header.iSlotCount, kEmptySlot);
+	std::vector<int32_t> ids;
+	std::vector<int32_t> prices;
+	std::vector<uint32_t> nameOffsets{ 0 };
+	std::string names;
+	uint32_t mask = header.iSlotCount - 1;
+	for (const Item& item : aItems)
+	{
+		uint32_t slot = hash(item.iId) & mask;
+		while (slots[slot].iIndex != 0)
+		{
+			if (slots[slot].iId == item.iId)
+			{
+				return false;
+			}
+			slot = (slot + 1) & mask;
+		}
+		ids.push_back(item.iId);
+		prices.push_back(item.iUnitPrice);
+		slots[slot].iId = item.iId;
+		slots[slot].iIndex = (uint32_t)ids.size();
+		names += item.iName;
+		nameOffsets.push_back((uint32_t)names.size());
+	}
+
+	header.iSlots = sizeof(CatalogHeader);
+	header.iIds = header.iSlots + slots.size() * sizeof(Slot);
+	header.iPrices = header.iIds + ids.size() * sizeof(int32_t);
+	header.iNameOffsets = header.iPrices + prices.size() * sizeof(int32_t);
+	header.iNames = header.iNameOffsets + nameOffsets.size() * sizeof(uint32_t);
+	header.iSize = header.iNames + names.size();
+
+	std::string temporary = aPath + ".tmp";
+	FILE* file = std::fopen(temporary.c_str(), "wb");
+	if (!file)
+	{
+		return false;
+	}
+	bool written = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+		std::fwrite(slots.data(), sizeof(Slot), slots.size(), file) == slots.size() &&
+		std::fwrite(ids.data(), sizeof(int32_t), ids.size(), file) == ids.size() &&
+		std::fwrite(prices.data(), sizeof(int32_t), prices.size(), file) == prices.size() &&
+		std::fwrite(nameOffsets.data(), sizeof(uint32_t), nameOffsets.size(), file) == nameOffsets.size() &&
+		std::fwrite(names.data(), 1, names.size(), file) == names.size();
+	written = (std::fclose(file) == 0) && written;
+	if (!written || std::rename(temporary.c_str(), aPath.c_str()) != 0)
+	{
+		std::remove(temporary.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool ItemCatalog::open(const std::string& aPath)
+{
+	close();
+
+	int fd = ::open(aPath.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		return false;
+	}
+	struct stat status;
+	void* data = MAP_FAILED;
+	if (fstat(fd, &status) == 0 && (size_t)status.st_size >= sizeof(CatalogHeader))
+	{
+		data = mmap(nullptr, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	}
+	::close(fd);
+	if (data == MAP_FAILED)
+	{
+		return false;
+	}
+	iData = (const char*)data;
+	iSize = status.st_size;
+
+	CatalogHeader header;
+	std::memcpy(&header, iData, sizeof(header));
+	if (!validHeader(header, iSize))
+	{
+		close();
+		return false;
+	}
+	iCount = header.iCount;
+	iSlotCount = header.iSlotCount;
+	iSlots = (const Slot*)(iData + header.iSlots);
+	iIds = (const int32_t*)(iData + header.iIds);
+	iPrices = (const int32_t*)(iData + header.iPrices);
+	iNameOffsets = (const uint32_t*)(iData + header.iNameOffsets);
+	iNames = iData + header.iNames;
+	if (iNameOffsets[iCount] > iSize - header.iNames || !validTables())
+	{
+		close();
+		return false;
+	}
+	return true;
+}
+
+/*
+ Each item must be in exactly one slot, holding its id: with at least twice as many slots as items, some slots
+ are then empty, so every probe in find() ends. Name offsets must not decrease: with the last within the file,
+ every name is. A pass over the tables when the file is opened, so a corrupt file is refused rather than read out of bounds.
+ */
+bool ItemCatalog::validTables() const
+{
+	std::vector<bool> placed(iCount, false);
+	uint32_t used = 0;
+	for (uint32_t slot = 0; slot < iSlotCount; ++slot)
+	{
+		uint32_t index = iSlots[slot].iIndex;
+		if (index == 0)
+		{
+			continue;
+		}
+		if (index > iCount || placed[index - 1] || iIds[index - 1] != iSlots[slot].iId)
+		{
+			return false;
+		}
+		placed[index - 1] = true;
+		++used;
+	}
+	if (used != iCount)
+	{
+		return false;
+	}
+
+	for (uint32_t index = 0; index < iCount; ++index)
+	{
+		if (iNameOffsets[index] > iNameOffsets[index + 1])
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void ItemCatalog::close()
+{
+	if (iData)
+	{
+		munmap((void*)iData, iSize);
+	}
+	iData = nullptr;
+	iSize = 0;
+	iCount = 0;
+	iSlotCount = 1;
+	iSlots = &kEmptySlot;
+	iIds = nullptr;
+	iPrices = nullptr;
+	iNameOffsets = nullptr;
+	iNames = nullptr;
+}
+
+Item ItemCatalog::item(int aIndex) const
+{
+	size_t length;
+	const char* itemName = name(aIndex, length);
+	return Item(iIds[aIndex], iPrices[aIndex], std::string(itemName, length));
+}
+
+bool ItemCatalog::isCatalog(const std::string& aPath)
+{
+	char magic[sizeof(kMagic)];
+	FILE* file = std::fopen(aPath.c_str(), "rb");
+	if (!file)
+	{
+		return false;
+	}
+	bool catalog = std::fread(magic, sizeof(magic), 1, file) == 1 && std::memcmp(magic, kMagic, sizeof(kMagic)) == 0;
+	std::fclose(file);
+	return catalog;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "item.hpp"
+
+/*
+ * The store's items (id, unit price, name) in a read-only file, for every till process on a server to share.
+ *
+ * Opening the catalog maps the file (mmap), so there is nothing to parse or copy (only a check of the tables, below),
+ * and every process mapping it shares the one copy in the page cache. Looking up an id is a hash table probe in the file
+ * (at most half full, so probes are short), and gives the item's index into the price and name columns.
+ *
+ * File: a 64 byte header, then
+ *   slots:  per slot (a power of two, at least twice the items): int32 id, uint32 index + 1 (0: empty)
+ *   ids:    int32 per item
+ *   prices: int32 per item
+ *   names:  uint32 offset per item, and one more for the end of the last name, then the names (not terminated)
+ * in host byte order (it is shared on one server, not between them).
+ *
+ * A catalog is replaced by writing a new file over it: write() writes a temporary file and renames it,
+ * so processes which have the old one open carry on using it.
+ *
+ * open() checks the whole file once (the header's layout, every slot and name offset), so a truncated or corrupt
+ * file is refused rather than read out of bounds. It does not check the file again while it is mapped.
+ */
+class ItemCatalog
+{
+public:
+	ItemCatalog() {};
+	~ItemCatalog();
+
+	ItemCatalog(const ItemCatalog&) = delete;
+	ItemCatalog& operator=(const ItemCatalog&) = delete;
+
+	// false if aItems repeats an id, or the file could not be written
+	static bool write(const std::string& aPath, const std::vector<Item>& aItems);
+
+	// false if the file could not be mapped, or is not a valid catalog (the catalog is then empty)
+	bool open(const std::string& aPath);
+	void close();
+
+	// The item's index (-1 if there is none)
+	int find(int aId) const
+	{
+		uint32_t mask = iSlotCount - 1;
+		for (uint32_t slot = hash(aId) & mask;; slot = (slot + 1) & mask)
+		{
+			if (iSlots[slot].iIndex == 0)
+			{
+				return -1;
+			}
+			if (iSlots[slot].iId == aId)
+			{
+				return (int)iSlots[slot].iIndex - 1;
+			}
+		}
+	};
+
+	int id(int aIndex) const { return iIds[aIndex]; };
+	int price(int aIndex) const { return iPrices[aIndex]; };
+
+	// Not terminated: the name is aLength characters
+	const char* name(int aIndex, size_t& aLength) const
+	{
+		aLength = iNameOffsets[aIndex + 1] - iNameOffsets[aIndex];
+		return iNames + iNameOffsets[aIndex];
+	};
+
+	// A copy of the item (which allocates its name)
+	Item item(int aIndex) const;
+
+	size_t size() const { return iCount; };
+
+	static bool isCatalog(const std::string& aPath);
+
+private:
+	struct Slot
+	{
+		int32_t iId;
+		uint32_t iIndex;
+	};
+
+	bool validTables() const;
+
+	static uint32_t hash(int aId)
+	{
+		uint32_t hash = (uint32_t)aId * 2654435761u;
+		return hash ^ (hash >> 15);
+	};
+
+	const char* iData{ nullptr };
+	size_t iSize{ 0 };
+
+	uint32_t iCount{ 0 };
+	uint32_t iSlotCount{ 1 };
+	const Slot* iSlots{ &kEmptySlot };
+	const int32_t* iIds{ nullptr };
+	const int32_t* iPrices{ nullptr };
+	const uint32_t* iNameOffsets{ nullptr };
+	const char* iNames{ nullptr };
+
+	static const Slot kEmptySlot;
+};
@@ -0,0 +1,93 @@
+#include "item_taxonomy.h"
+#include <atomic>
+
+namespace
+{
+	std::atomic<int> sNextTaxonomy{ 1 };
+}
+
+ItemTaxonomy::ItemTaxonomy(const std::string& aRootName) :
+	iId(sNextTaxonomy++)
+{
+	Category root;
+	root.iName = aRootName;
+	root.iEnd = 1;
+	iCategories.push_back(root);
+}
+
+int ItemTaxonomy::addCategory(int aParent, const std::string& aName)
+{
+	if (aParent < 0 || aParent >= (int)iCategories.size())
+	{
+		return -1;
+	}
+
+	Category category;
+	category.iParent = aParent;
+	category.iName = aName;
+	iCategories.push_back(category);
+
+	int id = (int)iCategories.size() - 1;
+	iCategories[aParent].iChildren.push_back(id);
+	number();
+	return id;
+}
+
+bool ItemTaxonomy::assign(int aItemId, int aCategory)
+{
+	if (aCategory < 0 || aCategory >= (int)iCategories.size())
+	{
+		return false;
+	}
+	iItems[aItemId] = aCategory;
+	return true;
+}
+
+int ItemTaxonomy::category(int aItemId) const
+{
+	auto find = iItems.find(aItemId);
+	return find == iItems.end() ? -1 : find->second;
+}
+
+bool ItemTaxonomy::inCategory(int aItemId, int aCategory, bool aSubtree) const
+{
+	if (aCategory < 0 || aCategory >= (int)iCategories.size())
+	{
+		return false;
+	}
+	auto find = iItems.find(aItemId);
+	if (find == iItems.end())
+	{
+		return false;
+	}
+	if (!aSubtree)
+	{
+		return find->second == aCategory;
+	}
+	int position = iCategories[find->second].iFirst;
+	const Category& category = iCategories[aCategory];
+	return position >= category.iFirst && position < category.iEnd;
+}
+
+// Items hold their category (not its position), so only the categories are renumbered
+void ItemTaxonomy::number()
+{
+	std::vector<std::pair<int, size_t>> stack{ { kRoot, 0 } };	// <category, next child>
+	int position = 0;
+	iCategories[kRoot].iFirst = position++;
+	while (!stack.empty())
+	{
+		Category& category = iCategories[stack.back().first];
+		if (stack.back().second < category.iChildren.size())
+		{
+			int child = category.iChildren[stack.back().second++];
+			iCategories[child].iFirst = position++;
+			stack.push_back(std::make_pair(child, (size_t)0));
+		}
+		else
+		{
+			category.iEnd = position;
+			stack.pop_back();
+		}
+	}
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+/*
+ * The store's category tree (e.g. All > Food > Sandwiches > Chicken) and the category of each item id.
+ *
+ * Categories are numbered in preorder (a category, then everything below it), so a category and everything
+ * below it are one interval of those numbers [first, end). Each item id is filed under one category, so
+ * "is this item in this category, or anywhere below it" is a lookup of the item and a comparison, however big the category.
+ *
+ * Category selectors (see CategorySelector) look items up when a basket is checked, so items (and categories)
+ * added later are matched by the deals which already exist. Not to be changed while checkouts are using it.
+ */
+class ItemTaxonomy
+{
+public:
+	static const int kRoot = 0;
+
+	ItemTaxonomy(const std::string& aRootName = "All");
+
+	ItemTaxonomy(const ItemTaxonomy&) = delete;
+	ItemTaxonomy& operator=(const ItemTaxonomy&) = delete;
+
+	// Returns the new category (-1 if aParent is not a category)
+	int addCategory(int aParent, const std::string& aName);
+
+	// Files item aItemId under aCategory (moving it, if it was filed already). Returns false if aCategory is not a category.
+	bool assign(int aItemId, int aCategory);
+
+	// The category aItemId is filed under (-1 if none)
+	int category(int aItemId) const;
+
+	// aItemId is filed under aCategory (or, for aSubtree, under aCategory or anything below it).
+	// false if aCategory is not a category (e.g. a failed addCategory's -1).
+	bool inCategory(int aItemId, int aCategory, bool aSubtree = true) const;
+
+	int parent(int aCategory) const { return iCategories[aCategory].iParent; };
+	const std::string& name(int aCategory) const { return iCategories[aCategory].iName; };
+
+	// aCategory's position in preorder (the path id items are compared by)
+	int path(int aCategory) const { return iCategories[aCategory].iFirst; };
+
+	size_t categoryCount() const { return iCategories.size(); };
+	size_t itemCount() const { return iItems.size(); };
+
+	// Different for every taxonomy (for Selector::signature)
+	int id() const { return iId; };
+
+private:
+	struct Category
+	{
+		int iParent{ -1 };
+		std::string iName;
+		std::vector<int> iChildren;
+		int iFirst{ 0 };	// this category's preorder position
+		int iEnd{ 0 };		// after the last category below it
+	};
+
+	void number();
+
+	int iId;
+	std::vector<Category> iCategories;
+	std::unordered_map<int, int> iItems;	// <item id, category>
+};
@@ -5,6 +5,8 @@
 #include <sstream>
 #include <vector>
 #include <memory>
+#include <cstdio>
+#include <cstring>
 
 /*
  * This file contains the Model Deals, that is,
@@ -37,6 +39,15 @@ std::string BuyInSetOfXCheapestFree::name() const
 	return "Buy" + std::to_string(iTargetCount) + "GetCheapestFree";
 }
 
+// As name(), formatted on the stack
+size_t BuyInSetOfXCheapestFree::writeName(char* aBuffer, size_t aSize) const
+{
+	char name[64];
+	int length = std::snprintf(name, sizeof(name), "Buy%dGetCheapestFree", iTargetCount);
+	std::memcpy(aBuffer, name, std::min(aSize, (size_t)length));
+	return length;
+}
+
 std::vector<std::pair<Item, int>> BuyInSetOfXCheapestFree::evaluate(std::vector<Item>& aInput) const
 {
 	std::vector<std::pair<Item, int>> result;
@@ -44,7 +55,11 @@ std::vector<std::pair<Item, int>> BuyInSetOfXCheapestFree::evaluate(std::vector<
 
 	std::vector<Item> sorted = aInput;
 
-	std::sort(sorted.begin(), sorted.end(), [](const Item& item, const Item& other) { return item.iUnitPrice < other.iUnitPrice; });
+	// (items at the same price in id order, so the result does not depend on the order of aInput)
+	std::sort(sorted.begin(), sorted.end(), [](const Item& item, const Item& other)
+	{
+		return item.iUnitPrice < other.iUnitPrice || (item.iUnitPrice == other.iUnitPrice && item.iId < other.iId);
+	});
 
 	// iTargetSet
 	for (Item& item : sorted)
@@ -54,7 +69,7 @@ std::vector<std::pair<Item, int>> BuyInSetOfXCheapestFree::evaluate(std::vector<
 			break;
 		}
 
-		if (iInputSet.count(item.iId))
+		if (iInputSet->count(item.iId))
 		{
 			valid.push_back(item);
 		}
@@ -75,6 +90,40 @@ std::vector<std::pair<Item, int>> BuyInSetOfXCheapestFree::evaluate(std::vector<
 	return result;
 }
 
+/*
+ As evaluate(): the cheapest iTargetCount lines in the set, the first of them free.
+ (ties broken by id, then by line, so of equal items the first available is used, as the search always removed)
+ The candidates are sorted in aResult, so nothing is allocated once it has grown.
+ */
+void BuyInSetOfXCheapestFree::evaluateLines(const BasketView& aBasket, std::vector<LinePrice>& aResult) const
+{
+	aResult.clear();
+	for (int line = 0; line < aBasket.iSize; ++line)
+	{
+		if (aBasket.available(line) && iInputSet->count(aBasket.iItems[line].iId))
+		{
+			aResult.push_back(LinePrice(line, aBasket.iItems[line].iUnitPrice));
+		}
+	}
+
+	if (iTargetCount <= 0 || (int)aResult.size() < iTargetCount)
+	{
+		aResult.clear();
+		return;
+	}
+
+	const Item* items = aBasket.iItems;
+	std::partial_sort(aResult.begin(), aResult.begin() + iTargetCount, aResult.end(), [items](const LinePrice& aLine, const LinePrice& aOther)
+	{
+		const Item& item = items[aLine.first];
+		const Item& other = items[aOther.first];
+		return item.iUnitPrice < other.iUnitPrice || (item.iUnitPrice == other.iUnitPrice &&
+			(item.iId < other.iId || (item.iId == other.iId && aLine.first < aOther.first)));
+	});
+	aResult.resize(iTargetCount);
+	aResult[0].second = 0;
+}
+
 bool BuyInSetOfXCheapestFree::selectsOn(const Item & aItem) const
 {
 	return targets(aItem);
@@ -82,12 +131,26 @@ bool BuyInSetOfXCheapestFree::selectsOn(const Item & aItem) const
 
 bool BuyInSetOfXCheapestFree::targets(const Item & aItem) const
 {
-	if (iInputSet.count(aItem.iId))
+	if (iInputSet->count(aItem.iId))
 		return true;
 
 	return false;
 }
 
+bool BuyInSetOfXCheapestFree::coveredIds(std::set<int>& aIds) const
+{
+	iInputSet->forEach([&aIds](int aId) { aIds.insert(aId); });
+	return true;
+}
+
+void BuyInSetOfXCheapestFree::eligibilityRules(std::vector<ItemCountRule>& aRules) const
+{
+	ItemCountRule rule;
+	rule.iIds = iInputSet->asSet();
+	rule.iCount = iTargetCount;
+	aRules.push_back(rule);
+}
+
 std::string BuyAofXGetBofYForZ::name() const
 {
 	return "Buy" + std::to_string(iSelectionCount) + "Of" + std::to_string(iSelectionId) +
@@ -95,6 +158,15 @@ std::string BuyAofXGetBofYForZ::name() const
 		"For" + std::to_string(iTargetUnitPrice) + "UnitPrice";
 }
 
+size_t BuyAofXGetBofYForZ::writeName(char* aBuffer, size_t aSize) const
+{
+	char name[96];
+	int length = std::snprintf(name, sizeof(name), "Buy%dOf%dGet%dOf%dFor%dUnitPrice",
+		iSelectionCount, iSelectionId, iTargetCount, iTargetId, iTargetUnitPrice);
+	std::memcpy(aBuffer, name, std::min(aSize, (size_t)length));
+	return length;
+}
+
 bool BuyAofXGetBofYForZ::selectsOn(const Item & aItem) const
 {
 	if (iSelectionId == aItem.iId)
@@ -111,6 +183,34 @@ bool BuyAofXGetBofYForZ::targets(const Item & aItem) const
 	return false;
 }
 
+bool BuyAofXGetBofYForZ::coveredIds(std::set<int>& aIds) const
+{
+	aIds.insert(iSelectionId);
+	aIds.insert(iTargetId);
+	return true;
+}
+
+void BuyAofXGetBofYForZ::eligibilityRules(std::vector<ItemCountRule>& aRules) const
+{
+	ItemCountRule selection;
+	selection.iIds.insert(iSelectionId);
+	selection.iCount = iSelectionCount;
+
+	// Targets also count as selections when the ids are the same
+	if (iSelectionId == iTargetId)
+	{
+		selection.iCount = std::max(iSelectionCount, iTargetCount);
+		aRules.push_back(selection);
+		return;
+	}
+
+	ItemCountRule target;
+	target.iIds.insert(iTargetId);
+	target.iCount = iTargetCount;
+	aRules.push_back(selection);
+	aRules.push_back(target);
+}
+
 std::vector<std::pair<Item, int>> BuyAofXGetBofYForZ::evaluate(std::vector<Item>& aInput) const
 {
 	auto result = std::vector<std::pair<Item, int>>();
@@ -169,7 +269,50 @@ std::vector<std::pair<Item, int>> BuyAofXGetBofYForZ::evaluate(std::vector<Item>
 	return result;
 }
 
-std::string BuyAofXGetBofYForZ::serialise()
+// As evaluate(), by line
+void BuyAofXGetBofYForZ::evaluateLines(const BasketView& aBasket, std::vector<LinePrice>& aResult) const
+{
+	aResult.clear();
+
+	int targetCount = 0;
+	int selectionCount = 0;
+	for (int line = 0; line < aBasket.iSize; ++line)
+	{
+		if (targetCount >= iTargetCount && selectionCount >= iSelectionCount)
+		{
+			break;
+		}
+		if (!aBasket.available(line))
+		{
+			continue;
+		}
+
+		const Item& item = aBasket.iItems[line];
+		if (item.iId == iTargetId && targetCount < iTargetCount)
+		{
+			aResult.push_back(LinePrice(line, iTargetUnitPrice));
+			targetCount++;
+			if (iTargetId == iSelectionId)
+			{
+				++selectionCount;
+			}
+			continue;
+		}
+
+		if (item.iId == iSelectionId && selectionCount < iSelectionCount)
+		{
+			aResult.push_back(LinePrice(line, item.iUnitPrice));
+			++selectionCount;
+		}
+	}
+
+	if (targetCount < iTargetCount || selectionCount < iSelectionCount)
+	{
+		aResult.clear();
+	}
+}
+
+std::string BuyAofXGetBofYForZ::serialise() const
 {
 	std::string serial;
 	serial += std::to_string(((int)EBuyAofXGetBofYFZ)) + " "
@@ -197,16 +340,13 @@ BuyAofXGetBofYForZ* BuyAofXGetBofYForZ::deserialise(std::string aData)
 }
 
 
-std::string BuyInSetOfXCheapestFree::serialise()
+std::string BuyInSetOfXCheapestFree::serialise() const
 {
 	std::string serial;
 	serial += std::to_string(((int)EBuyInSetOfXCheapestFree)) + " "
 		+ std::to_string(iTargetCount);
 
-	for (int id : iInputSet)
-	{
-		serial += " " + std::to_string(id);
-	}
+	iInputSet->forEach([&serial](int aId) { serial += " " + std::to_string(aId); });
 	return serial;
 }
 
@@ -225,7 +365,7 @@ BuyInSetOfXCheapestFree* BuyInSetOfXCheapestFree::deserialise(std::string aData)
 
 const std::set<int>& BuyInSetOfXCheapestFree::selection() const
 {
-	return iInputSet;
+	return iInputSet->asSet();
 }
 
 int BuyInSetOfXCheapestFree::targetCount() const
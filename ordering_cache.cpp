@@ -0,0 +1,223 @@
+#include "ordering_cache.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+/*
+ * SmartDeals do not serialise, so their key is made from their selectors' signatures (Selector::signature)
+ * and deal prices. A selector without a signature adds nothing, so SmartDeals differing only in such selectors share a key.
+ */
+std::string OrderingCache::dealKey(const Deal* aDeal)
+{
+	std::string key = aDeal->name() + "|" + aDeal->serialise();
+
+	const SmartDeal* smart = dynamic_cast<const SmartDeal*>(aDeal);
+	if (smart)
+	{
+		std::vector<int> signature;
+		for (DealSelector* selector : smart->dealSelectors().selectors())
+		{
+			key += selector->strict() ? "|s" : "|o";
+			key += " " + std::to_string(std::get<2>(selector->iSelector));
+			for (Selector* part : { std::get<0>(selector->iSelector), std::get<1>(selector->iSelector) })
+			{
+				signature.clear();
+				key += (part && part->signature(signature)) ? " :" : " ?";
+				for (int value : signature)
+				{
+					key += " " + std::to_string(value);
+				}
+			}
+		}
+	}
+	return key;
+}
+
+/*
+ * The signature is independent of the order the deals were given in.
+ */
+std::string OrderingCache::signature(std::vector<std::string> aKeys)
+{
+	std::sort(aKeys.begin(), aKeys.end());
+
+	std::string result;
+	for (std::string& key : aKeys)
+	{
+		result += key + "\n";
+	}
+	return result;
+}
+
+size_t OrderingCache::size() const
+{
+	std::lock_guard<std::mutex> lock(iMutex);
+	return iEntries.size();
+}
+
+long OrderingCache::hits() const
+{
+	std::lock_guard<std::mutex> lock(iMutex);
+	return iHits;
+}
+
+long OrderingCache::misses() const
+{
+	std::lock_guard<std::mutex> lock(iMutex);
+	return iMisses;
+}
+
+double OrderingCache::hitRate() const
+{
+	std::lock_guard<std::mutex> lock(iMutex);
+	long lookups = iHits + iMisses;
+	return (lookups == 0) ? 0.0 : (double)iHits / lookups;
+}
+
+bool OrderingCache::lookup(const std::vector<const Deal*>& aDeals, std::vector<int>& aOrdering)
+{
+	std::vector<std::string> keys;
+	for (const Deal* deal : aDeals)
+	{
+		keys.push_back(dealKey(deal));
+	}
+	std::string key = signature(keys);
+
+	std::lock_guard<std::mutex> lock(iMutex);
+	auto find = iIndex.find(key);
+	if (find == iIndex.end())
+	{
+		++iMisses;
+		return false;
+	}
+
+	// Most recently used to the front
+	iEntries.splice(iEntries.begin(), iEntries, find->second);
+
+	// Map deal keys back to positions in aDeals.
+	// (Deals may share a key, so each position can only be used once)
+	std::vector<bool> used(aDeals.size(), false);
+	aOrdering.clear();
+	for (const std::string& key : find->second->second)
+	{
+		for (int i = 0; i < keys.size(); ++i)
+		{
+			if (!used[i] && keys[i] == key)
+			{
+				used[i] = true;
+				aOrdering.push_back(i);
+				break;
+			}
+		}
+	}
+
+	++iHits;
+	return true;
+}
+
+void OrderingCache::store(const std::vector<const Deal*>& aDeals, const std::vector<int>& aOrdering)
+{
+	std::vector<std::string> keys;
+	for (const Deal* deal : aDeals)
+	{
+		keys.push_back(dealKey(deal));
+	}
+
+	std::vector<std::string> ordering;
+	for (int i : aOrdering)
+	{
+		ordering.push_back(keys[i]);
+	}
+	std::string key = signature(keys);
+
+	std::lock_guard<std::mutex> lock(iMutex);
+	insert(key, ordering);
+}
+
+void OrderingCache::insert(const std::string& aSignature, const std::vector<std::string>& aOrdering)
+{
+	auto find = iIndex.find(aSignature);
+	if (find != iIndex.end())
+	{
+		find->second->second = aOrdering;
+		iEntries.splice(iEntries.begin(), iEntries, find->second);
+		return;
+	}
+
+	if (iCapacity == 0)
+	{
+		return;
+	}
+
+	// Evict least recently used
+	if (iEntries.size() >= iCapacity)
+	{
+		iIndex.erase(iEntries.back().first);
+		iEntries.pop_back();
+	}
+
+	iEntries.push_front(std::make_pair(aSignature, aOrdering));
+	iIndex[aSignature] = iEntries.begin();
+}
+
+bool OrderingCache::save(const std::string& aPath) const
+{
+	std::ofstream file(aPath);
+	if (!file)
+	{
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(iMutex);
+
+	// Write least recently used first, so loading restores the recency order
+	for (auto it = iEntries.rbegin(); it != iEntries.rend(); ++it)
+	{
+		file << it->second.size() << "\n";
+		for (const std::string& key : it->second)
+		{
+			file << key << "\n";
+		}
+	}
+	return (bool)file;
+}
+
+bool OrderingCache::load(const std::string& aPath)
+{
+	std::ifstream file(aPath);
+	if (!file)
+	{
+		return false;
+	}
+
+	std::string line;
+	while (std::getline(file, line))
+	{
+		if (line.empty())
+		{
+			continue;
+		}
+
+		// (a corrupt file is refused, not thrown on)
+		std::istringstream header(line);
+		int count;
+		if (!(header >> count) || count < 0 || !(header >> std::ws).eof())
+		{
+			return false;
+		}
+
+		std::vector<std::string> ordering;
+		for (int i = 0; i < count && std::getline(file, line); ++i)
+		{
+			ordering.push_back(line);
+		}
+
+		if (ordering.size() != count)
+		{
+			return false; // truncated file
+		}
+
+		std::lock_guard<std::mutex> lock(iMutex);
+		insert(signature(ordering), ordering);
+	}
+	return true;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+#include "deal.h"
+
+/*
+ * Remembers the best deal ordering found for a set of (filtered) deals.
+ *
+ * The set of deals which apply to a basket tends to repeat, and so does the winning ordering.
+ * Evaluating the remembered ordering first gives the search a tight total to beat straight away.
+ *
+ * Entries are keyed by a signature built from the deals themselves (name and serialised form,
+ * or for SmartDeals their selectors' signatures, see dealKey), so the cache can be saved to disk and loaded by a restarted till.
+ * load() returns false for a corrupt or truncated file (entries before the fault are kept).
+ * The cache is bounded, the least recently used entry is dropped when full.
+ * It can be shared by checkouts running on several threads.
+ */
+class OrderingCache
+{
+public:
+	OrderingCache(size_t aCapacity = 1024) : iCapacity(aCapacity) {};
+
+	// Look up the best known ordering of aDeals (as positions in aDeals)
+	bool lookup(const std::vector<const Deal*>& aDeals, std::vector<int>& aOrdering);
+
+	// Record the best ordering of aDeals (as positions in aDeals)
+	void store(const std::vector<const Deal*>& aDeals, const std::vector<int>& aOrdering);
+
+	size_t size() const;
+	size_t capacity() const { return iCapacity; };
+
+	long hits() const;
+	long misses() const;
+	double hitRate() const;
+
+	// One entry per block: number of deals, followed by one deal key per line (in the best order)
+	bool save(const std::string& aPath) const;
+	bool load(const std::string& aPath);
+
+	// Identifies a deal across processes
+	static std::string dealKey(const Deal* aDeal);
+
+private:
+	static std::string signature(std::vector<std::string> aKeys);
+	void insert(const std::string& aSignature, const std::vector<std::string>& aOrdering); // (iMutex held)
+
+	// <signature, ordering as deal keys>, most recently used first
+	typedef std::list<std::pair<std::string, std::vector<std::string>>> Entries;
+
+	mutable std::mutex iMutex;
+
+	size_t iCapacity;
+	Entries iEntries;
+	std::unordered_map<std::string, Entries::iterator> iIndex;
+
+	long iHits{ 0 };
+	long iMisses{ 0 };
+};
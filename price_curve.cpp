@@ -0,0 +1,207 @@
+#include "price_curve.h"
+#include <algorithm>
+#include <limits>
+
+/*
+ * Let r be the best price per unit of any bundle. An ordering starting with a bundle of that value (one of "best")
+ * costs at most n * r + M, where M is the most the rest of it costs for what is left over (fewer units than the bundle).
+ * An ordering starting with bundle b (units u, cost c) of worse value costs at least (n - u + 1) * c / u,
+ * which is more than n * r + M once n (c - r * u) > u * M + (u - 1) * c. Past that bound only the best orderings can win,
+ * and each of those costs period * r more for period (the lcm of the best bundles' units) more units,
+ * so the cheapest ordering repeats with that period.
+ */
+PriceCurve::PriceCurve(int aUnitPrice, const std::vector<SingleItemBundle>& aBundles)
+	: iUnitPrice(aUnitPrice), iBundles(aBundles)
+{
+	if (iBundles.size() > kMaxBundles)
+	{
+		iBundles.resize(kMaxBundles);
+	}
+
+	int count = iBundles.size();
+	std::vector<unsigned char> ordering;
+	for (int b = 0; b < count; ++b)
+	{
+		ordering.push_back(b);
+	}
+	do
+	{
+		iOrderings.insert(iOrderings.end(), ordering.begin(), ordering.end());
+	} while (std::next_permutation(ordering.begin(), ordering.end()));
+	int orderings = count ? iOrderings.size() / count : 1;
+
+	if (count == 0)
+	{
+		iPrices.push_back(0);
+		iBest.push_back(0);
+		iPeriod = 1;
+		iPeriodCost = iUnitPrice;
+		return;
+	}
+
+	// The best value (cost / units), and the lcm of the units of the bundles with it
+	long bestUnits = iBundles[0].iUnits;
+	long bestCost = iBundles[0].cost(iUnitPrice);
+	for (const SingleItemBundle& bundle : iBundles)
+	{
+		if ((long)bundle.cost(iUnitPrice) * bestUnits < bestCost * bundle.iUnits)
+		{
+			bestUnits = bundle.iUnits;
+			bestCost = bundle.cost(iUnitPrice);
+		}
+	}
+	auto best = [&](int aBundle) { return (long)iBundles[aBundle].cost(iUnitPrice) * bestUnits == bestCost * iBundles[aBundle].iUnits; };
+
+	long period = 1;
+	for (int b = 0; b < count; ++b)
+	{
+		if (best(b))
+		{
+			long a = period;
+			long c = iBundles[b].iUnits;
+			while (c)
+			{
+				long r = a % c;
+				a = c;
+				c = r;
+			}
+			period = period / a * iBundles[b].iUnits;
+		}
+	}
+
+	// M: the most the rest of a best ordering costs for its leftover units
+	long leftover = 0;
+	for (int o = 0; o < orderings; ++o)
+	{
+		const unsigned char* order = &iOrderings[o * count];
+		if (!best(order[0]))
+		{
+			continue;
+		}
+		for (int units = 1; units < iBundles[order[0]].iUnits; ++units)
+		{
+			leftover = std::max(leftover, (long)orderingPrice(o, units, nullptr));
+		}
+	}
+
+	// The bound, times bestUnits on both sides
+	long start = 0;
+	for (const SingleItemBundle& bundle : iBundles)
+	{
+		long units = bundle.iUnits;
+		long cost = bundle.cost(iUnitPrice);
+		long worse = cost * bestUnits - bestCost * units;
+		if (worse > 0)
+		{
+			start = std::max(start, (units * leftover * bestUnits + (units - 1) * cost * bestUnits) / worse + 1);
+		}
+	}
+
+	// (while the table is built, iPeriod is 0 so bestOrdering tries every ordering)
+	long size = std::min(start + period, (long)kMaxTableSize);
+	for (int n = 0; n < size; ++n)
+	{
+		int price;
+		iBest.push_back(bestOrdering(n, price));
+		iPrices.push_back(price);
+	}
+
+	if (start + period <= kMaxTableSize)
+	{
+		iPeriodStart = start;
+		iPeriod = period;
+		iPeriodCost = period / bestUnits * bestCost;
+	}
+}
+
+int PriceCurve::orderingPrice(int aOrdering, int aUnits, std::vector<int>* aChoices) const
+{
+	int count = iBundles.size();
+	const unsigned char* order = count ? &iOrderings[aOrdering * count] : nullptr;
+	int total = 0;
+	for (int b = 0; b < count; ++b)
+	{
+		const SingleItemBundle& bundle = iBundles[order[b]];
+		int repeats = aUnits / bundle.iUnits;
+		total += repeats * bundle.cost(iUnitPrice);
+		aUnits -= repeats * bundle.iUnits;
+		if (aChoices)
+		{
+			aChoices->insert(aChoices->end(), repeats, order[b]);
+		}
+	}
+
+	if (aChoices)
+	{
+		aChoices->insert(aChoices->end(), aUnits, -1);
+	}
+	return total + aUnits * iUnitPrice;
+}
+
+int PriceCurve::bestOrdering(int aUnits, int& aPrice) const
+{
+	if (aUnits < iPrices.size())
+	{
+		aPrice = iPrices[aUnits];
+		return iBest[aUnits];
+	}
+
+	if (iPeriod > 0)
+	{
+		int repeats = (aUnits - iPeriodStart) / iPeriod;
+		aPrice = iPrices[aUnits - repeats * iPeriod] + repeats * iPeriodCost;
+		return iBest[aUnits - repeats * iPeriod];
+	}
+
+	int orderings = iBundles.empty() ? 1 : iOrderings.size() / iBundles.size();
+	int best = 0;
+	aPrice = std::numeric_limits<int>::max();
+	for (int o = 0; o < orderings; ++o)
+	{
+		int price = orderingPrice(o, aUnits, nullptr);
+		if (price < aPrice)
+		{
+			aPrice = price;
+			best = o;
+		}
+	}
+	return best;
+}
+
+int PriceCurve::price(int aUnits) const
+{
+	int price;
+	bestOrdering(aUnits, price);
+	return price;
+}
+
+int PriceCurve::priceItems(const std::vector<Item>& aItems, std::vector<std::tuple<const Deal*, Item, int>>& aLines) const
+{
+	// (bundles first, as the deals take them, then the items at full price)
+	int price;
+	std::vector<int> used;
+	orderingPrice(bestOrdering(aItems.size(), price), aItems.size(), &used);
+
+	int total = 0;
+	int next = 0;
+	for (int choice : used)
+	{
+		if (choice == -1)
+		{
+			const Item& item = aItems[next++];
+			aLines.push_back(std::make_tuple(nullptr, item, item.iUnitPrice));
+			total += item.iUnitPrice;
+			continue;
+		}
+
+		const SingleItemBundle& bundle = iBundles[choice];
+		for (int u = 0; u < bundle.iUnits; ++u)
+		{
+			const Item& item = aItems[next++];
+			int unitPrice = (u < bundle.iDealUnits) ? bundle.iDealUnitPrice : item.iUnitPrice;
+			aLines.push_back(std::make_tuple(bundle.iDeal, item, unitPrice));
+			total += unitPrice;
+		}
+	}
+	return total;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <vector>
+#include <tuple>
+
+#include "deal_analysis.h"
+
+/*
+ * The price of n units of one item, for items only affected by single item deals.
+ *
+ * The search applies each deal until it no longer matches, then the next, so with these deals n units cost
+ *   price(n) = min over the orderings of the bundles of: each bundle as often as it fits, in order, then the rest at the unit price
+ * (A cheaper split of n into bundles may exist, e.g. 11 units at 100 with "5 for 400" and "3 for 210": 5 + 3 + 3 is 820,
+ * but no ordering of the deals reaches it, so the price is 830.)
+ *
+ * Computed once (when the DealCatalog is loaded): the price and cheapest ordering for each n up to a bound,
+ * past which the orderings starting with the best value bundle always win, so the curve is periodic:
+ *   price(n + period) = price(n) + periodCost
+ * (If that bound is very large, the orderings are priced at each call past the end of the table instead.)
+ *
+ * The orderings grow as (bundles)!, so the catalog only gives curves to items with at most kMaxBundles deals.
+ */
+class PriceCurve
+{
+public:
+	static const int kMaxBundles = 4;
+	static const int kMaxTableSize = 1024;
+
+	PriceCurve() {};
+	PriceCurve(int aUnitPrice, const std::vector<SingleItemBundle>& aBundles);
+
+	int unitPrice() const { return iUnitPrice; };
+	const std::vector<SingleItemBundle>& bundles() const { return iBundles; };
+	int price(int aUnits) const;
+
+	// Price aItems (all the same item, at unitPrice()), adding a receipt line <Deal, Item, price> per item
+	int priceItems(const std::vector<Item>& aItems, std::vector<std::tuple<const Deal*, Item, int>>& aLines) const;
+
+	size_t tableSize() const { return iPrices.size(); };
+	int period() const { return iPeriod; };		// 0: no periodic tail
+	int periodCost() const { return iPeriodCost; };
+
+private:
+	// The price of ordering aOrdering (an index into iOrderings) for aUnits,
+	// and (if aChoices) the bundles it uses, in order (-1 for a unit at its full price)
+	int orderingPrice(int aOrdering, int aUnits, std::vector<int>* aChoices) const;
+
+	// The cheapest ordering for aUnits (and its price in aPrice)
+	int bestOrdering(int aUnits, int& aPrice) const;
+
+	int iUnitPrice{ 0 };
+	std::vector<SingleItemBundle> iBundles;
+	std::vector<unsigned char> iOrderings;	// every ordering of the bundles, iBundles.size() entries each
+
+	std::vector<int> iPrices;				// price(n) for n < tableSize()
+	std::vector<unsigned char> iBest;		// the cheapest ordering for n
+
+	int iPeriodStart{ 0 };					// price(n + iPeriod) == price(n) + iPeriodCost for n >= iPeriodStart
+	int iPeriod{ 0 };
+	int iPeriodCost{ 0 };
+};
@@ -0,0 +1,279 @@
+#include "receipt_writer.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+void BufferSink::write(const char* aData, size_t aSize)
+{
+	size_t size = std::min(aSize, iCapacity - iSize);
+	std::memcpy(iBuffer + iSize, aData, size);
+	iSize += size;
+	iOverflowed = iOverflowed || size < aSize;
+}
+
+namespace
+{
+	const int kHeadingLength = 7;	// "RECEIPT"
+
+	// Writes aValue in decimal, returns its length (aBuffer needs 12 characters)
+	int formatInt(char* aBuffer, int aValue)
+	{
+		char digits[12];
+		int length = 0;
+		long long value = aValue;
+		bool negative = value < 0;
+		if (negative)
+		{
+			value = -value;
+		}
+
+		do
+		{
+			digits[length++] = '0' + value % 10;
+			value /= 10;
+		} while (value > 0);
+
+		int size = 0;
+		if (negative)
+		{
+			aBuffer[size++] = '-';
+		}
+		while (length > 0)
+		{
+			aBuffer[size++] = digits[--length];
+		}
+		return size;
+	}
+
+	// Right align aText in aLine (of aWidth characters), keeping to the line
+	void placeRight(char* aLine, int aWidth, const char* aText, int aLength)
+	{
+		int length = std::min(aLength, aWidth);
+		std::memcpy(aLine + aWidth - length, aText, length);
+	}
+
+	void writeInt(ReceiptSink& aSink, int aValue)
+	{
+		char buffer[12];
+		aSink.write(buffer, formatInt(buffer, aValue));
+	}
+
+	void writeText(ReceiptSink& aSink, const char* aText)
+	{
+		aSink.write(aText, std::strlen(aText));
+	}
+
+	// As a JSON string (with quotes)
+	void writeJsonString(ReceiptSink& aSink, const char* aText, size_t aLength)
+	{
+		aSink.write("\"", 1);
+		size_t start = 0;
+		for (size_t c = 0; c < aLength; ++c)
+		{
+			unsigned char character = aText[c];
+			if (character != '"' && character != '\\' && character >= 0x20)
+			{
+				continue;
+			}
+
+			aSink.write(aText + start, c - start);
+			start = c + 1;
+
+			char escape[6] = { '\\', (char)character, 0, 0, 0, 0 };
+			if (character < 0x20)
+			{
+				const char* hex = "0123456789abcdef";
+				escape[1] = 'u';
+				escape[2] = '0';
+				escape[3] = '0';
+				escape[4] = hex[character >> 4];
+				escape[5] = hex[character & 0xf];
+				aSink.write(escape, 6);
+			}
+			else
+			{
+				aSink.write(escape, 2);
+			}
+		}
+		aSink.write(aText + start, aLength - start);
+		aSink.write("\"", 1);
+	}
+
+	template <typename T>
+	char* put(char* aRecord, T aValue)
+	{
+		std::memcpy(aRecord, &aValue, sizeof(aValue));
+		return aRecord + sizeof(aValue);
+	}
+}
+
+constexpr int ReceiptWriter::kMaxWidth;
+
+ReceiptWriter::ReceiptWriter(ReceiptSink& aSink, ReceiptFormat aFormat, int aWidth) :
+	iSink(aSink), iFormat(aFormat), iWidth(std::max(kHeadingLength, std::min(aWidth, kMaxWidth)))
+{
+}
+
+void ReceiptWriter::begin()
+{
+	iFirstLine = true;
+	if (iFormat == EReceiptJson)
+	{
+		writeText(iSink, "{\"lines\":[");
+	}
+	else if (iFormat == EReceiptText)
+	{
+		char line[kMaxWidth + 1];
+		int fill = (iWidth - kHeadingLength) / 2;
+		std::memset(line, ' ', fill);
+		std::memcpy(line + fill, "RECEIPT", kHeadingLength);
+		std::memset(line + fill + kHeadingLength, ' ', fill);
+		line[2 * fill + kHeadingLength] = '\n';
+		iSink.write(line, 2 * fill + kHeadingLength + 1);
+
+		std::memset(line, '-', iWidth);
+		line[iWidth] = '\n';
+		iSink.write(line, iWidth + 1);
+	}
+}
+
+void ReceiptWriter::line(const Checkout::ReceiptLine& aLine)
+{
+	switch (iFormat)
+	{
+		case EReceiptText: textLine(aLine); break;
+		case EReceiptJson: jsonLine(aLine); break;
+		case EReceiptBinary: binaryLine(aLine); break;
+	}
+	iFirstLine = false;
+}
+
+void ReceiptWriter::end(int aTotal)
+{
+	if (iFormat == EReceiptJson)
+	{
+		writeText(iSink, "],\"total\":");
+		writeInt(iSink, aTotal);
+		writeText(iSink, "}\n");
+	}
+	else if (iFormat == EReceiptBinary)
+	{
+		char record[1 + sizeof(int32_t)];
+		put<int32_t>(put<uint8_t>(record, 2), aTotal);
+		iSink.write(record, sizeof(record));
+	}
+	else
+	{
+		char line[kMaxWidth + 1];
+		std::memset(line, '-', iWidth);
+		line[iWidth] = '\n';
+		iSink.write(line, iWidth + 1);
+
+		char total[12];
+		std::memset(line, ' ', iWidth);
+		std::memcpy(line, "Total:", std::min(6, iWidth));
+		placeRight(line, iWidth, total, formatInt(total, aTotal));
+		iSink.write(line, iWidth + 1);
+	}
+}
+
+void ReceiptWriter::write(const std::vector<Checkout::ReceiptLine>& aLines, int aTotal)
+{
+	begin();
+	for (const Checkout::ReceiptLine& receiptLine : aLines)
+	{
+		line(receiptLine);
+	}
+	end(aTotal);
+}
+
+/*
+ * The item (and its price), then if a deal changed the price, the deal (and the new price):
+ *
+ *   Sandwich1      (175)
+ *   Tesco Meal De... 100
+ */
+void ReceiptWriter::textLine(const Checkout::ReceiptLine& aLine)
+{
+	const Deal* deal = std::get<0>(aLine);
+	const Item& item = std::get<1>(aLine);
+	int price = std::get<2>(aLine);
+	bool dealPrice = deal && item.iUnitPrice != price;
+
+	char line[kMaxWidth + 1];
+	std::memset(line, ' ', iWidth);
+	line[iWidth] = '\n';
+	item.iName.copy(line, iWidth);
+
+	// The original price is in brackets if the deal changed it
+	char priceText[14];
+	int priceLength;
+	if (dealPrice)
+	{
+		priceText[0] = '(';
+		priceLength = 1 + formatInt(priceText + 1, item.iUnitPrice);
+		priceText[priceLength++] = ')';
+	}
+	else
+	{
+		priceLength = formatInt(priceText, deal ? item.iUnitPrice : price);
+	}
+	placeRight(line, iWidth, priceText, priceLength);
+	iSink.write(line, iWidth + 1);
+
+	if (!dealPrice)
+	{
+		return;
+	}
+
+	std::memset(line, ' ', iWidth);
+	int nameLength = std::min((int)deal->writeName(line, iWidth), iWidth);
+	priceLength = formatInt(priceText, price);
+
+	// Show the name has been cut off, if it runs into the price
+	if (nameLength + priceLength + 1 > iWidth - priceLength && iWidth - priceLength - 4 >= 0)
+	{
+		std::memcpy(line + iWidth - priceLength - 4, "... ", 4);
+	}
+	placeRight(line, iWidth, priceText, priceLength);
+	iSink.write(line, iWidth + 1);
+}
+
+void ReceiptWriter::jsonLine(const Checkout::ReceiptLine& aLine)
+{
+	const Deal* deal = std::get<0>(aLine);
+	const Item& item = std::get<1>(aLine);
+
+	writeText(iSink, iFirstLine ? "{\"id\":" : ",{\"id\":");
+	writeInt(iSink, item.iId);
+	writeText(iSink, ",\"name\":");
+	writeJsonString(iSink, item.iName.data(), item.iName.size());
+	writeText(iSink, ",\"unitPrice\":");
+	writeInt(iSink, item.iUnitPrice);
+	writeText(iSink, ",\"price\":");
+	writeInt(iSink, std::get<2>(aLine));
+	if (deal)
+	{
+		char name[kMaxWidth];
+		size_t nameLength = std::min(deal->writeName(name, kMaxWidth), (size_t)kMaxWidth);
+		writeText(iSink, ",\"deal\":");
+		writeJsonString(iSink, name, nameLength);
+	}
+	writeText(iSink, "}");
+}
+
+void ReceiptWriter::binaryLine(const Checkout::ReceiptLine& aLine)
+{
+	const Deal* deal = std::get<0>(aLine);
+	const Item& item = std::get<1>(aLine);
+
+	char record[1 + 3 * sizeof(int32_t) + 1 + kMaxWidth];
+	char* end = put<uint8_t>(record, 1);
+	end = put<int32_t>(end, item.iId);
+	end = put<int32_t>(end, item.iUnitPrice);
+	end = put<int32_t>(end, std::get<2>(aLine));
+
+	size_t nameLength = deal ? std::min(deal->writeName(end + 1, kMaxWidth), (size_t)kMaxWidth) : 0;
+	end = put<uint8_t>(end, nameLength);
+	iSink.write(record, end + nameLength - record);
+}
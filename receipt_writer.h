@@ -0,0 +1,91 @@
+#pragma once
+
+#include <string>
+
+#include "checkout.h"
+
+/*
+ * Where a ReceiptWriter puts its output.
+ */
+class ReceiptSink
+{
+public:
+	virtual ~ReceiptSink() {};
+	virtual void write(const char* aData, size_t aSize) = 0;
+};
+
+// A buffer owned by the caller. Output past its end is dropped (see overflowed()).
+class BufferSink : public ReceiptSink
+{
+public:
+	BufferSink(char* aBuffer, size_t aCapacity) : iBuffer(aBuffer), iCapacity(aCapacity) {};
+
+	virtual void write(const char* aData, size_t aSize);
+
+	size_t size() const { return iSize; };
+	bool overflowed() const { return iOverflowed; };
+	void clear() { iSize = 0; iOverflowed = false; };
+
+private:
+	char* iBuffer;
+	size_t iCapacity;
+	size_t iSize{ 0 };
+	bool iOverflowed{ false };
+};
+
+// Appends to a string (which only allocates as it grows, so it can be reused)
+class StringSink : public ReceiptSink
+{
+public:
+	StringSink(std::string& aString) : iString(aString) {};
+
+	virtual void write(const char* aData, size_t aSize) { iString.append(aData, aSize); };
+
+private:
+	std::string& iString;
+};
+
+enum ReceiptFormat
+{
+	EReceiptText = 0,	// the fixed width printed receipt (as Checkout::createReceipt)
+	EReceiptJson = 1,	// one JSON object per receipt, on one line
+	EReceiptBinary = 2	// records in host byte order, see ReceiptWriter
+};
+
+/*
+ * Formats receipts straight into a ReceiptSink, without allocating.
+ * Lines are formatted on the stack (so the text width is at most kMaxWidth)
+ * and deal names are written with Deal::writeName.
+ *
+ * The receipt can be written a line at a time (begin, line..., end) or all at once (write).
+ *
+ * JSON:   {"lines":[{"id":1,"name":"Sandwich1","unitPrice":175,"price":100,"deal":"Tesco Meal Deal"},...],"total":885}
+ * Binary: per line: uint8 1, int32 id, int32 unit price, int32 price, uint8 deal name length, deal name
+ *         then: uint8 2, int32 total
+ * Deal names longer than kMaxWidth are cut short in JSON and binary.
+ */
+class ReceiptWriter
+{
+public:
+	static constexpr int kMaxWidth = 255;
+
+	ReceiptWriter(ReceiptSink& aSink, ReceiptFormat aFormat = EReceiptText, int aWidth = Checkout::RECEIPT_WIDTH);
+
+	void begin();
+	void line(const Checkout::ReceiptLine& aLine);
+	void end(int aTotal);
+
+	void write(const std::vector<Checkout::ReceiptLine>& aLines, int aTotal);
+
+	int width() const { return iWidth; };
+
+private:
+	void textLine(const Checkout::ReceiptLine& aLine);
+	void jsonLine(const Checkout::ReceiptLine& aLine);
+	void binaryLine(const Checkout::ReceiptLine& aLine);
+
+	ReceiptSink& iSink;
+	ReceiptFormat iFormat;
+	int iWidth;
+	bool iFirstLine{ true };
+};
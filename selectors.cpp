@@ -1,6 +1,35 @@
 #include "selectors.h"
 #include <algorithm>
 
+// Adapter for selectors which only implement select(): each item selected is the first available line equal to it
+void Selector::selectLines(const BasketView& aBasket, std::vector<int>& aLines)
+{
+	std::vector<Item> items;
+	for (int line = 0; line < aBasket.iSize; ++line)
+	{
+		if (aBasket.available(line))
+		{
+			items.push_back(aBasket.iItems[line]);
+		}
+	}
+
+	std::vector<Item> selected = select(items);
+	std::vector<unsigned char> taken(aBasket.iConsumed, aBasket.iConsumed + aBasket.iSize);
+	aLines.clear();
+	for (const Item& item : selected)
+	{
+		for (int line = 0; line < aBasket.iSize; ++line)
+		{
+			if (!taken[line] && aBasket.iItems[line] == item)
+			{
+				taken[line] = 1;
+				aLines.push_back(line);
+				break;
+			}
+		}
+	}
+}
+
 // Select a (1) specific item
 std::vector<Item> SingleItemSelector::select(std::vector<Item>& aItems)
 {
@@ -17,11 +46,44 @@ std::vector<Item> SingleItemSelector::select(std::vector<Item>& aItems)
 	return result;
 }
 
+void SingleItemSelector::selectLines(const BasketView& aBasket, std::vector<int>& aLines)
+{
+	aLines.clear();
+	for (int line = 0; line < aBasket.iSize; ++line)
+	{
+		if (aBasket.available(line) && aBasket.iItems[line] == iSelectionItem)
+		{
+			aLines.push_back(line);
+			return;
+		}
+	}
+}
+
 bool SingleItemSelector::includesItem(const Item & aItem) const
 {
 	return const_cast<Item&>(aItem) == iSelectionItem;
 }
 
+bool SingleItemSelector::signature(std::vector<int>& aSignature) const
+{
+	aSignature = { 1, iSelectionItem.iId, iSelectionItem.iUnitPrice };
+	return true;
+}
+
+bool SingleItemSelector::coveredIds(std::set<int>& aIds) const
+{
+	aIds.insert(iSelectionItem.iId);
+	return true;
+}
+
+bool SingleItemSelector::eligibilityRule(ItemCountRule& aRule) const
+{
+	aRule.iIds = std::set<int>{ iSelectionItem.iId };
+	aRule.iUnitPrice = iSelectionItem.iUnitPrice;
+	aRule.iCount = 1;
+	return true;
+}
+
 // Select #X of Item-Y
 std::vector<Item> CountedSpecificItemSelector::select(std::vector<Item>& aItems)
 {
@@ -48,6 +110,40 @@ std::vector<Item> CountedSpecificItemSelector::select(std::vector<Item>& aItems)
 	return result;
 }
 
+void CountedSpecificItemSelector::selectLines(const BasketView& aBasket, std::vector<int>& aLines)
+{
+	aLines.clear();
+	for (int line = 0; line < aBasket.iSize; ++line)
+	{
+		if (aBasket.available(line) && aBasket.iItems[line] == iSelectionItem)
+		{
+			aLines.push_back(line);
+			if ((int)aLines.size() >= iSelectionCount)
+			{
+				break;
+			}
+		}
+	}
+
+	if ((int)aLines.size() < iSelectionCount)
+	{
+		aLines.clear();
+	}
+}
+
+bool CountedSpecificItemSelector::signature(std::vector<int>& aSignature) const
+{
+	aSignature = { 2, iSelectionItem.iId, iSelectionItem.iUnitPrice, iSelectionCount };
+	return true;
+}
+
+bool CountedSpecificItemSelector::eligibilityRule(ItemCountRule& aRule) const
+{
+	SingleItemSelector::eligibilityRule(aRule);
+	aRule.iCount = std::max(1, iSelectionCount); // (a count of 0 still selects one item)
+	return true;
+}
+
 // Select any #X from [a,b,c,...]
 std::vector<Item> CountedAnyInSetSelector::select(std::vector<Item>& aItems)
 {
@@ -76,6 +172,40 @@ std::vector<Item> CountedAnyInSetSelector::select(std::vector<Item>& aItems)
 	return result;
 }
 
+bool CountedAnyInSetSelector::signature(std::vector<int>& aSignature) const
+{
+	setSignature(4, aSignature);
+	aSignature.push_back(iSelectionCount);
+	return true;
+}
+
+void CountedAnyInSetSelector::selectLines(const BasketView& aBasket, std::vector<int>& aLines)
+{
+	aLines.clear();
+	for (int line = 0; line < aBasket.iSize; ++line)
+	{
+		if (aBasket.available(line))
+		{
+			aLines.push_back(line);
+		}
+	}
+	takeCounted(aBasket, aLines);
+}
+
+// (in place: matches are moved to the front)
+void CountedAnyInSetSelector::takeCounted(const BasketView& aBasket, std::vector<int>& aLines) const
+{
+	int count = 0;
+	for (int candidate = 0; candidate < aLines.size() && count < iSelectionCount; ++candidate)
+	{
+		if (iSelectionSet.count(aBasket.iItems[aLines[candidate]]))
+		{
+			aLines[count++] = aLines[candidate];
+		}
+	}
+	aLines.resize(count < iSelectionCount ? 0 : count);
+}
+
 // Select #X cheapest from [a,b,c,...]
 std::vector<Item> CountedCheapestInSetSelector::select(std::vector<Item>& aItems)
 {
@@ -84,6 +214,31 @@ std::vector<Item> CountedCheapestInSetSelector::select(std::vector<Item>& aItems
 	return CountedAnyInSetSelector::select(sorted);
 }
 
+// (SingleInSetSelector selects as this does, with a count of 1, so it has the same signature)
+bool CountedCheapestInSetSelector::signature(std::vector<int>& aSignature) const
+{
+	setSignature(5, aSignature);
+	aSignature.push_back(iSelectionCount);
+	return true;
+}
+
+// (the lines are sorted as select() sorts the items, so the same items are selected)
+void CountedCheapestInSetSelector::selectLines(const BasketView& aBasket, std::vector<int>& aLines)
+{
+	aLines.clear();
+	for (int line = 0; line < aBasket.iSize; ++line)
+	{
+		if (aBasket.available(line))
+		{
+			aLines.push_back(line);
+		}
+	}
+
+	const Item* items = aBasket.iItems;
+	std::sort(aLines.begin(), aLines.end(), [items](int aLine, int aOther) { return items[aLine] < items[aOther]; });
+	takeCounted(aBasket, aLines);
+}
+
 // Select (1) from [a,b,c,...]
 std::vector<Item> SingleInSetSelector::select(std::vector<Item>& aItems)
 {
@@ -105,7 +260,281 @@ std::vector<Item> GreedyAnyInSetSelector::select(std::vector<Item>& aItems)
 	return result;
 }
 
+void GreedyAnyInSetSelector::selectLines(const BasketView& aBasket, std::vector<int>& aLines)
+{
+	aLines.clear();
+	for (int line = 0; line < aBasket.iSize; ++line)
+	{
+		if (aBasket.available(line) && iSelectionSet.count(aBasket.iItems[line]))
+		{
+			aLines.push_back(line);
+		}
+	}
+}
+
+bool GreedyAnyInSetSelector::signature(std::vector<int>& aSignature) const
+{
+	setSignature(3, aSignature);
+	return true;
+}
+
+bool CategorySelector::includesItem(const Item& aItem) const
+{
+	return iTaxonomy.inCategory(aItem.iId, iCategory, iSubtree);
+}
+
+void CategorySelector::categorySignature(int aKind, std::vector<int>& aSignature) const
+{
+	aSignature = { aKind, iTaxonomy.id(), iCategory, iSubtree ? 1 : 0 };
+}
+
+std::vector<Item> GreedyInCategorySelector::select(std::vector<Item>& aItems)
+{
+	std::vector<Item> result{};
+	for (Item& item : aItems)
+	{
+		if (includesItem(item))
+		{
+			result.push_back(item);
+		}
+	}
+	return result;
+}
+
+void GreedyInCategorySelector::selectLines(const BasketView& aBasket, std::vector<int>& aLines)
+{
+	aLines.clear();
+	for (int line = 0; line < aBasket.iSize; ++line)
+	{
+		if (aBasket.available(line) && includesItem(aBasket.iItems[line]))
+		{
+			aLines.push_back(line);
+		}
+	}
+}
+
+bool GreedyInCategorySelector::signature(std::vector<int>& aSignature) const
+{
+	categorySignature(6, aSignature);
+	return true;
+}
+
+std::vector<Item> CountedInCategorySelector::select(std::vector<Item>& aItems)
+{
+	std::vector<Item> result{};
+	for (Item& item : aItems)
+	{
+		if ((int)result.size() >= iSelectionCount)
+		{
+			break;
+		}
+		if (includesItem(item))
+		{
+			result.push_back(item);
+		}
+	}
+
+	if ((int)result.size() < iSelectionCount)
+	{
+		return std::vector<Item> {};
+	}
+	return result;
+}
+
+void CountedInCategorySelector::selectLines(const BasketView& aBasket, std::vector<int>& aLines)
+{
+	aLines.clear();
+	for (int line = 0; line < aBasket.iSize; ++line)
+	{
+		if (aBasket.available(line))
+		{
+			aLines.push_back(line);
+		}
+	}
+	takeCounted(aBasket, aLines);
+}
+
+// (in place: matches are moved to the front)
+void CountedInCategorySelector::takeCounted(const BasketView& aBasket, std::vector<int>& aLines) const
+{
+	int count = 0;
+	for (int candidate = 0; candidate < (int)aLines.size() && count < iSelectionCount; ++candidate)
+	{
+		if (includesItem(aBasket.iItems[aLines[candidate]]))
+		{
+			aLines[count++] = aLines[candidate];
+		}
+	}
+	aLines.resize(count < iSelectionCount ? 0 : count);
+}
+
+bool CountedInCategorySelector::signature(std::vector<int>& aSignature) const
+{
+	categorySignature(7, aSignature);
+	aSignature.push_back(iSelectionCount);
+	return true;
+}
+
+std::vector<Item> CountedCheapestInCategorySelector::select(std::vector<Item>& aItems)
+{
+	std::vector<Item> sorted = aItems;
+	std::sort(sorted.begin(), sorted.end());
+	return CountedInCategorySelector::select(sorted);
+}
+
+// (sorted as select() sorts, as CountedCheapestInSetSelector::selectLines)
+void CountedCheapestInCategorySelector::selectLines(const BasketView& aBasket, std::vector<int>& aLines)
+{
+	aLines.clear();
+	for (int line = 0; line < aBasket.iSize; ++line)
+	{
+		if (aBasket.available(line))
+		{
+			aLines.push_back(line);
+		}
+	}
+
+	const Item* items = aBasket.iItems;
+	std::sort(aLines.begin(), aLines.end(), [items](int aLine, int aOther) { return items[aLine] < items[aOther]; });
+	takeCounted(aBasket, aLines);
+}
+
+bool CountedCheapestInCategorySelector::signature(std::vector<int>& aSignature) const
+{
+	categorySignature(8, aSignature);
+	aSignature.push_back(iSelectionCount);
+	return true;
+}
+
 bool ManyItemSelector::includesItem(const Item & aItem) const
 {
 	return iSelectionSet.count(aItem);
 }
+
+void ManyItemSelector::setSignature(int aKind, std::vector<int>& aSignature) const
+{
+	aSignature.clear();
+	aSignature.push_back(aKind);
+	for (const Item& item : iSelectionSet)
+	{
+		aSignature.push_back(item.iId);
+		aSignature.push_back(item.iUnitPrice);
+	}
+}
+
+SelectionCache::SelectionCache(size_t aCapacity) :
+	iCapacity(1)
+{
+	while (iCapacity < aCapacity)
+	{
+		iCapacity *= 2;
+	}
+}
+
+/*
+ Results are keyed by the selector's id (shared by selectors with the same signature)
+ and which lines are available, and checked against both (not just the hash).
+ */
+void SelectionCache::selectLines(Selector& aSelector, const BasketView& aBasket, std::vector<int>& aLines)
+{
+	if (aBasket.iItems != iItems)
+	{
+		clear();
+		iItems = aBasket.iItems;
+	}
+	if (iTable.empty())
+	{
+		iTable.resize(iCapacity);
+	}
+
+	int id = selectorId(aSelector);
+	size_t hash = 14695981039346656037ull ^ (size_t)id;
+	for (int line = 0; line < aBasket.iSize; ++line)
+	{
+		hash = (hash ^ (aBasket.available(line) ? 1 : 0)) * 1099511628211ull;
+	}
+
+	Entry& entry = iTable[hash & (iCapacity - 1)];
+	if (entry.iId == id && entry.iHash == hash && sameLines(entry, aBasket))
+	{
+		++iHits;
+		aLines.assign(iLines.begin() + entry.iLines, iLines.begin() + entry.iLines + entry.iCount);
+		return;
+	}
+
+	++iMisses;
+	aSelector.selectLines(aBasket, aLines);
+
+	// Start the arenas again once they hold as much as a full table of 64 line baskets
+	if (iAvailable.size() + aBasket.iSize > iCapacity * 64)
+	{
+		iAvailable.clear();
+		iLines.clear();
+		std::fill(iTable.begin(), iTable.end(), Entry());
+	}
+
+	entry.iId = id;
+	entry.iHash = hash;
+	entry.iAvailable = iAvailable.size();
+	entry.iLines = iLines.size();
+	entry.iSize = aBasket.iSize;
+	entry.iCount = (int)aLines.size();
+	for (int line = 0; line < aBasket.iSize; ++line)
+	{
+		iAvailable.push_back(aBasket.available(line) ? 1 : 0);
+	}
+	iLines.insert(iLines.end(), aLines.begin(), aLines.end());
+}
+
+bool SelectionCache::sameLines(const Entry& aEntry, const BasketView& aBasket) const
+{
+	if (aEntry.iSize != aBasket.iSize)
+	{
+		return false;
+	}
+	const unsigned char* available = iAvailable.data() + aEntry.iAvailable;
+	for (int line = 0; line < aBasket.iSize; ++line)
+	{
+		if (available[line] != (aBasket.available(line) ? 1 : 0))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+int SelectionCache::selectorId(Selector& aSelector)
+{
+	auto find = iIds.find(&aSelector);
+	if (find != iIds.end())
+	{
+		return find->second;
+	}
+
+	// (a new id is the number of selectors seen so far)
+	int id = (int)iIds.size();
+	if (aSelector.signature(iSignature))
+	{
+		auto same = iSignatures.find(iSignature);
+		if (same != iSignatures.end())
+		{
+			id = same->second;
+		}
+		else
+		{
+			iSignatures[iSignature] = id;
+		}
+	}
+	iIds[&aSelector] = id;
+	return id;
+}
+
+void SelectionCache::clear()
+{
+	iItems = nullptr;
+	iIds.clear();
+	iSignatures.clear();
+	iTable.clear();
+	iAvailable.clear();
+	iLines.clear();
+}
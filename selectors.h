@@ -1,11 +1,14 @@
 #pragma once
 
 #include <set>
+#include <map>
+#include <unordered_map>
 #include <vector>
 #include <tuple>
 #include <memory>
 
 #include "item.hpp"
+#include "item_taxonomy.h"
 #include "deal.h"
 
 // Abstract Selector
@@ -14,6 +17,20 @@ class Selector
 public:
 	virtual std::vector<Item> select(std::vector<Item>& aItems) = 0;
 	virtual bool includesItem(const Item&) const = 0;
+
+	// As select(), on the available lines of aBasket, without copying items: aLines is set to the lines selected (empty if none).
+	// By default the available items are copied and passed to select().
+	virtual void selectLines(const BasketView& aBasket, std::vector<int>& aLines);
+
+	// Adds the ids of the items this selector can match. Returns false if they cannot be listed.
+	virtual bool coveredIds(std::set<int>&) const { return false; };
+
+	// The items select() needs to find anything. Returns false if not known.
+	virtual bool eligibilityRule(ItemCountRule&) const { return false; };
+
+	// Describes what this selector selects: selectors with the same signature select the same lines of any basket.
+	// Returns false if it cannot be described (it is then only the same as itself).
+	virtual bool signature(std::vector<int>&) const { return false; };
 };
 
 // --------------
@@ -25,7 +42,13 @@ public:
 	SingleItemSelector(Item& aItem) : Selector(), iSelectionItem(aItem) {};
 
 	virtual std::vector<Item> select(std::vector<Item>& aItems);
+	virtual void selectLines(const BasketView& aBasket, std::vector<int>& aLines);
 	virtual bool includesItem(const Item&) const;
+	virtual bool coveredIds(std::set<int>& aIds) const;
+	virtual bool eligibilityRule(ItemCountRule& aRule) const;
+	virtual bool signature(std::vector<int>& aSignature) const;
+
+	const Item& item() const { return iSelectionItem; };
 protected:
 	Item& iSelectionItem;
 };
@@ -43,6 +66,11 @@ public:
 	};
 
 	virtual std::vector<Item> select(std::vector<Item>& aItems);
+	virtual void selectLines(const BasketView& aBasket, std::vector<int>& aLines);
+	virtual bool eligibilityRule(ItemCountRule& aRule) const;
+	virtual bool signature(std::vector<int>& aSignature) const;
+
+	int selectionCount() const { return iSelectionCount; };
 private:
 	int iSelectionCount;
 };
@@ -56,8 +84,12 @@ public:
 protected:
 	ManyItemSelector(std::set<Item>& aSelection) : iSelectionSet(aSelection) {};
 	
+	// NB: std::set<Item> is ordered (and so matched) by unit price, so the items cannot be listed by id (coveredIds)
 	virtual bool includesItem(const Item&) const;
 
+	// aKind, then the set's items
+	void setSignature(int aKind, std::vector<int>& aSignature) const;
+
 	std::set<Item>& iSelectionSet;
 };
 
@@ -69,6 +101,8 @@ public:
 	{};
 
 	virtual std::vector<Item> select(std::vector<Item>& aItems);
+	virtual void selectLines(const BasketView& aBasket, std::vector<int>& aLines);
+	virtual bool signature(std::vector<int>& aSignature) const;
 };
 
 /*
@@ -83,6 +117,12 @@ public:
 
 	int iSelectionCount;
 	virtual std::vector<Item> select(std::vector<Item>& aItems);
+	virtual void selectLines(const BasketView& aBasket, std::vector<int>& aLines);
+	virtual bool signature(std::vector<int>& aSignature) const;
+
+protected:
+	// Keeps the first iSelectionCount of the candidate lines in aLines which are in the set (or none if there are not enough)
+	void takeCounted(const BasketView& aBasket, std::vector<int>& aLines) const;
 };
 
 /*
@@ -96,6 +136,8 @@ public:
 	{};
 
 	virtual std::vector<Item> select(std::vector<Item>& aItems);
+	virtual void selectLines(const BasketView& aBasket, std::vector<int>& aLines);
+	virtual bool signature(std::vector<int>& aSignature) const;
 };
 
 /*
@@ -111,6 +153,77 @@ public:
 	virtual std::vector<Item> select(std::vector<Item>& aItems);
 };
 
+/*
+ * Abstract: matches items by their category in an ItemTaxonomy (aCategory, or for aSubtree anything below it too),
+ * instead of listing them. Items are looked up as baskets are checked, so items filed later are matched too.
+ * The items cannot be listed (coveredIds), so catalogs check these deals for every basket.
+ */
+class CategorySelector : public Selector
+{
+public:
+	virtual bool includesItem(const Item& aItem) const;
+
+	int category() const { return iCategory; };
+	bool subtree() const { return iSubtree; };
+protected:
+	CategorySelector(const ItemTaxonomy& aTaxonomy, int aCategory, bool aSubtree) :
+		iTaxonomy(aTaxonomy), iCategory(aCategory), iSubtree(aSubtree)
+	{};
+
+	// aKind, then the taxonomy and category
+	void categorySignature(int aKind, std::vector<int>& aSignature) const;
+
+	const ItemTaxonomy& iTaxonomy;
+	int iCategory;
+	bool iSubtree;
+};
+
+// Matches every item in the category (as GreedyAnyInSetSelector)
+class GreedyInCategorySelector : public CategorySelector
+{
+public:
+	GreedyInCategorySelector(const ItemTaxonomy& aTaxonomy, int aCategory, bool aSubtree = true) :
+		CategorySelector(aTaxonomy, aCategory, aSubtree)
+	{};
+
+	virtual std::vector<Item> select(std::vector<Item>& aItems);
+	virtual void selectLines(const BasketView& aBasket, std::vector<int>& aLines);
+	virtual bool signature(std::vector<int>& aSignature) const;
+};
+
+// Matches the first aCount items in the category, or none if there are not that many (as CountedAnyInSetSelector)
+class CountedInCategorySelector : public CategorySelector
+{
+public:
+	CountedInCategorySelector(const ItemTaxonomy& aTaxonomy, int aCategory, int aCount, bool aSubtree = true) :
+		CategorySelector(aTaxonomy, aCategory, aSubtree), iSelectionCount(aCount)
+	{};
+
+	virtual std::vector<Item> select(std::vector<Item>& aItems);
+	virtual void selectLines(const BasketView& aBasket, std::vector<int>& aLines);
+	virtual bool signature(std::vector<int>& aSignature) const;
+
+	int selectionCount() const { return iSelectionCount; };
+protected:
+	// Keeps the first iSelectionCount of the candidate lines in aLines which are in the category (or none if there are not enough)
+	void takeCounted(const BasketView& aBasket, std::vector<int>& aLines) const;
+
+	int iSelectionCount;
+};
+
+// Matches the aCount cheapest items in the category (as CountedCheapestInSetSelector)
+class CountedCheapestInCategorySelector : public CountedInCategorySelector
+{
+public:
+	CountedCheapestInCategorySelector(const ItemTaxonomy& aTaxonomy, int aCategory, int aCount, bool aSubtree = true) :
+		CountedInCategorySelector(aTaxonomy, aCategory, aCount, aSubtree)
+	{};
+
+	virtual std::vector<Item> select(std::vector<Item>& aItems);
+	virtual void selectLines(const BasketView& aBasket, std::vector<int>& aLines);
+	virtual bool signature(std::vector<int>& aSignature) const;
+};
+
 
 
 // ---- Combining Selectors:
@@ -214,3 +327,56 @@ private:
 
 };
 
+/*
+ * Shares selector results between the SmartDeals evaluated on one basket.
+ *
+ * Meal deal variants tend to reuse the same selectors (or selectors with the same definition, see Selector::signature).
+ * Each distinct selector is run once per set of available lines, and the lines it selected are
+ * handed to every other deal which asks the same selector (or an identical one) about the same lines.
+ * Selectors must depend only on the available items (as all of these do).
+ *
+ * For one basket at a time (it is cleared when used with another), and one thread.
+ * Results are kept in a table of aCapacity slots (rounded up to a power of two), a new result replacing the one in its slot,
+ * and copied into two arenas, so nothing is allocated once they have grown.
+ */
+class SelectionCache
+{
+public:
+	SelectionCache(size_t aCapacity = 256);
+
+	// As aSelector.selectLines(aBasket, aLines)
+	void selectLines(Selector& aSelector, const BasketView& aBasket, std::vector<int>& aLines);
+
+	void clear();
+
+	long hits() const { return iHits; };
+	long misses() const { return iMisses; };
+
+private:
+	struct Entry
+	{
+		int iId{ -1 };			// selector (-1: empty)
+		size_t iHash{ 0 };		// of iId and the available lines
+		size_t iAvailable{ 0 };	// in iAvailable: the available lines (one byte per line)
+		size_t iLines{ 0 };		// in iLines: the lines selected
+		int iSize{ 0 };			// lines in the basket
+		int iCount{ 0 };		// lines selected
+	};
+
+	int selectorId(Selector& aSelector);
+	bool sameLines(const Entry& aEntry, const BasketView& aBasket) const;
+
+	size_t iCapacity;
+	const Item* iItems{ nullptr };
+
+	std::unordered_map<const Selector*, int> iIds;
+	std::map<std::vector<int>, int> iSignatures;	// <signature, id>
+	std::vector<int> iSignature;
+
+	std::vector<Entry> iTable;
+	std::vector<unsigned char> iAvailable;
+	std::vector<int> iLines;
+
+	long iHits{ 0 };
+	long iMisses{ 0 };
+};
@@ -0,0 +1,97 @@
+#include "thread_pool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t aThreads, size_t aMaxQueued) :
+	iMaxQueued(aMaxQueued)
+{
+	if (aThreads == 0)
+	{
+		aThreads = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	for (size_t t = 0; t < aThreads; ++t)
+	{
+		iThreads.push_back(std::thread(&ThreadPool::run, this));
+	}
+}
+
+// Finishes the tasks already submitted
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(iMutex);
+		iStopping = true;
+	}
+	iTaskReady.notify_all();
+
+	for (std::thread& thread : iThreads)
+	{
+		thread.join();
+	}
+}
+
+void ThreadPool::submit(std::function<void()> aTask)
+{
+	{
+		std::unique_lock<std::mutex> lock(iMutex);
+		iSpace.wait(lock, [this] { return iMaxQueued == 0 || iTasks.size() < iMaxQueued; });
+		iTasks.push_back(std::move(aTask));
+	}
+	iTaskReady.notify_one();
+}
+
+bool ThreadPool::trySubmit(std::function<void()> aTask)
+{
+	{
+		std::lock_guard<std::mutex> lock(iMutex);
+		if (iMaxQueued > 0 && iTasks.size() >= iMaxQueued)
+		{
+			return false;
+		}
+		iTasks.push_back(std::move(aTask));
+	}
+	iTaskReady.notify_one();
+	return true;
+}
+
+void ThreadPool::wait()
+{
+	std::unique_lock<std::mutex> lock(iMutex);
+	iIdle.wait(lock, [this] { return iTasks.empty() && iRunning == 0; });
+}
+
+void ThreadPool::run()
+{
+	while (true)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(iMutex);
+			iTaskReady.wait(lock, [this] { return iStopping || !iTasks.empty(); });
+			if (iTasks.empty())
+			{
+				return; // stopping
+			}
+
+			task = std::move(iTasks.front());
+			iTasks.pop_front();
+			++iRunning;
+		}
+		iSpace.notify_one();
+
+		try
+		{
+			task();
+		}
+		catch (...)
+		{
+			++iFailed;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(iMutex);
+			--iRunning;
+		}
+		iIdle.notify_all();
+	}
+}
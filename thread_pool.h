@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * A fixed number of worker threads running submitted tasks in order.
+ *
+ * The queue of tasks waiting for a thread can be bounded (backpressure): submit then waits for space,
+ * and trySubmit refuses the task, so a caller which must not block (e.g. an event loop) can shed load.
+ *
+ * A task which throws does not take its thread (or the process) down: the exception is dropped and counted in failed().
+ * Tasks whose caller needs the exception must catch it themselves (e.g. into a promise).
+ */
+class ThreadPool
+{
+public:
+	// aThreads = 0: one per hardware thread, aMaxQueued = 0: no limit
+	ThreadPool(size_t aThreads = 0, size_t aMaxQueued = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	void submit(std::function<void()> aTask);
+
+	// As submit, but false (and the task is dropped) if the queue is full
+	bool trySubmit(std::function<void()> aTask);
+
+	// Wait until every task submitted so far has finished
+	void wait();
+
+	size_t size() const { return iThreads.size(); };
+	size_t maxQueued() const { return iMaxQueued; };
+
+	// Tasks which threw
+	size_t failed() const { return iFailed; };
+
+private:
+	void run();
+
+	std::vector<std::thread> iThreads;
+
+	std::mutex iMutex;
+	std::condition_variable iTaskReady;
+	std::condition_variable iIdle;
+	std::condition_variable iSpace;
+	std::deque<std::function<void()>> iTasks;
+	size_t iMaxQueued{ 0 };
+	size_t iRunning{ 0 };
+	std::atomic<size_t> iFailed{ 0 };
+	bool iStopping{ false };
+};